@@ -13,6 +13,9 @@
 /* Constants  */
 /* ---------- */
 
+/* How late the once-a-second monitor may run, so as to share a wakeup with other timers. */
+#define CHILD_PROC_MGR_MONITOR_SLACK    ( IO_SCHEDULER_TIME_ONE_SECOND / 10 )
+
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 /* Type definitions and structures  */
 /* ---------- ---------- ---------- */
@@ -218,7 +221,9 @@ child_proc_mgr_start ( struct _child_proc_mgr * cpmgr, p_io_scheduler_t schedule
     child_proc_mgr_stop ( cpmgr );
   
   cpmgr->monitor_task =
-    io_sched_create_timer_task ( scheduler, IO_SCHEDULER_TIME_ONE_SECOND, (void*) cpmgr, on_monitor_timer );
+    io_sched_create_timer_task ( scheduler, IO_SCHEDULER_TIME_ONE_SECOND, CHILD_PROC_MGR_MONITOR_SLACK, (void*) cpmgr, on_monitor_timer );
+  // Reaping children is housekeeping the rest of the process depends on; keep it ahead of bulk traffic.
+  io_sched_set_task_priority ( cpmgr->monitor_task, IO_SCHEDULER_PRIORITY_CONTROL );
   
   if ( !( io_sched_schedule_task ( cpmgr->monitor_task ) ) ) {
     LOGSVC_ERROR( "Failed to create/schedule monitor I/O task." );
@@ -305,6 +310,11 @@ on_monitor_timer ( p_io_scheduler_task_t task, int errcode )
   p_child_proc_mgr_t cpmgr = AS_PTR_child_proc_mgr( task->user_data );
   p_monitored_proc_t mp;
   
+  if ( errcode == IO_SCHEDULER_ERR_NOT_SCHEDULED ) {
+    LOGSVC_ERROR( "on_monitor_timer(): Monitor I/O task could not be scheduled; child processes are not being reaped." );
+    return IO_SCHEDULER_TASK_COMPLETE;
+  }
+  
   do {
     // See if any child process has exited (get its process id).
     child_pid = waitpid ( 0, &status, WNOHANG );
@@ -0,0 +1,150 @@
+/**
+ * @file    io-sched-backend.h
+ * @author  William Clifford
+ *
+ * Interface between the IO scheduler and the event notification mechanisms it can use to
+ * wait on its file descriptors. Each backend is handed tasks as they are scheduled and
+ * unscheduled, and is asked once per pass through the scheduler loop to wait for activity
+ * and report which tasks became ready. Only the scheduler itself should need this header.
+ **/
+
+#ifndef IO_SCHED_BACKEND_H__
+#define IO_SCHED_BACKEND_H__
+
+/* Include the precompiled header for all the standard library includes and project-wide
+   definitions. */
+#include "gccpch.h"
+
+#include "io-scheduler.h"
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+/**
+ * Operations provided by a backend. The add/remove operations are always called while the
+ * scheduler's task_list_mutex is held; wait is only ever called from the scheduler loop.
+ *
+ * Besides the tasks, every backend must watch scheduler->wakeup_rd_fd for reading, and hand it
+ * to io_sched_clear_wakeup() whenever it is ready.
+ **/
+typedef struct _io_sched_backend {
+  
+  /** Short name of the backend, for logging. */
+  const char * name;
+  
+  /** Sets up any backend state, stored in scheduler->backend_data. */
+  bool_t ( *init ) ( struct _io_scheduler * scheduler );
+  
+  /** Releases the backend state. */
+  void ( *destroy ) ( struct _io_scheduler * scheduler );
+  
+  /** Starts watching the task's file descriptor according to its options. */
+  bool_t ( *add_task ) ( struct _io_scheduler * scheduler, struct _io_scheduler_task * task );
+  
+  /** Stops watching the task's file descriptor. */
+  void ( *remove_task ) ( struct _io_scheduler * scheduler, struct _io_scheduler_task * task );
+  
+  /**
+   * Waits up to time_out nanoseconds for activity (indefinitely when negative), reporting each
+   * ready task through io_sched_mark_task_ready(). Returns the number of ready tasks, or -1
+   * on error.
+   **/
+  int ( *wait ) ( struct _io_scheduler * scheduler, int64_t time_out );
+  
+} io_sched_backend_t;
+
+typedef const struct _io_sched_backend * p_io_sched_backend_t;
+
+#define NIL_IO_SCHED_BACKEND            ((p_io_sched_backend_t) 0)
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+/** Portable backend using select(); limited to FD_SETSIZE descriptors. */
+extern const io_sched_backend_t g_io_sched_select_backend;
+
+#ifdef HAVE_SYS_EPOLL_H
+/** Linux epoll backend; interest is registered once per task rather than on every pass. */
+extern const io_sched_backend_t g_io_sched_epoll_backend;
+#endif
+
+#ifdef HAVE_LINUX_IO_URING_H
+/** Linux io_uring backend; polls are queued on the ring and submitted together once per pass. */
+extern const io_sched_backend_t g_io_sched_uring_backend;
+#endif
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+/**
+ * Called by a backend from within its wait operation once the scheduler's wakeup descriptor has
+ * become readable; consumes the wakeup so that the next wait blocks again.
+ **/
+void io_sched_clear_wakeup ( p_io_scheduler_t scheduler );
+
+/**
+ * Maps a task handle onto its task, for backends that have the kernel hold on to a handle rather
+ * than a pointer; returns NULL when the task has since been released. The caller must hold the
+ * scheduler's task_list_mutex.
+ **/
+p_io_scheduler_task_t io_sched_lookup_handle ( p_io_scheduler_t scheduler, io_sched_handle_t handle );
+
+/**
+ * Called by a backend from within its wait operation to report that a task is ready for the
+ * given subset of its read/write/error options.
+ **/
+void io_sched_mark_task_ready ( p_io_scheduler_task_t io_task, io_task_opts_t ready_opts );
+
+/**
+ * Gives a task back its interest once offloaded work for it has been handed back, or unschedules
+ * it when complete is set; called from the scheduler's own thread.
+ **/
+void io_sched_resume_task ( p_io_scheduler_task_t io_task, bool_t complete );
+
+/**
+ * Suspends a task's interest with the backend and its timeout while work for it is out with the
+ * worker pool; called from the scheduler's own thread. Returns false if the task is leaving.
+ **/
+bool_t io_sched_suspend_task ( p_io_scheduler_task_t io_task );
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+/* The slow-callback watchdog (io-sched-watchdog.c), likewise only for the scheduler itself. */
+
+/**
+ * Marks the calling thread as running (or no longer running) the scheduler's loop, so that the
+ * watchdog can have it take its own backtrace.
+ **/
+void io_sched_watchdog_attach ( p_io_scheduler_t scheduler, bool_t attach );
+
+/**
+ * Logs a callback that has returned after running over the scheduler's watchdog_budget.
+ **/
+void io_sched_watchdog_overran ( p_io_scheduler_t scheduler, fd_t fd, io_scheduler_cbk_t cbk, int64_t elapsed );
+
+/**
+ * Starts the watchdog's monitor thread for a scheduler whose watchdog_budget has been set.
+ * Returns false if it could not be started.
+ **/
+bool_t io_sched_watchdog_start ( p_io_scheduler_t scheduler, bool_t want_backtrace );
+
+/**
+ * Stops the watchdog's monitor thread, if there is one, and releases the watchdog.
+ **/
+void io_sched_watchdog_stop ( p_io_scheduler_t scheduler );
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+/* The worker pool behind io_sched_offload() (io-sched-pool.c). */
+
+/**
+ * Starts num_workers worker threads for the scheduler. Returns false if they could not be started.
+ **/
+bool_t io_sched_pool_start ( p_io_scheduler_t scheduler, size_t num_workers );
+
+/**
+ * Stops and joins the scheduler's workers, if it has any, hands back whatever work is still
+ * outstanding, and releases the pool.
+ **/
+void io_sched_pool_stop ( p_io_scheduler_t scheduler );
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+#endif /* IO_SCHED_BACKEND_H__ */
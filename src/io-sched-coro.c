@@ -0,0 +1,433 @@
+/**
+ * @file    io-sched-coro.c
+ * @author  William Clifford
+ **/
+
+#include "io-sched-coro.h"
+#include "tcp_socks.h"
+
+#define CATEGORY_NAME "io-scheduler"
+#include "logging-svc.h"
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local function prototypes        */
+/* ---------- ---------- ---------- */
+
+static void io_sched_coro_connect_cbk ( p_io_scheduler_t scheduler, sock_fd_t sockfd, int errcode, void * userdata );
+
+static bool_t io_sched_coro_read_cbk ( p_io_scheduler_task_t task, int errcode );
+
+static bool_t io_sched_coro_sleep_cbk ( p_io_scheduler_task_t task, int errcode );
+
+static bool_t io_sched_coro_write_cbk ( p_io_scheduler_task_t task, int errcode );
+
+static inline p_io_sched_coro_t inl_io_sched_coro_alloc ( size_t size );
+
+static inline bool_t inl_io_sched_coro_begin ( p_io_sched_coro_t coro, fd_t fd, void * buf, size_t len );
+
+static inline void inl_io_sched_coro_complete ( p_io_sched_coro_t coro, ssize_t result, int errcode );
+
+static inline bool_t inl_io_sched_coro_end ( p_io_sched_coro_t coro );
+
+static inline void inl_io_sched_coro_free ( p_io_sched_coro_t coro );
+
+static inline void inl_io_sched_coro_run ( p_io_sched_coro_t coro );
+
+static inline bool_t inl_io_sched_coro_wait ( p_io_sched_coro_t coro, p_io_scheduler_task_t task );
+
+static inline bool_t inl_io_sched_coro_write_some ( p_io_sched_coro_t coro );
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Module variables      */
+/* ---------- ---------- */
+
+/* Coroutines (header and frame together) are carved out of blocks of IO_SCHED_CORO_MIN_BLOCK
+   bytes, doubling for each size class, a chunk of blocks at a time; anything bigger than the
+   largest class is allocated by itself. */
+#define IO_SCHED_CORO_MIN_BLOCK         256
+#define IO_SCHED_CORO_NUM_CLASSES       4
+#define IO_SCHED_CORO_CHUNK_BLOCKS      16
+#define IO_SCHED_CORO_UNPOOLED          ((unsigned int) IO_SCHED_CORO_NUM_CLASSES)
+
+/* A pooled block while it is free. */
+typedef struct _io_sched_coro_block {
+  struct _io_sched_coro_block *         next;
+} io_sched_coro_block_t, * p_io_sched_coro_block_t;
+
+/* Free blocks of each size class. Blocks are kept for reuse for the life of the process, the
+   pool being sized by the most coroutines ever alive at once. */
+static p_io_sched_coro_block_t coro_free_blocks[ IO_SCHED_CORO_NUM_CLASSES ];
+static pthread_mutex_t mutex_coro_pool = PTHREAD_MUTEX_INITIALIZER;
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Exposed functions     */
+/* ---------- ---------- */
+
+/**
+ * Creates a coroutine on the given scheduler and runs it up to its first await.
+ **/
+bool_t
+io_sched_coro_spawn ( p_io_scheduler_t scheduler, io_sched_coro_fn_t fn,
+                      const void * frame, size_t frame_size,
+                      void * user_data, io_sched_coro_done_fn_t done_fn )
+{
+  p_io_sched_coro_t coro;
+  
+  if ( !(scheduler) || !(fn) )
+    return CMNUTIL_FALSE;
+  
+  coro = inl_io_sched_coro_alloc ( IO_SCHED_CORO_STRUCT_SIZE + frame_size );
+  if ( !(coro) ) {
+    LOGSVC_ERROR( "io_sched_coro_spawn(): Out of memory for a coroutine with a %lu byte frame.", (unsigned long) frame_size );
+    return CMNUTIL_FALSE;
+  }
+  coro->scheduler = scheduler;
+  coro->fn = fn;
+  coro->done_fn = done_fn;
+  coro->user_data = user_data;
+  coro->fd = INVALID_GENERAL_FD;
+  if ( frame )
+    memcpy ( coro->frame, frame, frame_size );
+  
+  inl_io_sched_coro_run ( coro );
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Connects the socket to the given address and port through tcp_connect_timeout_ud().
+ **/
+bool_t
+io_sched_coro_start_connect ( p_io_sched_coro_t coro, sock_fd_t sockfd,
+                              in_addr_t remote_ip, uint16_t remote_port, int timeout_secs )
+{
+  if ( !( inl_io_sched_coro_begin ( coro, sockfd, NULL, 0 ) ) )
+    return CMNUTIL_FALSE;
+  
+  /* May connect at once, in which case the callback has already been made on return. */
+  if ( !( tcp_connect_timeout_ud ( sockfd, remote_ip, remote_port, coro->scheduler, (void *) coro,
+                                   io_sched_coro_connect_cbk, timeout_secs ) ) && !( coro->completed ) )
+    inl_io_sched_coro_complete ( coro, -1, errno ? errno : ECONNREFUSED );
+  return inl_io_sched_coro_end ( coro );
+}
+
+/**
+ * Reads up to len bytes from a non-blocking descriptor, as soon as there are any.
+ **/
+bool_t
+io_sched_coro_start_read ( p_io_sched_coro_t coro, fd_t fd, void * buf, size_t len, int64_t time_out )
+{
+  ssize_t rc;
+  
+  if ( !( inl_io_sched_coro_begin ( coro, fd, buf, len ) ) )
+    return CMNUTIL_FALSE;
+  
+  /* Data already waiting saves a pass through the scheduler loop. */
+  rc = read ( fd, buf, len );
+  if ( rc >= 0 )
+    inl_io_sched_coro_complete ( coro, rc, IO_SCHEDULER_ERR_NONE );
+  else if ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) && ( errno != EINTR ) )
+    inl_io_sched_coro_complete ( coro, -1, errno );
+  else
+    inl_io_sched_coro_wait ( coro, io_sched_create_reader_task ( coro->scheduler, fd, time_out, (void *) coro, io_sched_coro_read_cbk ) );
+  return inl_io_sched_coro_end ( coro );
+}
+
+/**
+ * Waits for time_out nanoseconds to go by.
+ **/
+bool_t
+io_sched_coro_start_sleep ( p_io_sched_coro_t coro, int64_t time_out )
+{
+  if ( !( inl_io_sched_coro_begin ( coro, INVALID_GENERAL_FD, NULL, 0 ) ) )
+    return CMNUTIL_FALSE;
+  
+  if ( time_out < 0 )
+    inl_io_sched_coro_complete ( coro, 0, IO_SCHEDULER_ERR_NONE );
+  else
+    inl_io_sched_coro_wait ( coro, io_sched_create_timer_task ( coro->scheduler, time_out, IO_SCHEDULER_NO_SLACK, (void *) coro, io_sched_coro_sleep_cbk ) );
+  return inl_io_sched_coro_end ( coro );
+}
+
+/**
+ * Writes all len bytes from buf to a non-blocking descriptor.
+ **/
+bool_t
+io_sched_coro_start_write ( p_io_sched_coro_t coro, fd_t fd, const void * buf, size_t len, int64_t time_out )
+{
+  if ( !( inl_io_sched_coro_begin ( coro, fd, (void *) buf, len ) ) )
+    return CMNUTIL_FALSE;
+  
+  /* Whatever the socket buffer takes straight away saves a pass through the scheduler loop. */
+  if ( inl_io_sched_coro_write_some ( coro ) )
+    inl_io_sched_coro_complete ( coro, coro->result, coro->errcode );
+  else
+    inl_io_sched_coro_wait ( coro, io_sched_create_writer_task ( coro->scheduler, fd, time_out, (void *) coro, io_sched_coro_write_cbk ) );
+  return inl_io_sched_coro_end ( coro );
+}
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local functions       */
+/* ---------- ---------- */
+
+/**
+ * tcp_connect_timeout_ud() callback. A failed connection has had its socket closed already, and
+ * a successful one has been put back into blocking mode, which is undone here.
+ **/
+static void
+io_sched_coro_connect_cbk ( p_io_scheduler_t scheduler, sock_fd_t sockfd, int errcode, void * userdata )
+{
+  p_io_sched_coro_t coro = (p_io_sched_coro_t) userdata;
+  
+  if ( errcode == IO_SCHEDULER_ERR_NONE )
+    fcntl ( sockfd, F_SETFL, fcntl ( sockfd, F_GETFL ) | O_NONBLOCK );
+  inl_io_sched_coro_complete ( coro, ( errcode == IO_SCHEDULER_ERR_NONE ) ? 0 : -1, errcode );
+}
+
+/**
+ * Reader task callback; completes the read once there is data, end of file, an error or a timeout.
+ **/
+static bool_t
+io_sched_coro_read_cbk ( p_io_scheduler_task_t task, int errcode )
+{
+  p_io_sched_coro_t coro = (p_io_sched_coro_t) task->user_data;
+  ssize_t rc = -1;
+  
+  if ( errcode == IO_SCHEDULER_ERR_NONE ) {
+    rc = read ( coro->fd, coro->buf, coro->len );
+    if ( rc < 0 ) {
+      if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ) )
+        return IO_SCHEDULER_TASK_INCOMPLETE;
+      errcode = errno;
+    }
+  }
+  /* Out of the way before the coroutine carries on, since it may well read the descriptor again. */
+  io_sched_unschedule_task ( task );
+  inl_io_sched_coro_complete ( coro, rc, errcode );
+  return IO_SCHEDULER_TASK_COMPLETE;
+}
+
+/**
+ * Timer task callback; completes the sleep.
+ **/
+static bool_t
+io_sched_coro_sleep_cbk ( p_io_scheduler_task_t task, int errcode )
+{
+  p_io_sched_coro_t coro = (p_io_sched_coro_t) task->user_data;
+  
+  /* The timeout, for a sleep, is success; anything else is that the timer never started. */
+  if ( errcode == IO_SCHEDULER_ERR_OP_TIMEOUT )
+    errcode = IO_SCHEDULER_ERR_NONE;
+  io_sched_unschedule_task ( task );
+  inl_io_sched_coro_complete ( coro, 0, errcode );
+  return IO_SCHEDULER_TASK_COMPLETE;
+}
+
+/**
+ * Writer task callback; writes whatever the descriptor takes, completing the write once all of it
+ * is out, or on an error or timeout.
+ **/
+static bool_t
+io_sched_coro_write_cbk ( p_io_scheduler_task_t task, int errcode )
+{
+  p_io_sched_coro_t coro = (p_io_sched_coro_t) task->user_data;
+  
+  if ( errcode == IO_SCHEDULER_ERR_NONE ) {
+    if ( !( inl_io_sched_coro_write_some ( coro ) ) )
+      return IO_SCHEDULER_TASK_INCOMPLETE;
+  }
+  else {
+    coro->errcode = errcode;
+  }
+  io_sched_unschedule_task ( task );
+  inl_io_sched_coro_complete ( coro, coro->result, coro->errcode );
+  return IO_SCHEDULER_TASK_COMPLETE;
+}
+
+/**
+ * Takes a zeroed block of at least size bytes from the pool, or from malloc when it is larger than
+ * the largest size class.
+ **/
+static inline p_io_sched_coro_t
+inl_io_sched_coro_alloc ( size_t size )
+{
+  p_io_sched_coro_block_t block;
+  uint8_t * chunk;
+  unsigned int size_class;
+  size_t block_size, ii;
+  
+  for ( size_class = 0, block_size = IO_SCHED_CORO_MIN_BLOCK;
+        ( size_class < IO_SCHED_CORO_NUM_CLASSES ) && ( block_size < size );
+        size_class++, block_size <<= 1 )
+    ;
+  if ( size_class == IO_SCHED_CORO_UNPOOLED ) {
+    block = (p_io_sched_coro_block_t) malloc ( size );
+    block_size = size;
+  }
+  else {
+    LOCK_MUTEX( mutex_coro_pool );
+    if ( !( coro_free_blocks[ size_class ] ) ) {
+      chunk = (uint8_t *) malloc ( block_size * IO_SCHED_CORO_CHUNK_BLOCKS );
+      for ( ii = 0; chunk && ( ii < IO_SCHED_CORO_CHUNK_BLOCKS ); ii++ ) {
+        block = (p_io_sched_coro_block_t) ( chunk + ( ii * block_size ) );
+        block->next = coro_free_blocks[ size_class ];
+        coro_free_blocks[ size_class ] = block;
+      }
+    }
+    block = coro_free_blocks[ size_class ];
+    if ( block )
+      coro_free_blocks[ size_class ] = block->next;
+    UNLOCK_MUTEX( mutex_coro_pool );
+  }
+  
+  if ( !(block) )
+    return NIL_IO_SCHED_CORO;
+  memset ( block, 0, block_size );
+  ( (p_io_sched_coro_t) block )->size_class = size_class;
+  return (p_io_sched_coro_t) block;
+}
+
+/**
+ * Readies the coroutine for an operation on the given descriptor and buffer. Returns false, with
+ * the operation failed, for a coroutine already in the middle of one.
+ **/
+static inline bool_t
+inl_io_sched_coro_begin ( p_io_sched_coro_t coro, fd_t fd, void * buf, size_t len )
+{
+  if ( coro->starting ) {
+    LOGSVC_ERROR( "io_sched_coro_start(): Coroutine is already starting an operation." );
+    coro->result = -1;
+    coro->errcode = EBUSY;
+    return CMNUTIL_FALSE;
+  }
+  coro->fd = fd;
+  coro->buf = buf;
+  coro->len = len;
+  coro->result = 0;
+  coro->errcode = IO_SCHEDULER_ERR_NONE;
+  coro->completed = CMNUTIL_FALSE;
+  coro->starting = CMNUTIL_TRUE;
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Records the outcome of the operation under way, and has the coroutine carry on from its await,
+ * unless the operation is still being started, in which case the await falls straight through.
+ **/
+static inline void
+inl_io_sched_coro_complete ( p_io_sched_coro_t coro, ssize_t result, int errcode )
+{
+  coro->result = result;
+  coro->errcode = errcode;
+  coro->completed = CMNUTIL_TRUE;
+  if ( !( coro->starting ) )
+    inl_io_sched_coro_run ( coro );
+}
+
+/**
+ * Ends the starting of an operation. Returns true while it is pending, in which case the
+ * coroutine returns to the scheduler until the operation completes.
+ **/
+static inline bool_t
+inl_io_sched_coro_end ( p_io_sched_coro_t coro )
+{
+  bool_t pending = !( coro->completed );
+  
+  coro->starting = CMNUTIL_FALSE;
+  return pending;
+}
+
+/**
+ * Returns a coroutine's block to the pool, or to the system for one too big for the pool.
+ **/
+static inline void
+inl_io_sched_coro_free ( p_io_sched_coro_t coro )
+{
+  p_io_sched_coro_block_t block = (p_io_sched_coro_block_t) coro;
+  unsigned int size_class = coro->size_class;
+  
+  if ( size_class == IO_SCHED_CORO_UNPOOLED ) {
+    free ( coro );
+    return;
+  }
+  LOCK_MUTEX( mutex_coro_pool );
+  block->next = coro_free_blocks[ size_class ];
+  coro_free_blocks[ size_class ] = block;
+  UNLOCK_MUTEX( mutex_coro_pool );
+}
+
+/**
+ * Runs the coroutine on to its next await, or to its end, in which case it is done with.
+ **/
+static inline void
+inl_io_sched_coro_run ( p_io_sched_coro_t coro )
+{
+  if ( coro->fn ( coro ) == IO_CORO_DONE ) {
+    if ( coro->done_fn )
+      coro->done_fn ( coro );
+    inl_io_sched_coro_free ( coro );
+  }
+}
+
+/**
+ * Schedules the task the operation under way waits on. Failing that, the operation completes
+ * with ENOMEM when the scheduler could not create a task, ESHUTDOWN when it is draining, or the
+ * error the backend refused the descriptor with.
+ **/
+static inline bool_t
+inl_io_sched_coro_wait ( p_io_sched_coro_t coro, p_io_scheduler_task_t task )
+{
+  int errcode;
+  
+  if ( !(task) ) {
+    inl_io_sched_coro_complete ( coro, -1, ENOMEM );
+    return CMNUTIL_FALSE;
+  }
+  
+  /* The task is only ever dispatched from the scheduler's thread, which the coroutine runs on (or
+     which is yet to start), so it cannot complete before the await has returned. */
+  errno = 0;
+  if ( !( io_sched_schedule_task ( task ) ) ) {
+    errcode = coro->scheduler->draining ? ESHUTDOWN : ( errno ? errno : EIO );
+    /* Never scheduled, the task (and a sleep's timer) goes straight back to the scheduler. */
+    io_sched_unschedule_task ( task );
+    inl_io_sched_coro_complete ( coro, -1, errcode );
+    return CMNUTIL_FALSE;
+  }
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Writes as much of what is left of the write under way as the descriptor takes. Returns true once
+ * the write is over, all of it written or failed, false while more is left to go. Sockets are
+ * written with send() and MSG_NOSIGNAL, so that a peer that has gone away fails the write with
+ * EPIPE rather than raising SIGPIPE; anything else (a pipe, say) falls back to write().
+ **/
+static inline bool_t
+inl_io_sched_coro_write_some ( p_io_sched_coro_t coro )
+{
+  const uint8_t * data;
+  bool_t is_socket = CMNUTIL_TRUE;
+  ssize_t rc;
+  
+  while ( (size_t) coro->result < coro->len ) {
+    data = (const uint8_t *) coro->buf + coro->result;
+    if ( is_socket )
+      rc = send ( coro->fd, data, coro->len - (size_t) coro->result, MSG_NOSIGNAL );
+    else
+      rc = write ( coro->fd, data, coro->len - (size_t) coro->result );
+    if ( rc < 0 ) {
+      if ( errno == EINTR )
+        continue;
+      if ( is_socket && ( errno == ENOTSOCK ) ) {
+        is_socket = CMNUTIL_FALSE;
+        continue;
+      }
+      if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) )
+        return CMNUTIL_FALSE;
+      coro->errcode = errno;
+      return CMNUTIL_TRUE;
+    }
+    coro->result += rc;
+  }
+  return CMNUTIL_TRUE;
+}
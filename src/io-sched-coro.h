@@ -0,0 +1,205 @@
+/**
+ * @file    io-sched-coro.h
+ * @author  William Clifford
+ *
+ * Coroutines on top of the IO scheduler, after the fashion of protothreads. A multi-step
+ * protocol is written as a single function that reads from top to bottom, awaiting reads,
+ * writes, connects and sleeps in turn, instead of as a chain of callbacks handing a state
+ * machine along in user_data. At each await the function returns to the scheduler; once the
+ * operation completes, the scheduler calls it again and it carries on from just after the await.
+ *
+ *   static int
+ *   echo_once ( p_io_sched_coro_t coro )
+ *   {
+ *     echo_frame_t * f = IO_CORO_FRAME( coro, echo_frame_t );
+ *
+ *     IO_CORO_BEGIN( coro );
+ *     IO_CORO_READ( coro, f->fd, f->buf, sizeof( f->buf ), IO_SCHEDULER_TIME_ONE_SECOND );
+ *     if ( IO_CORO_RESULT( coro ) > 0 )
+ *       IO_CORO_WRITE( coro, f->fd, f->buf, IO_CORO_RESULT( coro ), IO_SCHEDULER_TIME_ONE_SECOND );
+ *     IO_CORO_END( coro );
+ *   }
+ *
+ * Being stackless, a coroutine does not keep its local variables across an await; anything it
+ * needs afterwards goes in its frame, which comes with the coroutine from a pool of blocks kept
+ * for reuse, so that neither spawning a coroutine nor any step within it costs a malloc. Awaits
+ * may only be made from the coroutine function itself (not from functions it calls), and at
+ * most one per source line. The resume points are GCC label addresses.
+ *
+ * A coroutine runs up to its first await on the thread that spawns it, and from then on on its
+ * scheduler's thread; spawn it from that thread too, or before the thread is started.
+ **/
+
+#ifndef IO_SCHED_CORO_H__
+#define IO_SCHED_CORO_H__
+
+/* Include the precompiled header for all the standard library includes and project-wide
+   definitions. */
+#include "gccpch.h"
+
+#include "io-scheduler.h"
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+struct _io_sched_coro;
+
+/**
+ * Signature of a coroutine function; returns IO_CORO_PENDING when it has stopped at an await,
+ * IO_CORO_DONE once it has finished. Written with the IO_CORO_* macros, which return for it.
+ **/
+typedef int ( *io_sched_coro_fn_t ) ( struct _io_sched_coro * coro );
+
+/**
+ * Signature of the function called once a coroutine has finished, just before it is freed.
+ **/
+typedef void ( *io_sched_coro_done_fn_t ) ( struct _io_sched_coro * coro );
+
+typedef struct _io_sched_coro {
+  
+  /** Scheduler the coroutine's operations are scheduled on. */
+  p_io_scheduler_t scheduler;
+  
+  /** The coroutine function, and the point in it to carry on from; NULL to start from the top. */
+  io_sched_coro_fn_t fn;
+  void * resume_at;
+  
+  /** Function called once the coroutine has finished, and an application-specific value. */
+  io_sched_coro_done_fn_t done_fn;
+  void * user_data;
+  
+  /**
+   * Outcome of the last operation awaited: the bytes read or written (zero for end of file), and
+   * zero or the error it failed with, IO_SCHEDULER_ERR_OP_TIMEOUT when it ran out of time.
+   **/
+  ssize_t result;
+  int errcode;
+  
+  /** Operation under way: its descriptor, buffer, and the bytes it is to move. */
+  fd_t fd;
+  void * buf;
+  size_t len;
+  
+  /**
+   * Set while an operation is being started, so that one completing there and then does not run
+   * the coroutine from inside itself; and set once the operation has completed.
+   **/
+  bool_t starting;
+  bool_t completed;
+  
+  /** Size class of the pooled block the coroutine was carved out of; see io_sched_coro_spawn(). */
+  unsigned int size_class;
+  
+  /** The coroutine's frame, frame_size bytes, for whatever it keeps across awaits. */
+  uint64_t frame[];
+  
+} io_sched_coro_t;
+
+typedef struct _io_sched_coro * p_io_sched_coro_t;
+
+#define IO_SCHED_CORO_STRUCT_SIZE       (sizeof( struct _io_sched_coro ))
+#define NIL_IO_SCHED_CORO               ((p_io_sched_coro_t) 0)
+
+/* Values a coroutine function returns. */
+#define IO_CORO_PENDING                 0
+#define IO_CORO_DONE                    1
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+#define IO_CORO_LABEL_(line)            io_coro_resume_ ## line
+#define IO_CORO_LABEL(line)             IO_CORO_LABEL_( line )
+
+/** The coroutine's frame, as a pointer to the given type. */
+#define IO_CORO_FRAME(c, type)          ( (type *) (void *) (c)->frame )
+
+/** Bytes moved by, and error from, the last operation awaited. */
+#define IO_CORO_RESULT(c)               ( (c)->result )
+#define IO_CORO_ERROR(c)                ( (c)->errcode )
+
+/** Opens the body of a coroutine function, carrying on from the last await if there was one. */
+#define IO_CORO_BEGIN(c)                                                \
+  do {                                                                  \
+    if ( (c)->resume_at )                                               \
+      goto *( (c)->resume_at );                                         \
+  } while ( 0 )
+
+/** Finishes the coroutine; closes the body of the function, and may also be used to leave early. */
+#define IO_CORO_END(c)                                                  \
+  do {                                                                  \
+    (c)->resume_at = NULL;                                              \
+    return IO_CORO_DONE;                                                \
+  } while ( 0 )
+
+/**
+ * Starts an operation and, unless it completed there and then, returns to the scheduler until
+ * it does. start is one of the io_sched_coro_start_*() calls, true while the operation is pending.
+ **/
+#define IO_CORO_AWAIT(c, start)                                         \
+  do {                                                                  \
+    (c)->resume_at = &&IO_CORO_LABEL( __LINE__ );                       \
+    if ( start )                                                        \
+      return IO_CORO_PENDING;                                           \
+    IO_CORO_LABEL( __LINE__ ): ;                                        \
+  } while ( 0 )
+
+/** Awaits a single read of up to len bytes; see io_sched_coro_start_read(). */
+#define IO_CORO_READ(c, fd, buf, len, time_out) \
+  IO_CORO_AWAIT( c, io_sched_coro_start_read ( c, fd, buf, len, time_out ) )
+
+/** Awaits the writing of all len bytes; see io_sched_coro_start_write(). */
+#define IO_CORO_WRITE(c, fd, buf, len, time_out) \
+  IO_CORO_AWAIT( c, io_sched_coro_start_write ( c, fd, buf, len, time_out ) )
+
+/** Awaits a TCP connection; see io_sched_coro_start_connect(). */
+#define IO_CORO_CONNECT(c, sockfd, remote_ip, remote_port, timeout_secs) \
+  IO_CORO_AWAIT( c, io_sched_coro_start_connect ( c, sockfd, remote_ip, remote_port, timeout_secs ) )
+
+/** Awaits the passing of time_out nanoseconds; see io_sched_coro_start_sleep(). */
+#define IO_CORO_SLEEP(c, time_out) \
+  IO_CORO_AWAIT( c, io_sched_coro_start_sleep ( c, time_out ) )
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+/**
+ * Creates a coroutine on the given scheduler, with a frame of frame_size bytes, and runs it up to
+ * its first await. The frame starts out as a copy of the given one, or zeroed if that is NULL. Coroutines up to a couple of kilobytes, frame included, are carved out of
+ * pooled blocks that are kept for reuse once released; larger ones are allocated by themselves.
+ * done_fn, if given, is called once the coroutine has finished, just before it is freed; it may
+ * run before this returns.
+ * @return True if the coroutine was started (whether or not it has already finished).
+ **/
+bool_t io_sched_coro_spawn ( p_io_scheduler_t scheduler, io_sched_coro_fn_t fn,
+                             const void * frame, size_t frame_size,
+                             void * user_data, io_sched_coro_done_fn_t done_fn );
+
+/**
+ * Connects the socket to the given address (network byte order) and port through
+ * tcp_connect_timeout_ud(), which also closes the socket should the connection fail once under
+ * way. The socket is left non-blocking for the reads and writes to follow.
+ * @return True while the connection is pending; false once it has completed, either way.
+ **/
+bool_t io_sched_coro_start_connect ( p_io_sched_coro_t coro, sock_fd_t sockfd,
+                                     in_addr_t remote_ip, uint16_t remote_port, int timeout_secs );
+
+/**
+ * Reads up to len bytes from a non-blocking descriptor into buf, as soon as there are any, giving
+ * up after time_out nanoseconds (IO_SCHEDULER_NO_TIMEOUT to wait for as long as it takes). The
+ * result is the number of bytes read, zero at end of file.
+ * @return True while the read is pending; false once it has completed.
+ **/
+bool_t io_sched_coro_start_read ( p_io_sched_coro_t coro, fd_t fd, void * buf, size_t len, int64_t time_out );
+
+/**
+ * Waits for time_out nanoseconds to go by; zero lets the scheduler make a pass first.
+ * @return True while the sleep is pending; false for a negative time_out.
+ **/
+bool_t io_sched_coro_start_sleep ( p_io_sched_coro_t coro, int64_t time_out );
+
+/**
+ * Writes all len bytes from buf to a non-blocking descriptor, giving up after time_out
+ * nanoseconds. The result is the number of bytes written, which falls short of len only on error.
+ * A socket whose peer has gone away fails the write with EPIPE, without raising SIGPIPE.
+ * @return True while the write is pending; false once it has completed.
+ **/
+bool_t io_sched_coro_start_write ( p_io_sched_coro_t coro, fd_t fd, const void * buf, size_t len, int64_t time_out );
+
+#endif /* IO_SCHED_CORO_H__ */
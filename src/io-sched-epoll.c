@@ -0,0 +1,305 @@
+/**
+ * @file    io-sched-epoll.c
+ * @author  William Clifford
+ *
+ * epoll backend for the IO scheduler. Interest in a file descriptor is registered with the
+ * kernel once, when its task is scheduled, and dropped when the task is unscheduled; each pass
+ * through the scheduler loop then only touches the descriptors that actually became ready.
+ *
+ * The kernel only allows a descriptor to be registered once per epoll instance, while the
+ * scheduler allows several tasks to share a descriptor (a connect-watching writer task and the
+ * reader task that replaces it, for example). Tasks are therefore chained per descriptor, and
+ * the registered interest is the union of the options of every task in the chain.
+ *
+ * Edge-triggered tasks (IO_SCHEDULER_EDGE) are registered with EPOLLET, so that a descriptor
+ * carrying a sustained stream is reported once per burst of data rather than on every pass.
+ **/
+
+#include "io-sched-backend.h"
+
+#define CATEGORY_NAME "io-scheduler"
+#include "logging-svc.h"
+
+#ifdef HAVE_SYS_EPOLL_H
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Constants  */
+/* ---------- */
+
+/* Max number of events collected by a single call to epoll_wait(); anything beyond this is
+   simply reported on the next pass. */
+#define IO_SCHED_EPOLL_MAX_EVENTS       256
+
+/* Initial number of entries in the per-descriptor task table; grown as needed. */
+#define IO_SCHED_EPOLL_INITIAL_FDS      64
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Type definitions and structures  */
+/* ---------- ---------- ---------- */
+
+typedef struct _io_sched_epoll {
+  fd_t                                  epoll_fd;
+  p_io_scheduler_task_t *               fd_tasks;           /**< @brief Task chains, indexed by descriptor.  **/
+  size_t                                fd_tasks_size;      /**< @brief Number of entries in fd_tasks.       **/
+  struct epoll_event                    events[ IO_SCHED_EPOLL_MAX_EVENTS ];
+} io_sched_epoll_t, * p_io_sched_epoll_t;
+
+#define SIZE_io_sched_epoll             (sizeof( struct _io_sched_epoll ))
+#define NEW_io_sched_epoll()            ( (p_io_sched_epoll_t) malloc ( sizeof( struct _io_sched_epoll ) ) )
+#define NIL_io_sched_epoll              ( (p_io_sched_epoll_t) 0 )
+#define AS_PTR_io_sched_epoll(vp)       ( (p_io_sched_epoll_t) vp )
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local function prototypes        */
+/* ---------- ---------- ---------- */
+
+static bool_t io_sched_epoll_add_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task );
+
+static void io_sched_epoll_destroy ( p_io_scheduler_t scheduler );
+
+static bool_t io_sched_epoll_init ( p_io_scheduler_t scheduler );
+
+static void io_sched_epoll_remove_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task );
+
+static int io_sched_epoll_wait ( p_io_scheduler_t scheduler, int64_t time_out );
+
+static inline uint32_t inl_io_sched_epoll_chain_events ( p_io_scheduler_task_t chain );
+
+static inline bool_t inl_io_sched_epoll_update ( p_io_sched_epoll_t ep, fd_t fd, int op, uint32_t events );
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Shared (global) variables        */
+/* ---------- ---------- ---------- */
+
+const io_sched_backend_t g_io_sched_epoll_backend = {
+  "epoll",
+  io_sched_epoll_init,
+  io_sched_epoll_destroy,
+  io_sched_epoll_add_task,
+  io_sched_epoll_remove_task,
+  io_sched_epoll_wait
+};
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local functions       */
+/* ---------- ---------- */
+
+static bool_t
+io_sched_epoll_add_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task )
+{
+  p_io_sched_epoll_t ep = AS_PTR_io_sched_epoll( scheduler->backend_data );
+  p_io_scheduler_task_t * tmp;
+  size_t new_size;
+  bool_t shared;
+  
+  /* Make sure the per-descriptor table can hold this descriptor. */
+  if ( (size_t) io_task->fd >= ep->fd_tasks_size ) {
+    new_size = ep->fd_tasks_size;
+    while ( new_size <= (size_t) io_task->fd )
+      new_size <<= 1;
+    tmp = (p_io_scheduler_task_t *) realloc ( ep->fd_tasks, new_size * sizeof( p_io_scheduler_task_t ) );
+    if ( !( tmp ) ) {
+      LOGSVC_ERROR( "io_sched_epoll_add_task(): Unable to grow descriptor table to %lu entries.", (unsigned long) new_size );
+      return CMNUTIL_FALSE;
+    }
+    memset ( tmp + ep->fd_tasks_size, 0, ( new_size - ep->fd_tasks_size ) * sizeof( p_io_scheduler_task_t ) );
+    ep->fd_tasks = tmp;
+    ep->fd_tasks_size = new_size;
+  }
+  
+  shared = ( ep->fd_tasks[ io_task->fd ] != NIL_IO_SCHEDULER_TASK );
+  io_task->fd_next = ep->fd_tasks[ io_task->fd ];
+  ep->fd_tasks[ io_task->fd ] = io_task;
+  
+  if ( !( inl_io_sched_epoll_update ( ep, io_task->fd, ( shared ? EPOLL_CTL_MOD : EPOLL_CTL_ADD ),
+                                      inl_io_sched_epoll_chain_events ( ep->fd_tasks[ io_task->fd ] ) ) ) )
+  {
+    ep->fd_tasks[ io_task->fd ] = io_task->fd_next;
+    io_task->fd_next = NIL_IO_SCHEDULER_TASK;
+    return CMNUTIL_FALSE;
+  }
+  
+  return CMNUTIL_TRUE;
+}
+
+static void
+io_sched_epoll_destroy ( p_io_scheduler_t scheduler )
+{
+  p_io_sched_epoll_t ep = AS_PTR_io_sched_epoll( scheduler->backend_data );
+  if ( ep ) {
+    if ( ep->epoll_fd != INVALID_GENERAL_FD )
+      close ( ep->epoll_fd );
+    free ( ep->fd_tasks );
+    free ( ep );
+    scheduler->backend_data = NULL;
+  }
+}
+
+static bool_t
+io_sched_epoll_init ( p_io_scheduler_t scheduler )
+{
+  p_io_sched_epoll_t ep = NEW_io_sched_epoll();
+  if ( !( ep ) )
+    return CMNUTIL_FALSE;
+  memset ( ep, 0, SIZE_io_sched_epoll );
+  scheduler->backend_data = ep;
+  
+  ep->epoll_fd = epoll_create ( IO_SCHED_EPOLL_INITIAL_FDS );
+  if ( ep->epoll_fd == INVALID_GENERAL_FD ) {
+    LOGSVC_ERROR( "io_sched_epoll_init(): epoll_create() failed: %s", strerror ( errno ) );
+    io_sched_epoll_destroy ( scheduler );
+    return CMNUTIL_FALSE;
+  }
+  fcntl ( ep->epoll_fd, F_SETFD, FD_CLOEXEC );
+  
+  ep->fd_tasks = (p_io_scheduler_task_t *) malloc ( IO_SCHED_EPOLL_INITIAL_FDS * sizeof( p_io_scheduler_task_t ) );
+  if ( !( ep->fd_tasks ) ) {
+    io_sched_epoll_destroy ( scheduler );
+    return CMNUTIL_FALSE;
+  }
+  memset ( ep->fd_tasks, 0, IO_SCHED_EPOLL_INITIAL_FDS * sizeof( p_io_scheduler_task_t ) );
+  ep->fd_tasks_size = IO_SCHED_EPOLL_INITIAL_FDS;
+  
+  /* The wakeup descriptor never has a task chain; it is picked out by number in the wait. */
+  if ( !( inl_io_sched_epoll_update ( ep, scheduler->wakeup_rd_fd, EPOLL_CTL_ADD, EPOLLIN ) ) ) {
+    io_sched_epoll_destroy ( scheduler );
+    return CMNUTIL_FALSE;
+  }
+  
+  return CMNUTIL_TRUE;
+}
+
+static void
+io_sched_epoll_remove_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task )
+{
+  p_io_sched_epoll_t ep = AS_PTR_io_sched_epoll( scheduler->backend_data );
+  p_io_scheduler_task_t * pp;
+  
+  if ( (size_t) io_task->fd >= ep->fd_tasks_size )
+    return;
+  
+  /* Unlink the task from the chain for its descriptor. */
+  pp = &( ep->fd_tasks[ io_task->fd ] );
+  while ( *pp && ( *pp != io_task ) )
+    pp = &( (*pp)->fd_next );
+  if ( !( *pp ) )
+    return;
+  *pp = io_task->fd_next;
+  io_task->fd_next = NIL_IO_SCHEDULER_TASK;
+  
+  /* The descriptor may already have been closed (which drops it from the epoll set), so any
+     error here is of no consequence. */
+  if ( ep->fd_tasks[ io_task->fd ] )
+    inl_io_sched_epoll_update ( ep, io_task->fd, EPOLL_CTL_MOD, inl_io_sched_epoll_chain_events ( ep->fd_tasks[ io_task->fd ] ) );
+  else
+    epoll_ctl ( ep->epoll_fd, EPOLL_CTL_DEL, io_task->fd, NULL );
+}
+
+static int
+io_sched_epoll_wait ( p_io_scheduler_t scheduler, int64_t time_out )
+{
+  p_io_sched_epoll_t ep = AS_PTR_io_sched_epoll( scheduler->backend_data );
+  p_io_scheduler_task_t ptask;
+  io_task_opts_t ready;
+  uint32_t revents;
+  int timeout_ms, nevents, ii, num_ready = 0;
+  fd_t fd;
+  
+  /* Round up to whole milliseconds, so that a deadline is never reported early. */
+  if ( time_out < 0 )
+    timeout_ms = -1;
+  else
+    timeout_ms = (int) ( ( time_out + ( IO_SCHEDULER_NTIME_ONE_SECOND / 1000 ) - 1 ) / ( IO_SCHEDULER_NTIME_ONE_SECOND / 1000 ) );
+  
+  nevents = epoll_wait ( ep->epoll_fd, ep->events, IO_SCHED_EPOLL_MAX_EVENTS, timeout_ms );
+  if ( nevents <= 0 )
+    return nevents;
+  
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  for ( ii = 0; ii < nevents; ii++ ) {
+    fd = ep->events[ii].data.fd;
+    revents = ep->events[ii].events;
+    if ( fd == scheduler->wakeup_rd_fd ) {
+      io_sched_clear_wakeup ( scheduler );
+      continue;
+    }
+    if ( (size_t) fd >= ep->fd_tasks_size )
+      continue;
+    for ( ptask = ep->fd_tasks[ fd ]; ptask; ptask = ptask->fd_next ) {
+      if ( S_IOSCHED_OPTS_REMOVE( ptask ) )
+        continue;
+      ready = IO_SCHEDULER_NONE;
+      /* Errors and hang-ups are reported as read/write readiness, just as select() does, so the
+         callback gets to see the failure from its own read or write. */
+      if ( S_IOSCHED_OPTS_READ( ptask ) && ( revents & ( EPOLLIN | EPOLLERR | EPOLLHUP ) ) )
+        ready |= IO_SCHEDULER_READ;
+      if ( S_IOSCHED_OPTS_WRITE( ptask ) && ( revents & ( EPOLLOUT | EPOLLERR | EPOLLHUP ) ) )
+        ready |= IO_SCHEDULER_WRITE;
+      if ( S_IOSCHED_OPTS_ERROR( ptask ) && ( revents & EPOLLPRI ) )
+        ready |= IO_SCHEDULER_ERROR;
+      if ( ready != IO_SCHEDULER_NONE ) {
+        io_sched_mark_task_ready ( ptask, ready );
+        num_ready++;
+      }
+    }
+  }
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  
+  return num_ready;
+}
+
+/**
+ * Builds the epoll interest set for a descriptor from every task watching it. The descriptor is
+ * only watched edge-triggered when every one of those tasks asked for it; the rest would not be
+ * called again for data still left over from an earlier edge.
+ **/
+static inline uint32_t
+inl_io_sched_epoll_chain_events ( p_io_scheduler_task_t chain )
+{
+  uint32_t events = chain ? EPOLLET : 0;
+  for ( ; chain; chain = chain->fd_next ) {
+    if ( !S_IOSCHED_OPTS_EDGE( chain ) )
+      events &= ~EPOLLET;
+    if ( S_IOSCHED_OPTS_READ( chain ) )
+      events |= EPOLLIN;
+    if ( S_IOSCHED_OPTS_WRITE( chain ) )
+      events |= EPOLLOUT;
+    if ( S_IOSCHED_OPTS_ERROR( chain ) )
+      events |= EPOLLPRI;
+  }
+  return events;
+}
+
+/**
+ * Adds or modifies the registration for a descriptor. The kernel drops a descriptor from the
+ * epoll set when it is closed, and the same number may be handed out again before we notice, so
+ * a failed add is retried as a modify and vice versa.
+ **/
+static inline bool_t
+inl_io_sched_epoll_update ( p_io_sched_epoll_t ep, fd_t fd, int op, uint32_t events )
+{
+  struct epoll_event ev;
+  
+  memset ( &ev, 0, sizeof( struct epoll_event ) );
+  ev.events = events;
+  ev.data.fd = fd;
+  
+  if ( epoll_ctl ( ep->epoll_fd, op, fd, &ev ) == 0 )
+    return CMNUTIL_TRUE;
+  if ( ( op == EPOLL_CTL_ADD ) && ( errno == EEXIST ) )
+    op = EPOLL_CTL_MOD;
+  else if ( ( op == EPOLL_CTL_MOD ) && ( errno == ENOENT ) )
+    op = EPOLL_CTL_ADD;
+  else {
+    LOGSVC_ERROR( "inl_io_sched_epoll_update(): epoll_ctl() failed for FD %d: %s", fd, strerror ( errno ) );
+    return CMNUTIL_FALSE;
+  }
+  if ( epoll_ctl ( ep->epoll_fd, op, fd, &ev ) == 0 )
+    return CMNUTIL_TRUE;
+  LOGSVC_ERROR( "inl_io_sched_epoll_update(): epoll_ctl() failed for FD %d: %s", fd, strerror ( errno ) );
+  return CMNUTIL_FALSE;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
@@ -0,0 +1,205 @@
+/**
+ * @file    io-sched-group.c
+ * @author  William Clifford
+ **/
+
+#include "io-sched-group.h"
+
+#define CATEGORY_NAME "io-scheduler"
+#include "logging-svc.h"
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local function prototypes        */
+/* ---------- ---------- ---------- */
+
+static inline void inl_io_sched_group_pin ( p_io_scheduler_t scheduler, size_t index );
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Exposed functions     */
+/* ---------- ---------- */
+
+/**
+ * Creates a group of num_schedulers schedulers, each set up according to the given configuration.
+ **/
+p_io_sched_group_t
+io_sched_group_create ( size_t num_schedulers, const io_scheduler_config_t * config, bool_t pin_to_cpus )
+{
+  p_io_sched_group_t rv;
+  long num_cpus;
+  size_t ii;
+  
+  if ( !(config) )
+    return NIL_IO_SCHED_GROUP;
+  
+  if ( !(num_schedulers) ) {
+    num_cpus = sysconf ( _SC_NPROCESSORS_ONLN );
+    num_schedulers = ( num_cpus > 0 ) ? (size_t) num_cpus : 1;
+  }
+  
+  LOGSVC_DEBUG( "io_sched_group_create(): %lu schedulers", (unsigned long) num_schedulers );
+  
+  rv = (p_io_sched_group_t) malloc ( IO_SCHED_GROUP_STRUCT_SIZE );
+  if ( rv ) {
+    memset ( rv, 0, IO_SCHED_GROUP_STRUCT_SIZE );
+    rv->pin_to_cpus = pin_to_cpus;
+    rv->schedulers = (p_io_scheduler_t *) calloc ( num_schedulers, sizeof( p_io_scheduler_t ) );
+    if ( !(rv->schedulers) ) {
+      free ( rv );
+      return NIL_IO_SCHED_GROUP;
+    }
+    for ( ii = 0; ii < num_schedulers; ii++ ) {
+      rv->schedulers[ii] = io_sched_create_scheduler_ex ( config );
+      if ( !(rv->schedulers[ii]) ) {
+        LOGSVC_ERROR( "io_sched_group_create(): Unable to create scheduler %lu.", (unsigned long) ii );
+        io_sched_group_destroy ( rv );
+        return NIL_IO_SCHED_GROUP;
+      }
+      rv->num_schedulers++;
+    }
+  }
+  return rv;
+}
+
+/**
+ * Creates a task on a scheduler picked from the group by the given method.
+ **/
+p_io_scheduler_task_t
+io_sched_group_create_task ( p_io_sched_group_t group, io_sched_group_assign_t assign,
+                             fd_t fd, io_task_opts_t opts, int64_t time_out, int64_t slack, void * user_data,
+                             io_scheduler_cbk_t read_cbk,
+                             io_scheduler_cbk_t write_cbk,
+                             io_scheduler_cbk_t err_cbk,
+                             io_scheduler_cbk_t time_out_cbk )
+{
+  return io_sched_create_task ( io_sched_group_pick ( group, assign, fd ),
+                                fd, opts, time_out, slack, user_data, read_cbk, write_cbk, err_cbk, time_out_cbk );
+}
+
+/**
+ * Stops (if need be) and destroys every scheduler in the group, then the group itself.
+ **/
+void
+io_sched_group_destroy ( p_io_sched_group_t group )
+{
+  size_t ii;
+  
+  if ( group ) {
+    for ( ii = 0; ii < group->num_schedulers; ii++ ) {
+      if ( group->schedulers[ii]->scheduler_thread )
+        io_sched_stop_scheduler ( group->schedulers[ii] );
+      io_sched_destroy_scheduler ( group->schedulers[ii] );
+    }
+    free ( group->schedulers );
+    free ( group );
+  }
+}
+
+/**
+ * Returns the scheduler at the given index within the group.
+ **/
+p_io_scheduler_t
+io_sched_group_get ( p_io_sched_group_t group, size_t index )
+{
+  if ( !(group) || ( index >= group->num_schedulers ) )
+    return NIL_IO_SCHEDULER;
+  return group->schedulers[ index ];
+}
+
+/**
+ * Picks a scheduler from the group for a task on the given file descriptor.
+ **/
+p_io_scheduler_t
+io_sched_group_pick ( p_io_sched_group_t group, io_sched_group_assign_t assign, fd_t fd )
+{
+  p_io_scheduler_t rv;
+  size_t ii;
+  
+  if ( !(group) || !(group->num_schedulers) )
+    return NIL_IO_SCHEDULER;
+  
+  switch ( assign ) {
+    case IO_SCHED_GROUP_ASSIGN_LEAST_LOADED:
+      /* The counts are read without taking each scheduler's lock; a slightly stale count is of
+         no consequence when all we want is a reasonable spread. */
+      rv = group->schedulers[0];
+      for ( ii = 1; ii < group->num_schedulers; ii++ ) {
+        if ( group->schedulers[ii]->num_scheduled_tasks < rv->num_scheduled_tasks )
+          rv = group->schedulers[ii];
+      }
+      return rv;
+    
+    case IO_SCHED_GROUP_ASSIGN_FD_HASH:
+    default:
+      /* Descriptors are handed out sequentially, so mix the bits (Knuth's multiplicative hash)
+         rather than taking the plain modulus. */
+      return group->schedulers[ ( ( (uint32_t) fd * 2654435761U ) >> 16 ) % group->num_schedulers ];
+  }
+}
+
+/**
+ * Starts a thread for every scheduler in the group.
+ **/
+bool_t
+io_sched_group_start ( p_io_sched_group_t group )
+{
+  bool_t rv = CMNUTIL_TRUE;
+  size_t ii;
+  
+  if ( !(group) )
+    return CMNUTIL_FALSE;
+  
+  for ( ii = 0; ii < group->num_schedulers; ii++ ) {
+    if ( group->schedulers[ii]->scheduler_thread )
+      continue;
+    if ( !( io_sched_start_scheduler_thread ( group->schedulers[ii] ) ) ) {
+      LOGSVC_ERROR( "io_sched_group_start(): Unable to start scheduler %lu.", (unsigned long) ii );
+      rv = CMNUTIL_FALSE;
+      continue;
+    }
+    if ( group->pin_to_cpus )
+      inl_io_sched_group_pin ( group->schedulers[ii], ii );
+  }
+  return rv;
+}
+
+/**
+ * Tells every scheduler in the group to stop processing its tasks.
+ **/
+void
+io_sched_group_stop ( p_io_sched_group_t group )
+{
+  size_t ii;
+  
+  if ( group ) {
+    for ( ii = 0; ii < group->num_schedulers; ii++ )
+      io_sched_stop_scheduler ( group->schedulers[ii] );
+  }
+}
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local functions       */
+/* ---------- ---------- */
+
+/**
+ * Binds a scheduler's thread to a single CPU; a no-op where thread affinity is not available.
+ **/
+static inline void
+inl_io_sched_group_pin ( p_io_scheduler_t scheduler, size_t index )
+{
+#ifdef CPU_SET
+  cpu_set_t cpus;
+  long num_cpus = sysconf ( _SC_NPROCESSORS_ONLN );
+  int rc;
+  
+  if ( num_cpus <= 0 )
+    return;
+  CPU_ZERO ( &cpus );
+  CPU_SET ( index % (size_t) num_cpus, &cpus );
+  rc = pthread_setaffinity_np ( scheduler->scheduler_thread, sizeof( cpu_set_t ), &cpus );
+  if ( rc != 0 )
+    LOGSVC_WARNING( "inl_io_sched_group_pin(): Unable to pin scheduler to CPU %lu: %s",
+                    (unsigned long) ( index % (size_t) num_cpus ), strerror ( rc ) );
+#endif
+}
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
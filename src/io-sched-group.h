@@ -0,0 +1,96 @@
+/**
+ * @file    io-sched-group.h
+ * @author  William Clifford
+ *
+ * Groups of IO schedulers, one event loop per thread (and, optionally, per CPU). A single
+ * scheduler runs every callback in the one thread; a group lets a service spread its
+ * descriptors over several schedulers instead, picking one for each new task by a hash of its
+ * descriptor, by the current load of each scheduler, or explicitly by index.
+ *
+ * Tasks are still created on, and owned by, a single scheduler within the group; all of their
+ * callbacks run in that scheduler's thread.
+ **/
+
+#ifndef IO_SCHED_GROUP_H__
+#define IO_SCHED_GROUP_H__
+
+/* Include the precompiled header for all the standard library includes and project-wide
+   definitions. */
+#include "gccpch.h"
+
+#include "io-scheduler.h"
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+/**
+ * How a group picks the scheduler for a new task.
+ **/
+typedef enum {
+  IO_SCHED_GROUP_ASSIGN_FD_HASH         = 0,  /**< Hash of the file descriptor; stable for a given FD.  **/
+  IO_SCHED_GROUP_ASSIGN_LEAST_LOADED    = 1   /**< Scheduler with the fewest tasks at the time.         **/
+} io_sched_group_assign_t;
+
+typedef struct _io_sched_group {
+  
+  /** The schedulers in the group, and how many there are. */
+  p_io_scheduler_t * schedulers;
+  size_t num_schedulers;
+  
+  /** Set when each scheduler's thread is to be pinned to its own CPU. */
+  bool_t pin_to_cpus;
+  
+} io_sched_group_t;
+
+typedef struct _io_sched_group * p_io_sched_group_t;
+
+#define IO_SCHED_GROUP_STRUCT_SIZE      (sizeof( struct _io_sched_group ))
+#define NIL_IO_SCHED_GROUP              ((p_io_sched_group_t) 0)
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+/**
+ * Creates a group of num_schedulers schedulers, each set up according to the given configuration.
+ * When num_schedulers is zero, one scheduler is created per online CPU. When pin_to_cpus is set,
+ * the thread of the Nth scheduler is bound to the Nth CPU (wrapping around) once started.
+ **/
+p_io_sched_group_t io_sched_group_create ( size_t num_schedulers, const io_scheduler_config_t * config, bool_t pin_to_cpus );
+
+/**
+ * Creates a task on a scheduler picked from the group by the given method; otherwise just like
+ * io_sched_create_task().
+ **/
+p_io_scheduler_task_t io_sched_group_create_task ( p_io_sched_group_t group, io_sched_group_assign_t assign,
+                                                   fd_t fd, io_task_opts_t opts, int64_t time_out, int64_t slack, void * user_data,
+                                                   io_scheduler_cbk_t read_cbk,
+                                                   io_scheduler_cbk_t write_cbk,
+                                                   io_scheduler_cbk_t err_cbk,
+                                                   io_scheduler_cbk_t time_out_cbk );
+
+/**
+ * Stops (if need be) and destroys every scheduler in the group, then the group itself.
+ **/
+void io_sched_group_destroy ( p_io_sched_group_t group );
+
+/**
+ * Returns the scheduler at the given index within the group, for explicitly targeting one.
+ **/
+p_io_scheduler_t io_sched_group_get ( p_io_sched_group_t group, size_t index );
+
+/**
+ * Picks a scheduler from the group for a task on the given file descriptor.
+ **/
+p_io_scheduler_t io_sched_group_pick ( p_io_sched_group_t group, io_sched_group_assign_t assign, fd_t fd );
+
+/**
+ * Starts a thread for every scheduler in the group. Returns false if any could not be started.
+ **/
+bool_t io_sched_group_start ( p_io_sched_group_t group );
+
+/**
+ * Tells every scheduler in the group to stop processing its tasks.
+ **/
+void io_sched_group_stop ( p_io_sched_group_t group );
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+
+#endif /* IO_SCHED_GROUP_H__ */
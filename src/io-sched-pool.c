@@ -0,0 +1,368 @@
+/**
+ * @file    io-sched-pool.c
+ * @author  William Clifford
+ *
+ * Worker pool for the IO scheduler. Callbacks run on the one scheduler thread, so a callback with
+ * real work to do (parsing, compression, a lookup) holds up every other task meanwhile. Handed to
+ * io_sched_offload(), the work runs on one of the pool's threads instead: the task's interest and
+ * timeout are suspended, the job is queued, and once a worker has finished with it the result is
+ * posted back to the scheduler loop (io_sched_post()), where the done function makes whatever
+ * writes are due and the task's interest is restored.
+ *
+ * Each worker has its own queue; jobs are dealt out to them in turn, and a worker with nothing
+ * left of its own steals from the others. A worker takes its own jobs oldest first, and steals the
+ * newest of someone else's, so that owner and thief rarely contend for the same end of a queue.
+ * Finished jobs go onto a single lock-free stack, with no more than one call posted to the loop
+ * for however many of them finish together.
+ **/
+
+#include "io-sched-backend.h"
+
+#define CATEGORY_NAME "io-scheduler"
+#include "logging-svc.h"
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Type definitions and structures  */
+/* ---------- ---------- ---------- */
+
+typedef struct _io_sched_job {
+  /* Place in a worker's queue. */
+  struct _io_sched_job *                prev;
+  struct _io_sched_job *                next;
+  /* Place on the finished stack. */
+  struct _io_sched_job *                done_next;
+  
+  p_io_scheduler_task_t                 task;
+  io_sched_work_fn_t                    work_fn;
+  io_sched_done_fn_t                    done_fn;
+  void *                                arg;
+  void *                                result;
+} io_sched_job_t, * p_io_sched_job_t;
+
+#define NEW_io_sched_job()              ( (p_io_sched_job_t) malloc ( sizeof( struct _io_sched_job ) ) )
+#define NIL_io_sched_job                ( (p_io_sched_job_t) 0 )
+
+typedef struct _io_sched_worker {
+  struct _io_sched_pool *               pool;
+  size_t                                index;
+  pthread_t                             thread;
+  
+  /* The worker's own queue; taken from at the head by the worker, at the tail by thieves. */
+  pthread_mutex_t                       mutex;
+  p_io_sched_job_t                      head;
+  p_io_sched_job_t                      tail;
+} io_sched_worker_t, * p_io_sched_worker_t;
+
+typedef struct _io_sched_pool {
+  p_io_scheduler_t                      scheduler;
+  p_io_sched_worker_t                   workers;
+  size_t                                num_workers;
+  size_t                                num_started;
+  
+  /* Next worker to deal a job to; only touched from the scheduler loop. */
+  size_t                                next_worker;
+  
+  /* Jobs queued across all workers; idle workers sleep on the condition until there are some. */
+  volatile size_t                       num_queued;
+  pthread_mutex_t                       idle_mutex;
+  pthread_cond_t                        idle_cond;
+  bool_t                                stop;
+  
+  /* Finished jobs, and whether a call to collect them is already posted to the loop. */
+  p_io_sched_job_t volatile             finished;
+  volatile int                          collect_posted;
+} io_sched_pool_t, * p_io_sched_pool_t;
+
+#define NEW_io_sched_pool()             ( (p_io_sched_pool_t) malloc ( sizeof( struct _io_sched_pool ) ) )
+#define NIL_io_sched_pool               ( (p_io_sched_pool_t) 0 )
+#define AS_PTR_io_sched_pool(vp)        ( (p_io_sched_pool_t) vp )
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local function prototypes        */
+/* ---------- ---------- ---------- */
+
+static void io_sched_pool_collect ( p_io_scheduler_t scheduler, void * arg );
+
+static void * io_sched_pool_threadfn ( void * ud );
+
+static inline void inl_io_sched_pool_finish ( p_io_sched_pool_t pool, p_io_sched_job_t job );
+
+static inline p_io_sched_job_t inl_io_sched_pool_take ( p_io_sched_worker_t worker, bool_t steal );
+
+static inline p_io_sched_job_t inl_io_sched_pool_take_finished ( p_io_sched_pool_t pool );
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Exposed functions     */
+/* ---------- ---------- */
+
+/**
+ * Hands work for a task off to the scheduler's worker pool, suspending the task until done_fn has
+ * been called with the result on the scheduler's thread.
+ **/
+bool_t
+io_sched_offload ( p_io_scheduler_task_t io_task, io_sched_work_fn_t work_fn, io_sched_done_fn_t done_fn, void * arg )
+{
+  p_io_sched_pool_t pool;
+  p_io_sched_worker_t worker;
+  p_io_sched_job_t job;
+  
+  if ( !( io_task ) || !( work_fn ) || !( io_task->owner->worker_pool ) )
+    return CMNUTIL_FALSE;
+  pool = AS_PTR_io_sched_pool( io_task->owner->worker_pool );
+  
+  job = NEW_io_sched_job();
+  if ( !( job ) )
+    return CMNUTIL_FALSE;
+  memset ( job, 0, sizeof( io_sched_job_t ) );
+  job->task = io_task;
+  job->work_fn = work_fn;
+  job->done_fn = done_fn;
+  job->arg = arg;
+  
+  if ( !( io_sched_suspend_task ( io_task ) ) ) {
+    free ( job );
+    return CMNUTIL_FALSE;
+  }
+  
+  /* Deal the job out to the next worker in turn; the count goes up with the queue locked, so that
+     it never runs behind the jobs a worker can find. */
+  worker = &( pool->workers[ pool->next_worker ] );
+  pool->next_worker = ( pool->next_worker + 1 ) % pool->num_workers;
+  LOCK_MUTEX( worker->mutex );
+  job->prev = worker->tail;
+  if ( worker->tail )
+    worker->tail->next = job;
+  else
+    worker->head = job;
+  worker->tail = job;
+  __sync_fetch_and_add ( &( pool->num_queued ), 1 );
+  UNLOCK_MUTEX( worker->mutex );
+  
+  LOCK_MUTEX( pool->idle_mutex );
+  pthread_cond_signal ( &(pool->idle_cond) );
+  UNLOCK_MUTEX( pool->idle_mutex );
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Starts num_workers worker threads for the scheduler.
+ **/
+bool_t
+io_sched_pool_start ( p_io_scheduler_t scheduler, size_t num_workers )
+{
+  p_io_sched_pool_t pool;
+  size_t ii;
+  int rc;
+  
+  pool = NEW_io_sched_pool();
+  if ( !( pool ) )
+    return CMNUTIL_FALSE;
+  memset ( pool, 0, sizeof( io_sched_pool_t ) );
+  pool->workers = (p_io_sched_worker_t) calloc ( num_workers, sizeof( io_sched_worker_t ) );
+  if ( !( pool->workers ) ) {
+    free ( pool );
+    return CMNUTIL_FALSE;
+  }
+  pool->scheduler = scheduler;
+  pool->num_workers = num_workers;
+  pthread_mutex_init ( &(pool->idle_mutex), (const pthread_mutexattr_t *) 0 );
+  pthread_cond_init ( &(pool->idle_cond), (const pthread_condattr_t *) 0 );
+  for ( ii = 0; ii < num_workers; ii++ ) {
+    pool->workers[ ii ].pool = pool;
+    pool->workers[ ii ].index = ii;
+    pthread_mutex_init ( &(pool->workers[ ii ].mutex), (const pthread_mutexattr_t *) 0 );
+  }
+  
+  scheduler->worker_pool = pool;
+  for ( ii = 0; ii < num_workers; ii++ ) {
+    rc = pthread_create ( &(pool->workers[ ii ].thread), (const pthread_attr_t *) 0, io_sched_pool_threadfn, (void*) &(pool->workers[ ii ]) );
+    if ( rc != 0 ) {
+      LOGSVC_ERROR( "io_sched_pool_start(): Unable to start worker thread: %s", strerror ( rc ) );
+      io_sched_pool_stop ( scheduler );
+      return CMNUTIL_FALSE;
+    }
+    pool->num_started++;
+  }
+  LOGSVC_DEBUG( "io_sched_pool_start(): Started %lu workers.", (unsigned long) num_workers );
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Stops and joins the workers, hands back outstanding work, and releases the pool.
+ **/
+void
+io_sched_pool_stop ( p_io_scheduler_t scheduler )
+{
+  p_io_sched_pool_t pool;
+  p_io_sched_job_t job, next;
+  size_t ii;
+  
+  if ( !( scheduler ) || !( scheduler->worker_pool ) )
+    return;
+  pool = AS_PTR_io_sched_pool( scheduler->worker_pool );
+  
+  /* Jobs under way are finished; the rest are left queued. */
+  LOCK_MUTEX( pool->idle_mutex );
+  pool->stop = CMNUTIL_TRUE;
+  pthread_cond_broadcast ( &(pool->idle_cond) );
+  UNLOCK_MUTEX( pool->idle_mutex );
+  for ( ii = 0; ii < pool->num_started; ii++ )
+    pthread_join ( pool->workers[ ii ].thread, (void**) 0 );
+  
+  /* Whatever a collect call still queued on the loop would have handed back, and whatever was
+     never started, goes back now; the scheduler is going, so the tasks are not resumed. */
+  for ( job = inl_io_sched_pool_take_finished ( pool ); job; job = next ) {
+    next = job->done_next;
+    job->task->is_offloaded = CMNUTIL_FALSE;
+    if ( job->done_fn )
+      job->done_fn ( job->task, job->result, job->arg );
+    free ( job );
+  }
+  for ( ii = 0; ii < pool->num_workers; ii++ ) {
+    while ( ( job = inl_io_sched_pool_take ( &(pool->workers[ ii ]), CMNUTIL_FALSE ) ) ) {
+      job->task->is_offloaded = CMNUTIL_FALSE;
+      if ( job->done_fn )
+        job->done_fn ( job->task, (void*) 0, job->arg );
+      free ( job );
+    }
+    pthread_mutex_destroy ( &(pool->workers[ ii ].mutex) );
+  }
+  
+  scheduler->worker_pool = NULL;
+  pthread_cond_destroy ( &(pool->idle_cond) );
+  pthread_mutex_destroy ( &(pool->idle_mutex) );
+  free ( pool->workers );
+  free ( pool );
+}
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local functions       */
+/* ---------- ---------- */
+
+/**
+ * Hands finished jobs back to their tasks; posted to the scheduler loop by the workers.
+ **/
+static void
+io_sched_pool_collect ( p_io_scheduler_t scheduler, void * arg )
+{
+  p_io_sched_pool_t pool = AS_PTR_io_sched_pool( arg );
+  p_io_sched_job_t job, next;
+  bool_t complete;
+  
+  /* Cleared before taking the stack; a job finished from here on has another call posted. */
+  __sync_lock_release ( &( pool->collect_posted ) );
+  for ( job = inl_io_sched_pool_take_finished ( pool ); job; job = next ) {
+    next = job->done_next;
+    complete = CMNUTIL_FALSE;
+    if ( job->done_fn )
+      complete = job->done_fn ( job->task, job->result, job->arg );
+    /* Unscheduled while away, the task is released once resumed, whatever done_fn said. */
+    io_sched_resume_task ( job->task, complete );
+    free ( job );
+  }
+}
+
+/**
+ * Worker thread; runs jobs from its own queue, then from the others', until told to stop.
+ **/
+static void *
+io_sched_pool_threadfn ( void * ud )
+{
+  p_io_sched_worker_t self = (p_io_sched_worker_t) ud;
+  p_io_sched_pool_t pool = self->pool;
+  p_io_sched_job_t job;
+  bool_t stop;
+  size_t ii;
+  
+  for ( ;; ) {
+    job = inl_io_sched_pool_take ( self, CMNUTIL_FALSE );
+    for ( ii = 1; !( job ) && ( ii < pool->num_workers ); ii++ )
+      job = inl_io_sched_pool_take ( &(pool->workers[ ( self->index + ii ) % pool->num_workers ]), CMNUTIL_TRUE );
+    if ( job ) {
+      job->result = job->work_fn ( job->task, job->arg );
+      inl_io_sched_pool_finish ( pool, job );
+      continue;
+    }
+    
+    LOCK_MUTEX( pool->idle_mutex );
+    while ( !( pool->stop ) && ( pool->num_queued == 0 ) )
+      pthread_cond_wait ( &(pool->idle_cond), &(pool->idle_mutex) );
+    stop = pool->stop;
+    UNLOCK_MUTEX( pool->idle_mutex );
+    if ( stop )
+      break;
+  }
+  return (void*) 0;
+}
+
+/**
+ * Pushes a finished job for the scheduler loop to collect, posting a call to collect it unless
+ * one is already on its way.
+ **/
+static inline void
+inl_io_sched_pool_finish ( p_io_sched_pool_t pool, p_io_sched_job_t job )
+{
+  p_io_sched_job_t head;
+  
+  do {
+    head = pool->finished;
+    job->done_next = head;
+  } while ( !__sync_bool_compare_and_swap ( &( pool->finished ), head, job ) );
+  
+  if ( __sync_lock_test_and_set ( &( pool->collect_posted ), 1 ) == 0 ) {
+    if ( !( io_sched_post ( pool->scheduler, io_sched_pool_collect, (void*) pool ) ) ) {
+      /* Left on the stack; the next job to finish, or io_sched_pool_stop(), picks it up. */
+      LOGSVC_ERROR( "inl_io_sched_pool_finish(): Unable to hand finished work back to the scheduler." );
+      __sync_lock_release ( &( pool->collect_posted ) );
+    }
+  }
+}
+
+/**
+ * Takes a job off a worker's queue: the oldest for the worker itself, the newest when stealing.
+ **/
+static inline p_io_sched_job_t
+inl_io_sched_pool_take ( p_io_sched_worker_t worker, bool_t steal )
+{
+  p_io_sched_job_t job;
+  
+  /* Not worth the lock when there is plainly nothing there. */
+  if ( !( worker->head ) )
+    return NIL_io_sched_job;
+  
+  LOCK_MUTEX( worker->mutex );
+  job = steal ? worker->tail : worker->head;
+  if ( job ) {
+    if ( job->prev )
+      job->prev->next = job->next;
+    else
+      worker->head = job->next;
+    if ( job->next )
+      job->next->prev = job->prev;
+    else
+      worker->tail = job->prev;
+    job->prev = job->next = NIL_io_sched_job;
+    __sync_fetch_and_sub ( &( worker->pool->num_queued ), 1 );
+  }
+  UNLOCK_MUTEX( worker->mutex );
+  return job;
+}
+
+/**
+ * Takes every job off the finished stack at once, returning them oldest first, linked through
+ * done_next.
+ **/
+static inline p_io_sched_job_t
+inl_io_sched_pool_take_finished ( p_io_sched_pool_t pool )
+{
+  p_io_sched_job_t job, next, fifo = NIL_io_sched_job;
+  
+  job = __sync_lock_test_and_set ( &( pool->finished ), NIL_io_sched_job );
+  while ( job ) {
+    next = job->done_next;
+    job->done_next = fifo;
+    fifo = job;
+    job = next;
+  }
+  return fifo;
+}
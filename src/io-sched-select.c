@@ -0,0 +1,154 @@
+/**
+ * @file    io-sched-select.c
+ * @author  William Clifford
+ *
+ * select() backend for the IO scheduler. The FD sets are rebuilt from the scheduled tasks list
+ * on every pass, so this is only suited to small numbers of descriptors; it remains as the
+ * portable fallback for systems without epoll.
+ **/
+
+#include "io-sched-backend.h"
+
+#define CATEGORY_NAME "io-scheduler"
+#include "logging-svc.h"
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local function prototypes        */
+/* ---------- ---------- ---------- */
+
+static bool_t io_sched_select_add_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task );
+
+static void io_sched_select_destroy ( p_io_scheduler_t scheduler );
+
+static bool_t io_sched_select_init ( p_io_scheduler_t scheduler );
+
+static void io_sched_select_remove_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task );
+
+static int io_sched_select_wait ( p_io_scheduler_t scheduler, int64_t time_out );
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Shared (global) variables        */
+/* ---------- ---------- ---------- */
+
+const io_sched_backend_t g_io_sched_select_backend = {
+  "select",
+  io_sched_select_init,
+  io_sched_select_destroy,
+  io_sched_select_add_task,
+  io_sched_select_remove_task,
+  io_sched_select_wait
+};
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local functions       */
+/* ---------- ---------- */
+
+static bool_t
+io_sched_select_add_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task )
+{
+  /* Nothing to register; the FD sets are built from the task list on each pass. */
+  if ( io_task->fd >= FD_SETSIZE ) {
+    LOGSVC_ERROR( "io_sched_select_add_task(): FD %d exceeds FD_SETSIZE (%d).", io_task->fd, FD_SETSIZE );
+    return CMNUTIL_FALSE;
+  }
+  return CMNUTIL_TRUE;
+}
+
+static void
+io_sched_select_destroy ( p_io_scheduler_t scheduler )
+{
+  scheduler->backend_data = NULL;
+}
+
+static bool_t
+io_sched_select_init ( p_io_scheduler_t scheduler )
+{
+  scheduler->backend_data = NULL;
+  if ( scheduler->wakeup_rd_fd >= FD_SETSIZE ) {
+    LOGSVC_ERROR( "io_sched_select_init(): Wakeup FD %d exceeds FD_SETSIZE (%d).", scheduler->wakeup_rd_fd, FD_SETSIZE );
+    return CMNUTIL_FALSE;
+  }
+  return CMNUTIL_TRUE;
+}
+
+static void
+io_sched_select_remove_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task )
+{
+  /* Nothing to do; removed tasks simply stop showing up in the FD sets. */
+}
+
+static int
+io_sched_select_wait ( p_io_scheduler_t scheduler, int64_t time_out )
+{
+  fd_set rd, wr, er;
+  fd_t maxfd = INVALID_GENERAL_FD; /* -1 */
+  p_io_scheduler_task_t ptask;
+  struct timeval tv_select_timeout;
+  io_task_opts_t ready;
+  int rc, num_ready = 0;
+  
+  FD_ZERO ( &rd );
+  FD_ZERO ( &wr );
+  FD_ZERO ( &er );
+  
+  FD_SET ( scheduler->wakeup_rd_fd, &rd );
+  maxfd = scheduler->wakeup_rd_fd;
+  
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  for ( ptask = scheduler->scheduled_tasks; ptask; ptask = ptask->next ) {
+    /* Timer-only tasks are never registered, so they never make it into the FD sets. */
+    if ( !( ptask->is_registered ) || S_IOSCHED_OPTS_REMOVE( ptask ) )
+      continue;
+    if ( S_IOSCHED_OPTS_READ( ptask ) ) {
+      maxfd = ( ptask->fd > maxfd ) ? ptask->fd : maxfd;
+      FD_SET ( ptask->fd, &rd );
+    }
+    if ( S_IOSCHED_OPTS_WRITE( ptask ) ) {
+      maxfd = ( ptask->fd > maxfd ) ? ptask->fd : maxfd;
+      FD_SET ( ptask->fd, &wr );
+    }
+    if ( S_IOSCHED_OPTS_ERROR( ptask ) ) {
+      maxfd = ( ptask->fd > maxfd ) ? ptask->fd : maxfd;
+      FD_SET ( ptask->fd, &er );
+    }
+  }
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  
+  if ( time_out < 0 ) {
+    rc = select ( maxfd + 1, &rd, &wr, &er, NULL );
+  }
+  else {
+    tv_select_timeout.tv_sec = (time_t) ( time_out / IO_SCHEDULER_NTIME_ONE_SECOND );
+    tv_select_timeout.tv_usec = (suseconds_t) ( ( time_out % IO_SCHEDULER_NTIME_ONE_SECOND ) / 1000 );
+    rc = select ( maxfd + 1, &rd, &wr, &er, &tv_select_timeout );
+  }
+  if ( rc <= 0 )
+    return rc;
+  
+  if ( FD_ISSET( scheduler->wakeup_rd_fd, &rd ) )
+    io_sched_clear_wakeup ( scheduler );
+  
+  /* Any task added since the FD sets were built simply will not have its bits set, unless it
+     shares a descriptor with a task that was being watched. */
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  for ( ptask = scheduler->scheduled_tasks; ptask; ptask = ptask->next ) {
+    if ( !( ptask->is_registered ) || S_IOSCHED_OPTS_REMOVE( ptask ) )
+      continue;
+    ready = IO_SCHEDULER_NONE;
+    if ( S_IOSCHED_OPTS_READ( ptask ) && FD_ISSET( ptask->fd, &rd ) )
+      ready |= IO_SCHEDULER_READ;
+    if ( S_IOSCHED_OPTS_WRITE( ptask ) && FD_ISSET( ptask->fd, &wr ) )
+      ready |= IO_SCHEDULER_WRITE;
+    if ( S_IOSCHED_OPTS_ERROR( ptask ) && FD_ISSET( ptask->fd, &er ) )
+      ready |= IO_SCHEDULER_ERROR;
+    if ( ready != IO_SCHEDULER_NONE ) {
+      io_sched_mark_task_ready ( ptask, ready );
+      num_ready++;
+    }
+  }
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  
+  return num_ready;
+}
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
@@ -0,0 +1,479 @@
+/**
+ * @file    io-sched-uring.c
+ * @author  William Clifford
+ *
+ * io_uring backend for the IO scheduler. Each task watching a descriptor has a one-shot poll
+ * outstanding on the ring; scheduling, unscheduling and re-arming a task only queue entries on
+ * the submission ring, and everything queued since the last pass is handed to the kernel by the
+ * single io_uring_enter() call that also waits for completions. Polls are re-armed as they
+ * complete, rather than left multishot, so that readiness stays level-triggered as it is with
+ * the other backends: a re-armed poll on a descriptor that still has data completes straight away.
+ * Edge-triggered tasks (IO_SCHEDULER_EDGE) get a multishot poll instead, which stays armed and
+ * completes again only as more data arrives; on kernels that lack multishot polls (before 5.13)
+ * the backend notices the first one being refused and goes back to one-shot polls throughout.
+ *
+ * The ring is driven through the raw system calls, so there is no dependency on liburing. The
+ * kernel holds on to each poll's user data well after the scheduler may have released its task,
+ * so polls are tagged with the task's handle rather than its address, and completions for a
+ * handle that has gone stale are simply dropped.
+ *
+ * Only readiness is submitted through the ring for now; the callbacks still do their own reads,
+ * writes and accepts.
+ **/
+
+#include "io-sched-backend.h"
+
+#define CATEGORY_NAME "io-scheduler"
+#include "logging-svc.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Constants  */
+/* ---------- */
+
+/* Size of the submission ring; when it fills up between passes, it is flushed on the spot. */
+#define IO_SCHED_URING_SQ_ENTRIES       256
+
+/* Size of the completion ring; the kernel keeps any overflow until there is room again. */
+#define IO_SCHED_URING_CQ_ENTRIES       4096
+
+/* What a ring entry is for, kept in the upper half of its user data; the lower half holds the
+   handle of the task a poll belongs to. */
+#define IO_SCHED_URING_TAG_MASK         ((uint64_t) 0xFFFFFFFF00000000ULL)
+#define IO_SCHED_URING_TAG_TASK         ((uint64_t) 1 << 32)
+#define IO_SCHED_URING_TAG_WAKEUP       ((uint64_t) 2 << 32)
+#define IO_SCHED_URING_TAG_TIMEOUT      ((uint64_t) 3 << 32)
+#define IO_SCHED_URING_TAG_REMOVE       ((uint64_t) 4 << 32)
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Type definitions and structures  */
+/* ---------- ---------- ---------- */
+
+typedef struct _io_sched_uring {
+  fd_t                                  ring_fd;
+  unsigned                              sq_entries;
+  
+  /* Ring mappings and their sizes; with IORING_FEAT_SINGLE_MMAP, both rings share one mapping. */
+  void *                                sq_ring;
+  size_t                                sq_ring_size;
+  void *                                cq_ring;
+  size_t                                cq_ring_size;
+  struct io_uring_sqe *                 sqes;
+  size_t                                sqes_size;
+  
+  /* Pointers into the mapped rings. */
+  unsigned *                            sq_head;
+  unsigned *                            sq_tail;
+  unsigned *                            sq_mask;
+  unsigned *                            sq_array;
+  unsigned *                            cq_head;
+  unsigned *                            cq_tail;
+  unsigned *                            cq_mask;
+  struct io_uring_cqe *                 cqes;
+  
+  /* Deadline for the current wait; the kernel copies it when the timeout entry is submitted. */
+  struct __kernel_timespec              timeout;
+  
+  /* Cleared once the kernel is found to refuse multishot polls. */
+  bool_t                                multishot;
+} io_sched_uring_t, * p_io_sched_uring_t;
+
+#define SIZE_io_sched_uring             (sizeof( struct _io_sched_uring ))
+#define NEW_io_sched_uring()            ( (p_io_sched_uring_t) malloc ( sizeof( struct _io_sched_uring ) ) )
+#define NIL_io_sched_uring              ( (p_io_sched_uring_t) 0 )
+#define AS_PTR_io_sched_uring(vp)       ( (p_io_sched_uring_t) vp )
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local function prototypes        */
+/* ---------- ---------- ---------- */
+
+static bool_t io_sched_uring_add_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task );
+
+static void io_sched_uring_destroy ( p_io_scheduler_t scheduler );
+
+static bool_t io_sched_uring_init ( p_io_scheduler_t scheduler );
+
+static void io_sched_uring_remove_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task );
+
+static int io_sched_uring_wait ( p_io_scheduler_t scheduler, int64_t time_out );
+
+static inline int inl_io_sched_uring_enter ( p_io_sched_uring_t ur, unsigned to_submit, unsigned min_complete, unsigned flags );
+
+static inline struct io_uring_sqe * inl_io_sched_uring_get_sqe ( p_io_sched_uring_t ur );
+
+static inline bool_t inl_io_sched_uring_poll ( p_io_sched_uring_t ur, fd_t fd, uint32_t events, bool_t multishot, uint64_t user_data );
+
+static inline bool_t inl_io_sched_uring_poll_task ( p_io_sched_uring_t ur, p_io_scheduler_task_t io_task, uint64_t user_data );
+
+static inline int inl_io_sched_uring_reap ( p_io_scheduler_t scheduler, p_io_sched_uring_t ur );
+
+static inline uint32_t inl_io_sched_uring_task_events ( p_io_scheduler_task_t io_task );
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Shared (global) variables        */
+/* ---------- ---------- ---------- */
+
+const io_sched_backend_t g_io_sched_uring_backend = {
+  "io_uring",
+  io_sched_uring_init,
+  io_sched_uring_destroy,
+  io_sched_uring_add_task,
+  io_sched_uring_remove_task,
+  io_sched_uring_wait
+};
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local functions       */
+/* ---------- ---------- */
+
+static bool_t
+io_sched_uring_add_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task )
+{
+  p_io_sched_uring_t ur = AS_PTR_io_sched_uring( scheduler->backend_data );
+  
+  /* Queued only; the poll reaches the kernel along with everything else on the next pass. */
+  if ( !( inl_io_sched_uring_poll_task ( ur, io_task, IO_SCHED_URING_TAG_TASK | io_task->handle ) ) )
+  {
+    LOGSVC_ERROR( "io_sched_uring_add_task(): Submission ring is full; cannot watch FD %d.", io_task->fd );
+    return CMNUTIL_FALSE;
+  }
+  return CMNUTIL_TRUE;
+}
+
+static void
+io_sched_uring_destroy ( p_io_scheduler_t scheduler )
+{
+  p_io_sched_uring_t ur = AS_PTR_io_sched_uring( scheduler->backend_data );
+  if ( ur ) {
+    if ( ur->sqes )
+      munmap ( ur->sqes, ur->sqes_size );
+    if ( ur->cq_ring && ( ur->cq_ring != ur->sq_ring ) )
+      munmap ( ur->cq_ring, ur->cq_ring_size );
+    if ( ur->sq_ring )
+      munmap ( ur->sq_ring, ur->sq_ring_size );
+    if ( ur->ring_fd != INVALID_GENERAL_FD )
+      close ( ur->ring_fd );
+    free ( ur );
+    scheduler->backend_data = NULL;
+  }
+}
+
+static bool_t
+io_sched_uring_init ( p_io_scheduler_t scheduler )
+{
+  p_io_sched_uring_t ur = NEW_io_sched_uring();
+  struct io_uring_params params;
+  unsigned ii;
+  
+  if ( !( ur ) )
+    return CMNUTIL_FALSE;
+  memset ( ur, 0, SIZE_io_sched_uring );
+  ur->ring_fd = INVALID_GENERAL_FD;
+#ifdef IORING_POLL_ADD_MULTI
+  ur->multishot = CMNUTIL_TRUE;
+#endif
+  scheduler->backend_data = ur;
+  
+  memset ( &params, 0, sizeof( struct io_uring_params ) );
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = IO_SCHED_URING_CQ_ENTRIES;
+  ur->ring_fd = (fd_t) syscall ( __NR_io_uring_setup, IO_SCHED_URING_SQ_ENTRIES, &params );
+  if ( ur->ring_fd < 0 ) {
+    LOGSVC_INFO( "io_sched_uring_init(): io_uring_setup() failed: %s", strerror ( errno ) );
+    ur->ring_fd = INVALID_GENERAL_FD;
+    io_sched_uring_destroy ( scheduler );
+    return CMNUTIL_FALSE;
+  }
+  ur->sq_entries = params.sq_entries;
+  
+  /* Map the rings. */
+  ur->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+  ur->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe );
+  if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+    if ( ur->cq_ring_size > ur->sq_ring_size )
+      ur->sq_ring_size = ur->cq_ring_size;
+    ur->cq_ring_size = ur->sq_ring_size;
+  }
+  ur->sq_ring = mmap ( NULL, ur->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ur->ring_fd, IORING_OFF_SQ_RING );
+  if ( ur->sq_ring == MAP_FAILED ) {
+    ur->sq_ring = NULL;
+    LOGSVC_ERROR( "io_sched_uring_init(): Unable to map submission ring: %s", strerror ( errno ) );
+    io_sched_uring_destroy ( scheduler );
+    return CMNUTIL_FALSE;
+  }
+  if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+    ur->cq_ring = ur->sq_ring;
+  }
+  else {
+    ur->cq_ring = mmap ( NULL, ur->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ur->ring_fd, IORING_OFF_CQ_RING );
+    if ( ur->cq_ring == MAP_FAILED ) {
+      ur->cq_ring = NULL;
+      LOGSVC_ERROR( "io_sched_uring_init(): Unable to map completion ring: %s", strerror ( errno ) );
+      io_sched_uring_destroy ( scheduler );
+      return CMNUTIL_FALSE;
+    }
+  }
+  ur->sqes_size = params.sq_entries * sizeof( struct io_uring_sqe );
+  ur->sqes = (struct io_uring_sqe *) mmap ( NULL, ur->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                            ur->ring_fd, IORING_OFF_SQES );
+  if ( ur->sqes == MAP_FAILED ) {
+    ur->sqes = NULL;
+    LOGSVC_ERROR( "io_sched_uring_init(): Unable to map submission entries: %s", strerror ( errno ) );
+    io_sched_uring_destroy ( scheduler );
+    return CMNUTIL_FALSE;
+  }
+  
+  ur->sq_head = (unsigned *) ( (char *) ur->sq_ring + params.sq_off.head );
+  ur->sq_tail = (unsigned *) ( (char *) ur->sq_ring + params.sq_off.tail );
+  ur->sq_mask = (unsigned *) ( (char *) ur->sq_ring + params.sq_off.ring_mask );
+  ur->sq_array = (unsigned *) ( (char *) ur->sq_ring + params.sq_off.array );
+  ur->cq_head = (unsigned *) ( (char *) ur->cq_ring + params.cq_off.head );
+  ur->cq_tail = (unsigned *) ( (char *) ur->cq_ring + params.cq_off.tail );
+  ur->cq_mask = (unsigned *) ( (char *) ur->cq_ring + params.cq_off.ring_mask );
+  ur->cqes = (struct io_uring_cqe *) ( (char *) ur->cq_ring + params.cq_off.cqes );
+  
+  /* Entries are always filled in ring order, so the indirection array never changes. */
+  for ( ii = 0; ii < params.sq_entries; ii++ )
+    ur->sq_array[ ii ] = ii;
+  
+  /* The wakeup descriptor has its own poll, told apart by its tag. */
+  if ( !( inl_io_sched_uring_poll ( ur, scheduler->wakeup_rd_fd, POLLIN, CMNUTIL_FALSE, IO_SCHED_URING_TAG_WAKEUP ) ) ) {
+    io_sched_uring_destroy ( scheduler );
+    return CMNUTIL_FALSE;
+  }
+  
+  return CMNUTIL_TRUE;
+}
+
+static void
+io_sched_uring_remove_task ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task )
+{
+  p_io_sched_uring_t ur = AS_PTR_io_sched_uring( scheduler->backend_data );
+  struct io_uring_sqe * sqe = inl_io_sched_uring_get_sqe ( ur );
+  
+  /* Should the removal not make it (or the poll complete first), the completion is dropped once
+     it turns up, as its handle will no longer lead to a registered task. */
+  if ( !( sqe ) )
+    return;
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = IO_SCHED_URING_TAG_TASK | io_task->handle;
+  sqe->user_data = IO_SCHED_URING_TAG_REMOVE;
+  __atomic_store_n ( ur->sq_tail, *(ur->sq_tail) + 1, __ATOMIC_RELEASE );
+}
+
+static int
+io_sched_uring_wait ( p_io_scheduler_t scheduler, int64_t time_out )
+{
+  p_io_sched_uring_t ur = AS_PTR_io_sched_uring( scheduler->backend_data );
+  struct io_uring_sqe * sqe;
+  unsigned to_submit;
+  int rc, num_ready = 0;
+  
+  /* The timeout entry completes on its own deadline or on the first other completion, whichever
+     comes first, so there is never more than the one left over from a previous pass. Should the
+     submission ring be full with the kernel refusing more (its completion queue backed up), the
+     completions already there are taken off first; if that finds nothing ready, the entry is
+     tried again, and only failing that does this pass poll rather than wait. */
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  if ( time_out > 0 ) {
+    sqe = inl_io_sched_uring_get_sqe ( ur );
+    if ( !( sqe ) ) {
+      num_ready = inl_io_sched_uring_reap ( scheduler, ur );
+      if ( !( num_ready ) )
+        sqe = inl_io_sched_uring_get_sqe ( ur );
+    }
+    if ( sqe ) {
+      ur->timeout.tv_sec = time_out / IO_SCHEDULER_NTIME_ONE_SECOND;
+      ur->timeout.tv_nsec = time_out % IO_SCHEDULER_NTIME_ONE_SECOND;
+      sqe->opcode = IORING_OP_TIMEOUT;
+      sqe->fd = -1;
+      sqe->addr = (uint64_t) (uintptr_t) &( ur->timeout );
+      sqe->len = 1;
+      sqe->off = 1;
+      sqe->user_data = IO_SCHED_URING_TAG_TIMEOUT;
+      __atomic_store_n ( ur->sq_tail, *(ur->sq_tail) + 1, __ATOMIC_RELEASE );
+    }
+    else {
+      time_out = 0;
+    }
+  }
+  to_submit = *(ur->sq_tail) - __atomic_load_n ( ur->sq_head, __ATOMIC_ACQUIRE );
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  
+  /* Everything queued since the last pass goes in with the one call that also waits. */
+  if ( time_out == 0 )
+    rc = inl_io_sched_uring_enter ( ur, to_submit, 0, 0 );
+  else
+    rc = inl_io_sched_uring_enter ( ur, to_submit, 1, IORING_ENTER_GETEVENTS );
+  if ( ( rc < 0 ) && ( errno != EINTR ) && ( errno != EBUSY ) && ( errno != ETIME ) ) {
+    LOGSVC_ERROR( "io_sched_uring_wait(): io_uring_enter() failed: %s", strerror ( errno ) );
+    return -1;
+  }
+  
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  num_ready += inl_io_sched_uring_reap ( scheduler, ur );
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  
+  return num_ready;
+}
+
+/**
+ * Thin wrapper around the io_uring_enter() system call.
+ **/
+static inline int
+inl_io_sched_uring_enter ( p_io_sched_uring_t ur, unsigned to_submit, unsigned min_complete, unsigned flags )
+{
+  return (int) syscall ( __NR_io_uring_enter, ur->ring_fd, to_submit, min_complete, flags, NULL, 0 );
+}
+
+/**
+ * Hands out the next free submission entry, cleared; the caller fills it in and then bumps the
+ * ring tail. When the ring is full, whatever is queued on it is submitted first. The caller must
+ * hold the scheduler's task_list_mutex. Returns NULL if no entry could be freed up.
+ **/
+static inline struct io_uring_sqe *
+inl_io_sched_uring_get_sqe ( p_io_sched_uring_t ur )
+{
+  struct io_uring_sqe * sqe;
+  unsigned tail = *(ur->sq_tail);
+  
+  if ( tail - __atomic_load_n ( ur->sq_head, __ATOMIC_ACQUIRE ) >= ur->sq_entries ) {
+    inl_io_sched_uring_enter ( ur, ur->sq_entries, 0, 0 );
+    if ( tail - __atomic_load_n ( ur->sq_head, __ATOMIC_ACQUIRE ) >= ur->sq_entries )
+      return (struct io_uring_sqe *) 0;
+  }
+  sqe = &( ur->sqes[ tail & *(ur->sq_mask) ] );
+  memset ( sqe, 0, sizeof( struct io_uring_sqe ) );
+  return sqe;
+}
+
+/**
+ * Queues a poll of the descriptor for the given events, one-shot or multishot; the caller must
+ * hold the scheduler's task_list_mutex.
+ **/
+static inline bool_t
+inl_io_sched_uring_poll ( p_io_sched_uring_t ur, fd_t fd, uint32_t events, bool_t multishot, uint64_t user_data )
+{
+  struct io_uring_sqe * sqe = inl_io_sched_uring_get_sqe ( ur );
+  
+  if ( !( sqe ) )
+    return CMNUTIL_FALSE;
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+#ifdef IORING_POLL_ADD_MULTI
+  if ( multishot )
+    sqe->len = IORING_POLL_ADD_MULTI;
+#endif
+  /* The kernel reads the 32-bit mask as two swapped halves on big-endian systems. */
+#if __BYTE_ORDER == __BIG_ENDIAN
+  events = ( events << 16 ) | ( events >> 16 );
+#endif
+  sqe->poll32_events = events;
+  sqe->user_data = user_data;
+  __atomic_store_n ( ur->sq_tail, *(ur->sq_tail) + 1, __ATOMIC_RELEASE );
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Queues the poll for a task: multishot when the task is edge-triggered and the kernel allows it,
+ * otherwise one-shot. The caller must hold the scheduler's task_list_mutex.
+ **/
+static inline bool_t
+inl_io_sched_uring_poll_task ( p_io_sched_uring_t ur, p_io_scheduler_task_t io_task, uint64_t user_data )
+{
+  return inl_io_sched_uring_poll ( ur, io_task->fd, inl_io_sched_uring_task_events ( io_task ),
+                                   ( ur->multishot && S_IOSCHED_OPTS_EDGE( io_task ) ), user_data );
+}
+
+/**
+ * Takes the completions off the ring, marking the tasks they are for as ready and re-arming their
+ * polls; returns the number of tasks marked. The caller must hold the scheduler's task_list_mutex.
+ **/
+static inline int
+inl_io_sched_uring_reap ( p_io_scheduler_t scheduler, p_io_sched_uring_t ur )
+{
+  struct io_uring_cqe * cqe;
+  p_io_scheduler_task_t ptask;
+  io_task_opts_t ready;
+  unsigned head, tail;
+  uint32_t revents;
+  int num_ready = 0;
+  
+  head = *(ur->cq_head);
+  tail = __atomic_load_n ( ur->cq_tail, __ATOMIC_ACQUIRE );
+  for ( ; head != tail; head++ ) {
+    cqe = &( ur->cqes[ head & *(ur->cq_mask) ] );
+    switch ( cqe->user_data & IO_SCHED_URING_TAG_MASK ) {
+      case IO_SCHED_URING_TAG_WAKEUP:
+        io_sched_clear_wakeup ( scheduler );
+        inl_io_sched_uring_poll ( ur, scheduler->wakeup_rd_fd, POLLIN, CMNUTIL_FALSE, IO_SCHED_URING_TAG_WAKEUP );
+        break;
+      
+      case IO_SCHED_URING_TAG_TASK:
+        ptask = io_sched_lookup_handle ( scheduler, (io_sched_handle_t) ( cqe->user_data & ~IO_SCHED_URING_TAG_MASK ) );
+        if ( !( ptask ) || !( ptask->is_registered ) || S_IOSCHED_OPTS_REMOVE( ptask ) || ( cqe->res == -ECANCELED ) )
+          break;
+#ifdef IORING_POLL_ADD_MULTI
+        if ( ( cqe->res == -EINVAL ) && ur->multishot && S_IOSCHED_OPTS_EDGE( ptask ) ) {
+          LOGSVC_NOTICE( "io_sched_uring_wait(): Multishot polls not supported; edge-triggered tasks fall back to one-shot polls." );
+          ur->multishot = CMNUTIL_FALSE;
+          if ( !( inl_io_sched_uring_poll_task ( ur, ptask, cqe->user_data ) ) )
+            LOGSVC_ERROR( "io_sched_uring_wait(): Submission ring is full; FD %d is no longer watched.", ptask->fd );
+          break;
+        }
+#endif
+        /* A poll that failed outright (a bad descriptor, say) is reported as read/write readiness,
+           so the callback gets to see the failure from its own read or write; it is not re-armed. */
+        revents = ( cqe->res < 0 ) ? (uint32_t) ( POLLERR | POLLHUP ) : (uint32_t) cqe->res;
+        ready = IO_SCHEDULER_NONE;
+        if ( S_IOSCHED_OPTS_READ( ptask ) && ( revents & ( POLLIN | POLLERR | POLLHUP ) ) )
+          ready |= IO_SCHEDULER_READ;
+        if ( S_IOSCHED_OPTS_WRITE( ptask ) && ( revents & ( POLLOUT | POLLERR | POLLHUP ) ) )
+          ready |= IO_SCHEDULER_WRITE;
+        if ( S_IOSCHED_OPTS_ERROR( ptask ) && ( revents & POLLPRI ) )
+          ready |= IO_SCHEDULER_ERROR;
+        if ( ready != IO_SCHEDULER_NONE ) {
+          io_sched_mark_task_ready ( ptask, ready );
+          num_ready++;
+        }
+#ifdef IORING_CQE_F_MORE
+        /* A multishot poll that is still armed needs nothing more. */
+        if ( cqe->flags & IORING_CQE_F_MORE )
+          break;
+#endif
+        if ( ( cqe->res >= 0 ) && !( inl_io_sched_uring_poll_task ( ur, ptask, cqe->user_data ) ) )
+          LOGSVC_ERROR( "io_sched_uring_wait(): Submission ring is full; FD %d is no longer watched.", ptask->fd );
+        break;
+      
+      default:
+        /* Timeouts and poll removals; nothing to do. */
+        break;
+    }
+  }
+  __atomic_store_n ( ur->cq_head, head, __ATOMIC_RELEASE );
+  return num_ready;
+}
+
+/**
+ * Builds the poll mask for a task from its options.
+ **/
+static inline uint32_t
+inl_io_sched_uring_task_events ( p_io_scheduler_task_t io_task )
+{
+  uint32_t events = 0;
+  if ( S_IOSCHED_OPTS_READ( io_task ) )
+    events |= POLLIN;
+  if ( S_IOSCHED_OPTS_WRITE( io_task ) )
+    events |= POLLOUT;
+  if ( S_IOSCHED_OPTS_ERROR( io_task ) )
+    events |= POLLPRI;
+  return events;
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
@@ -0,0 +1,354 @@
+/**
+ * @file    io-sched-watchdog.c
+ * @author  William Clifford
+ *
+ * Slow-callback watchdog for the IO scheduler. Every callback runs on the one scheduler thread,
+ * so a single callback that blocks (a send spinning on a full socket buffer, say) stalls every
+ * other task on the scheduler. With a budget set, the scheduler loop notes when each callback
+ * starts, and which task and callback it is; a monitor thread looks in on that a few times per
+ * budget and logs any callback that has run over, once per callback. The loop itself logs the
+ * total time taken once such a callback returns.
+ *
+ * Optionally, the monitor also has the scheduler thread log its own backtrace while still stuck
+ * in the callback: the thread is sent IO_SCHED_WATCHDOG_SIGNAL, whose handler does no more than
+ * record the return addresses, and the monitor then turns those into symbols and logs them.
+ * Symbols for functions not exported from the executable only show up when linked with
+ * -rdynamic. The handler is installed with SA_RESTART, but calls that are never restarted after
+ * a signal (sleeps, poll() and the like) still return early with EINTR.
+ **/
+
+#include "io-sched-backend.h"
+
+#define CATEGORY_NAME "io-scheduler"
+#include "logging-svc.h"
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Constants  */
+/* ---------- */
+
+/* Signal used to interrupt the scheduler thread for a backtrace; may be overridden at build time. */
+#ifndef IO_SCHED_WATCHDOG_SIGNAL
+#define IO_SCHED_WATCHDOG_SIGNAL        ( SIGRTMIN + 3 )
+#endif
+
+/* Deepest backtrace taken. */
+#define IO_SCHED_WATCHDOG_MAX_FRAMES    32
+
+/* How long the monitor waits for the scheduler thread to take its backtrace, in milliseconds. */
+#define IO_SCHED_WATCHDOG_BT_WAIT_MS    100
+
+/* Bounds on how often the monitor looks in on the scheduler loop, in nanoseconds. */
+#define IO_SCHED_WATCHDOG_MIN_PERIOD    ( IO_SCHEDULER_NTIME_ONE_SECOND / 1000 )
+#define IO_SCHED_WATCHDOG_MAX_PERIOD    ( IO_SCHEDULER_NTIME_ONE_SECOND / 4 )
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Type definitions and structures  */
+/* ---------- ---------- ---------- */
+
+typedef struct _io_sched_watchdog {
+  p_io_scheduler_t                      scheduler;
+  
+  /* Monitor thread, woken early through the condition when it is to stop. */
+  pthread_t                             thread;
+  pthread_mutex_t                       mutex;
+  pthread_cond_t                        cond;
+  bool_t                                stop;
+  int64_t                               period;
+  
+  /* Callback last reported, by the scheduler's count of callbacks made. */
+  uint64_t                              reported_seq;
+  
+  /* Backtrace handed over by the scheduler thread's signal handler. */
+  bool_t                                want_backtrace;
+  volatile sig_atomic_t                 bt_wanted;
+  volatile sig_atomic_t                 bt_done;
+  int                                   bt_depth;
+  void *                                bt[ IO_SCHED_WATCHDOG_MAX_FRAMES ];
+} io_sched_watchdog_t, * p_io_sched_watchdog_t;
+
+#define NEW_io_sched_watchdog()         ( (p_io_sched_watchdog_t) malloc ( sizeof( struct _io_sched_watchdog ) ) )
+#define NIL_io_sched_watchdog           ( (p_io_sched_watchdog_t) 0 )
+#define AS_PTR_io_sched_watchdog(vp)    ( (p_io_sched_watchdog_t) vp )
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local function prototypes        */
+/* ---------- ---------- ---------- */
+
+static void io_sched_watchdog_on_signal ( int signo );
+
+static void io_sched_watchdog_install_handler ( void );
+
+static void * io_sched_watchdog_threadfn ( void * ud );
+
+static inline void inl_io_sched_watchdog_backtrace ( p_io_sched_watchdog_t wd );
+
+static inline void inl_io_sched_watchdog_check ( p_io_sched_watchdog_t wd );
+
+static inline int64_t inl_io_sched_watchdog_clock ( void );
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Module variables      */
+/* ---------- ---------- */
+
+/* Watchdog of the scheduler loop running in the current thread, for the signal handler. */
+static __thread p_io_sched_watchdog_t tl_io_sched_watchdog = NIL_io_sched_watchdog;
+
+static pthread_once_t g_io_sched_watchdog_once = PTHREAD_ONCE_INIT;
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Exposed functions     */
+/* ---------- ---------- */
+
+/**
+ * Marks the calling thread as running the scheduler's loop, so that its backtrace can be taken.
+ **/
+void
+io_sched_watchdog_attach ( p_io_scheduler_t scheduler, bool_t attach )
+{
+  if ( scheduler && scheduler->watchdog )
+    tl_io_sched_watchdog = attach ? AS_PTR_io_sched_watchdog( scheduler->watchdog ) : NIL_io_sched_watchdog;
+}
+
+/**
+ * Reports a callback that has returned after running over its budget; called from the loop.
+ **/
+void
+io_sched_watchdog_overran ( p_io_scheduler_t scheduler, fd_t fd, io_scheduler_cbk_t cbk, int64_t elapsed )
+{
+  LOGSVC_WARNING( "Callback %p for FD %d took %lld us; budget is %lld us.",
+                  (void*) (uintptr_t) cbk, fd, (long long) ( elapsed / 1000 ), (long long) ( scheduler->watchdog_budget / 1000 ) );
+}
+
+/**
+ * Starts the monitor thread for a scheduler whose watchdog_budget has been set.
+ **/
+bool_t
+io_sched_watchdog_start ( p_io_scheduler_t scheduler, bool_t want_backtrace )
+{
+  p_io_sched_watchdog_t wd;
+  pthread_condattr_t cattr;
+  int rc;
+  
+  wd = NEW_io_sched_watchdog();
+  if ( !( wd ) )
+    return CMNUTIL_FALSE;
+  memset ( wd, 0, sizeof( io_sched_watchdog_t ) );
+  wd->scheduler = scheduler;
+  
+  /* Look in a few times per budget, so that an overrun is caught not long after it starts. */
+  wd->period = scheduler->watchdog_budget / 4;
+  if ( wd->period < IO_SCHED_WATCHDOG_MIN_PERIOD )
+    wd->period = IO_SCHED_WATCHDOG_MIN_PERIOD;
+  else if ( wd->period > IO_SCHED_WATCHDOG_MAX_PERIOD )
+    wd->period = IO_SCHED_WATCHDOG_MAX_PERIOD;
+
+#ifdef HAVE_EXECINFO_H
+  if ( want_backtrace ) {
+    /* The first call to backtrace() may load libgcc, which is no business for a signal handler. */
+    backtrace ( wd->bt, 1 );
+    pthread_once ( &g_io_sched_watchdog_once, io_sched_watchdog_install_handler );
+    wd->want_backtrace = CMNUTIL_TRUE;
+  }
+#else
+  if ( want_backtrace )
+    LOGSVC_NOTICE( "io_sched_watchdog_start(): Backtraces are not available on this platform." );
+#endif
+  
+  pthread_mutex_init ( &(wd->mutex), (const pthread_mutexattr_t *) 0 );
+  pthread_condattr_init ( &cattr );
+  pthread_condattr_setclock ( &cattr, CLOCK_MONOTONIC );
+  pthread_cond_init ( &(wd->cond), &cattr );
+  pthread_condattr_destroy ( &cattr );
+  
+  scheduler->watchdog = wd;
+  rc = pthread_create ( &(wd->thread), (const pthread_attr_t *) 0, io_sched_watchdog_threadfn, (void*) wd );
+  if ( rc != 0 ) {
+    LOGSVC_ERROR( "io_sched_watchdog_start(): Unable to start watchdog thread: %s", strerror ( rc ) );
+    scheduler->watchdog = NULL;
+    pthread_cond_destroy ( &(wd->cond) );
+    pthread_mutex_destroy ( &(wd->mutex) );
+    free ( wd );
+    return CMNUTIL_FALSE;
+  }
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Stops the monitor thread, if there is one, and releases the watchdog.
+ **/
+void
+io_sched_watchdog_stop ( p_io_scheduler_t scheduler )
+{
+  p_io_sched_watchdog_t wd;
+  
+  if ( !( scheduler ) || !( scheduler->watchdog ) )
+    return;
+  wd = AS_PTR_io_sched_watchdog( scheduler->watchdog );
+  
+  LOCK_MUTEX( wd->mutex );
+  wd->stop = CMNUTIL_TRUE;
+  pthread_cond_signal ( &(wd->cond) );
+  UNLOCK_MUTEX( wd->mutex );
+  pthread_join ( wd->thread, (void**) 0 );
+  
+  scheduler->watchdog = NULL;
+  pthread_cond_destroy ( &(wd->cond) );
+  pthread_mutex_destroy ( &(wd->mutex) );
+  free ( wd );
+}
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local functions       */
+/* ---------- ---------- */
+
+/**
+ * Takes the backtrace of the scheduler thread from within the thread itself. Only records the
+ * return addresses; turning them into symbols is left to the monitor thread.
+ **/
+static void
+io_sched_watchdog_on_signal ( int signo )
+{
+#ifdef HAVE_EXECINFO_H
+  p_io_sched_watchdog_t wd = tl_io_sched_watchdog;
+  int saved_errno = errno;
+  
+  if ( wd && wd->bt_wanted ) {
+    wd->bt_depth = backtrace ( wd->bt, IO_SCHED_WATCHDOG_MAX_FRAMES );
+    wd->bt_wanted = 0;
+    wd->bt_done = 1;
+  }
+  errno = saved_errno;
+#endif
+}
+
+/**
+ * Installs the handler for IO_SCHED_WATCHDOG_SIGNAL; done once for the process.
+ **/
+static void
+io_sched_watchdog_install_handler ( void )
+{
+  struct sigaction sa;
+  
+  memset ( &sa, 0, sizeof( struct sigaction ) );
+  sa.sa_handler = io_sched_watchdog_on_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset ( &(sa.sa_mask) );
+  if ( sigaction ( IO_SCHED_WATCHDOG_SIGNAL, &sa, (struct sigaction *) 0 ) != 0 )
+    LOGSVC_ERROR( "io_sched_watchdog_install_handler(): sigaction() failed: %s", strerror ( errno ) );
+}
+
+/**
+ * Monitor thread: looks in on the scheduler loop once per period until told to stop.
+ **/
+static void *
+io_sched_watchdog_threadfn ( void * ud )
+{
+  p_io_sched_watchdog_t wd = AS_PTR_io_sched_watchdog( ud );
+  struct timespec deadline;
+  int64_t wake_at;
+  
+  LOCK_MUTEX( wd->mutex );
+  while ( !( wd->stop ) ) {
+    wake_at = inl_io_sched_watchdog_clock () + wd->period;
+    deadline.tv_sec = (time_t) ( wake_at / IO_SCHEDULER_NTIME_ONE_SECOND );
+    deadline.tv_nsec = (long) ( wake_at % IO_SCHEDULER_NTIME_ONE_SECOND );
+    pthread_cond_timedwait ( &(wd->cond), &(wd->mutex), &deadline );
+    if ( !( wd->stop ) )
+      inl_io_sched_watchdog_check ( wd );
+  }
+  UNLOCK_MUTEX( wd->mutex );
+  
+  return ud;
+}
+
+/**
+ * Has the scheduler thread record its backtrace, then logs it.
+ **/
+static inline void
+inl_io_sched_watchdog_backtrace ( p_io_sched_watchdog_t wd )
+{
+#ifdef HAVE_EXECINFO_H
+  p_io_scheduler_t scheduler = wd->scheduler;
+  struct timespec pause = { 0, IO_SCHEDULER_NTIME_ONE_SECOND / 1000 };
+  char ** symbols;
+  int ii;
+  
+  if ( !( scheduler->loop_running ) )
+    return;
+  
+  wd->bt_depth = 0;
+  wd->bt_done = 0;
+  wd->bt_wanted = 1;
+  if ( pthread_kill ( scheduler->loop_thread, IO_SCHED_WATCHDOG_SIGNAL ) != 0 ) {
+    wd->bt_wanted = 0;
+    return;
+  }
+  for ( ii = 0; ( ii < IO_SCHED_WATCHDOG_BT_WAIT_MS ) && !( wd->bt_done ); ii++ )
+    nanosleep ( &pause, (struct timespec *) 0 );
+  if ( !( wd->bt_done ) ) {
+    wd->bt_wanted = 0;
+    LOGSVC_WARNING( "Scheduler thread did not answer for its backtrace." );
+    return;
+  }
+  
+  symbols = backtrace_symbols ( wd->bt, wd->bt_depth );
+  LOGSVC_WARNING( "Scheduler thread backtrace (%d frames):", wd->bt_depth );
+  for ( ii = 0; ii < wd->bt_depth; ii++ ) {
+    if ( symbols )
+      LOGSVC_WARNING( "  #%-2d %s", ii, symbols[ ii ] );
+    else
+      LOGSVC_WARNING( "  #%-2d %p", ii, wd->bt[ ii ] );
+  }
+  free ( symbols );
+#endif
+}
+
+/**
+ * Looks in on the callback in progress on the scheduler loop, if any, and reports it once it has
+ * run over its budget.
+ **/
+static inline void
+inl_io_sched_watchdog_check ( p_io_sched_watchdog_t wd )
+{
+  p_io_scheduler_t scheduler = wd->scheduler;
+  io_scheduler_cbk_t cbk;
+  int64_t started, elapsed;
+  uint64_t seq;
+  fd_t fd;
+  
+  started = __atomic_load_n ( &(scheduler->cbk_started), __ATOMIC_ACQUIRE );
+  if ( !( started ) )
+    return;
+  seq = __atomic_load_n ( &(scheduler->cbk_seq), __ATOMIC_ACQUIRE );
+  fd = scheduler->cbk_fd;
+  cbk = scheduler->cbk_fn;
+  /* The loop fills in the rest before the start time; if that has not changed since, neither has
+     the rest. */
+  if ( __atomic_load_n ( &(scheduler->cbk_started), __ATOMIC_ACQUIRE ) != started )
+    return;
+  if ( seq == wd->reported_seq )
+    return;
+  
+  elapsed = inl_io_sched_watchdog_clock () - started;
+  if ( elapsed < scheduler->watchdog_budget )
+    return;
+  
+  wd->reported_seq = seq;
+  LOGSVC_WARNING( "Callback %p for FD %d has been running for %lld us; budget is %lld us.",
+                  (void*) (uintptr_t) cbk, fd, (long long) ( elapsed / 1000 ), (long long) ( scheduler->watchdog_budget / 1000 ) );
+  if ( wd->want_backtrace )
+    inl_io_sched_watchdog_backtrace ( wd );
+}
+
+/**
+ * Reads the clock callback start times are taken on, in nanoseconds.
+ **/
+static inline int64_t
+inl_io_sched_watchdog_clock ( void )
+{
+  struct timespec ts;
+  clock_gettime ( CLOCK_MONOTONIC, &ts );
+  return ( (int64_t) ts.tv_sec * IO_SCHEDULER_NTIME_ONE_SECOND ) + (int64_t) ts.tv_nsec;
+}
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
@@ -5,6 +5,7 @@
  **/
 
 #include "io-scheduler.h"
+#include "io-sched-backend.h"
 
 #define CATEGORY_NAME "io-scheduler"
 #include "logging-svc.h"
@@ -23,20 +24,191 @@
 
 static void io_sched_destroy_task ( p_io_scheduler_task_t io_task );
 
+static bool_t io_sched_process_task ( p_io_scheduler_task_t io_task, io_task_opts_t ready_opts, bool_t task_expired );
+
 static void * io_sched_threadfn ( void * ud );
 
+static inline void inl_io_sched_apply_thread_attr ( p_io_scheduler_t scheduler );
+
+static inline bool_t inl_io_sched_call ( p_io_scheduler_task_t io_task, io_scheduler_cbk_t cbk, io_sched_cbk_kind_t kind, int errcode );
+
+static inline void inl_io_sched_busy_poll_socket ( p_io_scheduler_t scheduler, fd_t fd );
+
+static inline p_io_sched_backend_t inl_io_sched_choose_backend ( io_sched_backend_type_t backend );
+
+static inline p_io_sched_backend_t inl_io_sched_fallback_backend ( p_io_sched_backend_t backend );
+
+static inline void inl_io_sched_hist_add ( io_sched_histogram_t * hist, int64_t ns );
+
 static inline void inl_io_sched_populate_expire_time ( p_io_scheduler_task_t io_task );
 
+static inline int64_t inl_io_sched_read_clock ( p_io_scheduler_t scheduler );
+
 static inline void inl_io_sched_pump ( p_io_scheduler_t scheduler );
 
+static inline void inl_io_sched_release_removed_tasks ( p_io_scheduler_t scheduler );
+
+static inline void inl_io_sched_reschedule_task_now ( p_io_scheduler_task_t io_task );
+
+static inline int64_t inl_io_sched_stats_clock ( void );
+
+static inline bool_t inl_io_sched_schedule_task_now ( p_io_scheduler_task_t io_task );
+
+static inline bool_t inl_io_sched_submit ( p_io_scheduler_task_t io_task, int cmd );
+
+static inline void inl_io_sched_unschedule_task_locked ( p_io_scheduler_task_t io_task );
+
+static inline void inl_io_sched_unschedule_task_now ( p_io_scheduler_task_t io_task );
+
+static inline void inl_io_sched_usage_refused ( const char * what, const io_sched_limits_t * limits, uint64_t * num_refused );
+
+static inline void inl_io_sched_usage_taken ( const char * what, const io_sched_limits_t * limits, size_t in_use, size_t * high_watermark );
+
+static inline void inl_io_sched_close_wakeup ( p_io_scheduler_t scheduler );
+
+static inline p_io_scheduler_task_t * inl_io_sched_lookup_chain ( p_io_scheduler_t scheduler, fd_t fd, bool_t grow );
+
+static inline bool_t inl_io_sched_lookup_insert ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task );
+
+static inline void inl_io_sched_lookup_remove ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task );
+
+static inline int64_t inl_io_sched_next_timeout ( p_io_scheduler_t scheduler );
+
+static inline void inl_io_sched_drain_submissions ( p_io_scheduler_t scheduler, bool_t make_calls );
+
+static inline bool_t inl_io_sched_open_wakeup ( p_io_scheduler_t scheduler );
+
+static inline void inl_io_sched_process_expired_tasks ( p_io_scheduler_t scheduler );
+
+static inline void inl_io_sched_refuse_task ( p_io_scheduler_task_t io_task );
+
+static inline bool_t inl_io_sched_slab_grow ( p_io_scheduler_t scheduler );
+
+static inline p_io_scheduler_task_t inl_io_sched_slab_lookup ( p_io_scheduler_t scheduler, io_sched_handle_t handle );
+
+static inline bool_t inl_io_sched_timer_id_grow ( p_io_scheduler_t scheduler );
+
+static inline bool_t inl_io_sched_timer_before ( p_io_scheduler_task_t t1, p_io_scheduler_task_t t2 );
+
+static inline bool_t inl_io_sched_timer_insert ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task );
+
+static inline void inl_io_sched_timer_remove ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task );
+
+static inline void inl_io_sched_timer_sift_down ( p_io_scheduler_t scheduler, size_t slot );
+
+static inline void inl_io_sched_timer_sift_up ( p_io_scheduler_t scheduler, size_t slot );
+
+static inline int inl_io_sched_wait ( p_io_scheduler_t scheduler, int64_t time_out );
+
+static inline void inl_io_sched_wakeup ( p_io_scheduler_t scheduler );
+
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 /* Module variables      */
 /* ---------- ---------- */
 
+/* Default number of reads or writes an edge-triggered callback makes per pass. */
+#define IO_SCHEDULER_DEFAULT_EDGE_BATCH 16
+
+/* Default per-pass budget of the bulk priority class: callbacks made, and bytes accounted. */
+#define IO_SCHEDULER_DEFAULT_BULK_CALLBACKS 64
+#define IO_SCHEDULER_DEFAULT_BULK_BYTES ( 1024 * 1024 )
+
+/* Initial number of entries in the descriptor and timer lookup tables; grown as needed. */
+#define IO_SCHEDULER_INITIAL_FD_LOOKUP  64
+
+/* Timer IDs are added to the pool this many at a time. */
+#define IO_SCHEDULER_TIMER_CHUNK        256
+
+/* Timer IDs are handed out from -3 downwards; maps one onto its timer lookup table entry. */
+#define IO_SCHEDULER_TIMER_INDEX(id)    ((size_t) ( -(id) - 3 ))
+
+/* Commands a task may have pending on its scheduler's submission queue. */
+#define IO_SCHEDULER_CMD_SCHEDULE       0x01
+#define IO_SCHEDULER_CMD_RESCHEDULE     0x02
+#define IO_SCHEDULER_CMD_UNSCHEDULE     0x04
+
+/* Set once a task is on its way out, whether or not the scheduler loop has caught up yet; none
+   of its callbacks should be made from then on. */
+#define S_IOSCHED_TASK_LEAVING(t)       ( S_IOSCHED_OPTS_REMOVE( t ) || ( (t)->pending_cmds & IO_SCHEDULER_CMD_UNSCHEDULE ) )
+
+/* A call queued with io_sched_post(). */
+typedef struct _io_sched_posted_call {
+  struct _io_sched_posted_call *        next;
+  io_sched_post_fn_t                    fn;
+  void *                                arg;
+} io_sched_posted_call_t, * p_io_sched_posted_call_t;
+
+#define NEW_io_sched_posted_call()      ( (p_io_sched_posted_call_t) malloc ( sizeof( struct _io_sched_posted_call ) ) )
+
+/* Tasks are carved out of chunks of this many slots, each slot starting on its own cache line. */
+#define IO_SCHEDULER_SLAB_CHUNK         256
+#define IO_SCHEDULER_SLAB_MAX_CHUNKS    ( ( (size_t) IO_SCHEDULER_HANDLE_INDEX_MASK + 1 ) / IO_SCHEDULER_SLAB_CHUNK )
+#define IO_SCHEDULER_CACHE_LINE         64
+
+/* A slot in the task slab; the task comes first, so that a task pointer is also its slot pointer. */
+typedef struct _io_sched_slab_slot {
+  io_scheduler_task_t                   task;
+  volatile uint32_t                     generation;
+} __attribute__ (( aligned ( IO_SCHEDULER_CACHE_LINE ) )) io_sched_slab_slot_t, * p_io_sched_slab_slot_t;
+
+#define IO_SCHEDULER_SLAB_SLOT(s, idx)  ( &( (s)->slab_chunks[ (idx) / IO_SCHEDULER_SLAB_CHUNK ][ (idx) % IO_SCHEDULER_SLAB_CHUNK ] ) )
+
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 /* Exposed functions     */
 /* ---------- ---------- */
 
+/**
+ * Counts bytes read or written by the callback under way against its priority class's budget.
+ **/
+void
+io_sched_account_bytes ( p_io_scheduler_task_t io_task, size_t num_bytes )
+{
+  if ( io_task )
+    io_task->owner->dispatch_bytes += num_bytes;
+}
+
+/**
+ * Returns the name of the event notification backend in use by the scheduler.
+ **/
+const char *
+io_sched_backend_name ( p_io_scheduler_t scheduler )
+{
+  if ( !(scheduler) || !(scheduler->backend) )
+    return "none";
+  return scheduler->backend->name;
+}
+
+/**
+ * Fills in a scheduler configuration with the default settings.
+ **/
+void
+io_sched_config_init ( io_scheduler_config_t * config )
+{
+  if ( config ) {
+    memset ( config, 0, sizeof( io_scheduler_config_t ) );
+    config->backend = IO_SCHEDULER_BACKEND_AUTO;
+    config->clock = IO_SCHEDULER_CLOCK_MONOTONIC;
+    config->edge_batch = IO_SCHEDULER_DEFAULT_EDGE_BATCH;
+    config->budgets[ IO_SCHEDULER_PRIORITY_BULK ].callbacks = IO_SCHEDULER_DEFAULT_BULK_CALLBACKS;
+    config->budgets[ IO_SCHEDULER_PRIORITY_BULK ].bytes = IO_SCHEDULER_DEFAULT_BULK_BYTES;
+  }
+}
+
+/**
+ * Hands a pass's worth of readiness over to the next pass, from within an edge-triggered task's
+ * callback.
+ **/
+void
+io_sched_continue_task ( p_io_scheduler_task_t io_task, io_task_opts_t ready_opts )
+{
+  ready_opts &= ( IO_SCHEDULER_READ | IO_SCHEDULER_WRITE | IO_SCHEDULER_ERROR );
+  if ( !( io_task ) || ( ready_opts == IO_SCHEDULER_NONE ) || S_IOSCHED_TASK_LEAVING( io_task ) )
+    return;
+  /* The pass clears a task's readiness before calling it back, so this queues the task afresh for
+     the next pass; the chain is only ever touched from the scheduler's own thread. */
+  io_sched_mark_task_ready ( io_task, ready_opts );
+}
+
 /**
  * Creates a read-only task for the given file descriptor; will wait only time_out microseconds
  * before calling the read callback method with a timeout error.
@@ -49,7 +221,7 @@ io_sched_create_reader_task ( p_io_scheduler_t scheduler,
   if ( time_out > 0 )
     opts |= IO_SCHEDULER_TIMER;
   LOGSVC_TRACE( "io_sched_create_reader_task(): fd == %d, time_out == %lu", fd, time_out );
-  return io_sched_create_task ( scheduler, fd, opts, time_out, user_data,
+  return io_sched_create_task ( scheduler, fd, opts, time_out, IO_SCHEDULER_NO_SLACK, user_data,
                                 read_cbk, NIL_IO_SCHEDULER_CBK, NIL_IO_SCHEDULER_CBK, read_cbk );
 }
 
@@ -66,58 +238,152 @@ io_sched_create_reader_task_ex ( p_io_scheduler_t scheduler,
   if ( time_out > 0 )
     opts |= IO_SCHEDULER_TIMER;
   LOGSVC_TRACE( "io_sched_create_reader_task_ex(): fd == %d, time_out == %lu", fd, time_out );
-  return io_sched_create_task ( scheduler, fd, opts, time_out, user_data,
+  return io_sched_create_task ( scheduler, fd, opts, time_out, IO_SCHEDULER_NO_SLACK, user_data,
                                 read_cbk, NIL_IO_SCHEDULER_CBK, err_cbk, read_cbk );
 }
 
 /**
  * Creates a scheduler and tells it how many tasks it can handle concurrently.
- * @param max_concurrent_tasks Max number of tasks scheduler can have scheduled at any given time.
- * @param max_num_timers Max number of timers scheduler can have scheduled at any given time.
+ * @param max_concurrent_tasks Number of tasks to make room for up front; more are added as needed.
+ * @param max_num_timers Number of timers to make room for up front; more are added as needed.
  * @return The IO scheduler, or NULL if unable to create the scheduler.
  **/
 p_io_scheduler_t
 io_sched_create_scheduler ( size_t max_concurrent_tasks, size_t max_num_timers )
 {
-  p_io_scheduler_t rv;
-  size_t ii;
-  fd_t timer_id;
+  io_scheduler_config_t config;
   
-  LOGSVC_TRACE( "io_sched_create_scheduler(): max_tasks == %d, max_timers == %d", max_concurrent_tasks, max_num_timers );
+  io_sched_config_init ( &config );
+  config.max_concurrent_tasks = max_concurrent_tasks;
+  config.max_num_timers = max_num_timers;
+  return io_sched_create_scheduler_ex ( &config );
+}
+
+/**
+ * Creates a scheduler using the given settings.
+ * @param config Scheduler settings, prepared with io_sched_config_init().
+ * @return The IO scheduler, or NULL if unable to create the scheduler.
+ **/
+p_io_scheduler_t
+io_sched_create_scheduler_ex ( const io_scheduler_config_t * config )
+{
+  p_io_scheduler_t rv;
+  size_t max_concurrent_tasks, max_num_timers;
   
-  if ( !(max_concurrent_tasks) || !(max_num_timers) )
+  if ( !(config) )
     return NIL_IO_SCHEDULER;
   
+  max_concurrent_tasks = config->max_concurrent_tasks;
+  max_num_timers = config->max_num_timers;
+  
+  LOGSVC_TRACE( "io_sched_create_scheduler(): max_tasks == %d, max_timers == %d", max_concurrent_tasks, max_num_timers );
+  
   rv = (p_io_scheduler_t) malloc ( IO_SCHEDULER_STRUCT_SIZE );
   if ( rv ) {
     memset ( rv, 0, IO_SCHEDULER_STRUCT_SIZE );
-    rv->task_pool = stack_fixed_init ( max_concurrent_tasks );
-    rv->timer_id_pool = stack_fixed_init ( max_num_timers );
-    if ( !(rv->task_pool) || !(rv->timer_id_pool) ) {
+    rv->wakeup_rd_fd = rv->wakeup_wr_fd = INVALID_GENERAL_FD;
+#ifdef CLOCK_MONOTONIC_COARSE
+    rv->clock_id = ( config->clock == IO_SCHEDULER_CLOCK_MONOTONIC_COARSE ) ? CLOCK_MONOTONIC_COARSE : CLOCK_MONOTONIC;
+#else
+    rv->clock_id = CLOCK_MONOTONIC;
+#endif
+    rv->now = inl_io_sched_read_clock ( rv );
+    rv->edge_batch = config->edge_batch;
+    memcpy ( rv->budgets, config->budgets, sizeof( rv->budgets ) );
+    rv->task_limits = config->task_limits;
+    rv->timer_limits = config->timer_limits;
+    if ( config->busy_poll > 0 ) {
+      rv->busy_poll = config->busy_poll;
+      if ( config->busy_poll_usecs == 0 )
+        rv->busy_poll_usecs = (int) ( ( config->busy_poll + 999 ) / 1000 );
+      else if ( config->busy_poll_usecs > 0 )
+        rv->busy_poll_usecs = config->busy_poll_usecs;
+    }
+    if ( config->collect_stats ) {
+      rv->stats = (p_io_sched_stats_t) calloc ( 1, sizeof( io_sched_stats_t ) );
+      if ( !(rv->stats) ) {
+        free ( rv );
+        return NIL_IO_SCHEDULER;
+      }
+    }
+    pthread_mutex_init ( &(rv->task_list_mutex), (const pthread_mutexattr_t *) 0 );
+    pthread_mutex_init ( &(rv->task_pool_mutex), (const pthread_mutexattr_t *) 0 );
+    pthread_mutex_init ( &(rv->timer_pool_mutex), (const pthread_mutexattr_t *) 0 );
+    
+    rv->slab_chunks = (p_io_sched_slab_slot_t *) calloc ( IO_SCHEDULER_SLAB_MAX_CHUNKS, sizeof( p_io_sched_slab_slot_t ) );
+    if ( !(rv->slab_chunks) ) {
       io_sched_destroy_scheduler ( rv );
       return NIL_IO_SCHEDULER;
     }
-    /* Create the tasks */
-    for ( ii=0; ii < max_concurrent_tasks; ii++ ) {
-      void * tmp = malloc ( IO_SCHEDULER_TASK_STRUCT_SIZE );
-      if ( !(tmp) ) {
+    /* Create the tasks and timer IDs; past these, each pool only grows when one is wanted and
+       none are free. */
+    while ( ( rv->slab_capacity < max_concurrent_tasks ) || ( rv->timer_capacity < max_num_timers ) ) {
+      if ( ( ( rv->slab_capacity < max_concurrent_tasks ) && !( inl_io_sched_slab_grow ( rv ) ) ) ||
+           ( ( rv->timer_capacity < max_num_timers ) && !( inl_io_sched_timer_id_grow ( rv ) ) ) )
+      {
         fprintf ( stderr, "CRITICAL: io_sched_create_scheduler() : Out of memory.\n" );
         io_sched_destroy_scheduler ( rv );
         return NIL_IO_SCHEDULER;
       }
-      if ( stack_fixed_push ( rv->task_pool, tmp ) == STACK_ERROR_FULL )
-        break;
     }
     
-    /* Create the timers */
-    for ( timer_id = -max_num_timers - 2; timer_id < -2; timer_id++ ) {
-      if ( stack_fixed_push ( rv->timer_id_pool, (void*) timer_id ) == STACK_ERROR_FULL )
-        break;
+    /* Room for a timeout on every task made up front; the heap grows along with the slab. */
+    rv->timer_heap_size = rv->slab_capacity + 1;
+    rv->timer_heap = (p_io_scheduler_task_t *) malloc ( rv->timer_heap_size * sizeof( p_io_scheduler_task_t ) );
+    if ( !(rv->timer_heap) ) {
+      fprintf ( stderr, "CRITICAL: io_sched_create_scheduler() : Out of memory.\n" );
+      io_sched_destroy_scheduler ( rv );
+      return NIL_IO_SCHEDULER;
     }
     
-    pthread_mutex_init ( &(rv->task_list_mutex), (const pthread_mutexattr_t *) 0 );
-    pthread_mutex_init ( &(rv->task_pool_mutex), (const pthread_mutexattr_t *) 0 );
-    pthread_mutex_init ( &(rv->timer_pool_mutex), (const pthread_mutexattr_t *) 0 );
+    /* Lookup tables; one entry per timer ID made up front, and both grow as needed. */
+    rv->fd_lookup_size = IO_SCHEDULER_INITIAL_FD_LOOKUP;
+    rv->fd_lookup = (p_io_scheduler_task_t *) calloc ( rv->fd_lookup_size, sizeof( p_io_scheduler_task_t ) );
+    rv->timer_lookup_size = ( rv->timer_capacity > IO_SCHEDULER_INITIAL_FD_LOOKUP ) ? rv->timer_capacity : IO_SCHEDULER_INITIAL_FD_LOOKUP;
+    rv->timer_lookup = (p_io_scheduler_task_t *) calloc ( rv->timer_lookup_size, sizeof( p_io_scheduler_task_t ) );
+    if ( !(rv->fd_lookup) || !(rv->timer_lookup) ) {
+      fprintf ( stderr, "CRITICAL: io_sched_create_scheduler() : Out of memory.\n" );
+      io_sched_destroy_scheduler ( rv );
+      return NIL_IO_SCHEDULER;
+    }
+    
+    /* The backend watches the wakeup descriptor, so it has to exist first. */
+    if ( !( inl_io_sched_open_wakeup ( rv ) ) ) {
+      io_sched_destroy_scheduler ( rv );
+      return NIL_IO_SCHEDULER;
+    }
+    
+    /* Bring up the event notification backend, falling back to the simpler ones if need be; the
+       kernel may lack io_uring (or have it disabled) even where the headers are present. */
+    rv->backend = inl_io_sched_choose_backend ( config->backend );
+    while ( !( rv->backend->init ( rv ) ) ) {
+      p_io_sched_backend_t fallback = inl_io_sched_fallback_backend ( rv->backend );
+      if ( !( fallback ) ) {
+        rv->backend = NIL_IO_SCHED_BACKEND;
+        io_sched_destroy_scheduler ( rv );
+        return NIL_IO_SCHEDULER;
+      }
+      LOGSVC_WARNING( "io_sched_create_scheduler(): Unable to start '%s' backend; falling back to '%s'.", rv->backend->name, fallback->name );
+      rv->backend = fallback;
+    }
+    LOGSVC_DEBUG( "io_sched_create_scheduler(): Using '%s' backend.", rv->backend->name );
+    
+    /* Slow-callback watchdog, if asked for. */
+    if ( config->watchdog_budget > 0 ) {
+      rv->watchdog_budget = config->watchdog_budget;
+      if ( !( io_sched_watchdog_start ( rv, config->watchdog_backtrace ) ) ) {
+        io_sched_destroy_scheduler ( rv );
+        return NIL_IO_SCHEDULER;
+      }
+    }
+    
+    /* Worker pool for io_sched_offload(), if asked for. */
+    if ( config->num_workers > 0 ) {
+      if ( !( io_sched_pool_start ( rv, config->num_workers ) ) ) {
+        io_sched_destroy_scheduler ( rv );
+        return NIL_IO_SCHEDULER;
+      }
+    }
   }
   return rv;
 }
@@ -128,27 +394,45 @@ io_sched_create_scheduler ( size_t max_concurrent_tasks, size_t max_num_timers )
  **/
 p_io_scheduler_task_t
 io_sched_create_task ( p_io_scheduler_t scheduler,
-                       fd_t fd, io_task_opts_t opts, int64_t time_out, void * user_data,
+                       fd_t fd, io_task_opts_t opts, int64_t time_out, int64_t slack, void * user_data,
                        io_scheduler_cbk_t read_cbk,
                        io_scheduler_cbk_t write_cbk,
                        io_scheduler_cbk_t err_cbk,
                        io_scheduler_cbk_t time_out_cbk )
 {
-  p_io_scheduler_task_t ptask;
+  p_io_scheduler_task_t ptask = NIL_IO_SCHEDULER_TASK;
+  p_io_sched_slab_slot_t slot;
+  uint32_t index;
   
   if ( !(scheduler) )
     return NIL_IO_SCHEDULER_TASK;
   
   LOGSVC_TRACE( "io_sched_create_task(): fd == %d, opts == %u, time_out == %lu", fd, opts, time_out );
-  ptask = (p_io_scheduler_task_t) stack_fixed_pop_and_return_r ( scheduler->task_pool_mutex, scheduler->task_pool );
+  /* Slots are cleared as they are released, so there is nothing more to do than take one. */
+  LOCK_MUTEX( scheduler->task_pool_mutex );
+  if ( ( !( scheduler->task_limits.hard ) || ( scheduler->slab_capacity - scheduler->slab_num_free < scheduler->task_limits.hard ) ) &&
+       ( ( scheduler->slab_num_free ) || inl_io_sched_slab_grow ( scheduler ) ) )
+  {
+    index = scheduler->slab_free[ --(scheduler->slab_num_free) ];
+    slot = IO_SCHEDULER_SLAB_SLOT( scheduler, index );
+    ptask = &( slot->task );
+    ptask->handle = IO_SCHEDULER_HANDLE( index, slot->generation );
+    inl_io_sched_usage_taken ( "Task slab", &( scheduler->task_limits ),
+                               scheduler->slab_capacity - scheduler->slab_num_free, &( scheduler->task_high_watermark ) );
+  }
+  else {
+    inl_io_sched_usage_refused ( "Task slab", &( scheduler->task_limits ), &( scheduler->task_num_refused ) );
+  }
+  UNLOCK_MUTEX( scheduler->task_pool_mutex );
   if ( ptask ) {
-    memset ( ptask, 0, IO_SCHEDULER_TASK_STRUCT_SIZE );
     if ( opts & IO_SCHEDULER_REMOVE )
       opts &= ~IO_SCHEDULER_REMOVE;
     ptask->owner = scheduler;
     ptask->fd = fd;
     ptask->opts = opts;
+    ptask->priority = IO_SCHEDULER_PRIORITY_INTERACTIVE;
     ptask->time_out = time_out;
+    ptask->slack = ( slack > 0 ) ? slack : IO_SCHEDULER_NO_SLACK;
     ptask->user_data = user_data;
     ptask->on_read_rdy_cbk = read_cbk;
     ptask->on_write_rdy_cbk = write_cbk;
@@ -163,20 +447,39 @@ io_sched_create_task ( p_io_scheduler_t scheduler,
  **/
 p_io_scheduler_task_t
 io_sched_create_timer_task ( p_io_scheduler_t scheduler,
-                             int64_t time_out, void * user_data, io_scheduler_cbk_t time_out_cbk )
+                             int64_t time_out, int64_t slack, void * user_data, io_scheduler_cbk_t time_out_cbk )
 {
-  fd_t timer_id;
+  p_io_scheduler_task_t ptask;
+  fd_t timer_id = INVALID_GENERAL_FD;
   
   if ( !(scheduler) )
     return NIL_IO_SCHEDULER_TASK;
   
-  timer_id = (fd_t) stack_fixed_pop_and_return_r ( scheduler->timer_pool_mutex, scheduler->timer_id_pool );
-  if ( !(timer_id) )
+  LOCK_MUTEX( scheduler->timer_pool_mutex );
+  if ( ( !( scheduler->timer_limits.hard ) || ( scheduler->timer_capacity - scheduler->timer_num_free < scheduler->timer_limits.hard ) ) &&
+       ( ( scheduler->timer_num_free ) || inl_io_sched_timer_id_grow ( scheduler ) ) )
+  {
+    timer_id = -3 - (fd_t) scheduler->timer_free[ --(scheduler->timer_num_free) ];
+    inl_io_sched_usage_taken ( "Timer pool", &( scheduler->timer_limits ),
+                               scheduler->timer_capacity - scheduler->timer_num_free, &( scheduler->timer_high_watermark ) );
+  }
+  else {
+    inl_io_sched_usage_refused ( "Timer pool", &( scheduler->timer_limits ), &( scheduler->timer_num_refused ) );
+  }
+  UNLOCK_MUTEX( scheduler->timer_pool_mutex );
+  if ( timer_id == INVALID_GENERAL_FD )
     return NIL_IO_SCHEDULER_TASK;
   
   LOGSVC_TRACE( "io_sched_create_timer_task(): timer_id == %d, time_out == %lu", timer_id, time_out );
-  return io_sched_create_task ( scheduler, timer_id, IO_SCHEDULER_TIMER, time_out, user_data,
-                                NIL_IO_SCHEDULER_CBK, NIL_IO_SCHEDULER_CBK, NIL_IO_SCHEDULER_CBK, time_out_cbk );
+  ptask = io_sched_create_task ( scheduler, timer_id, IO_SCHEDULER_TIMER, time_out, slack, user_data,
+                                 NIL_IO_SCHEDULER_CBK, NIL_IO_SCHEDULER_CBK, NIL_IO_SCHEDULER_CBK, time_out_cbk );
+  if ( !( ptask ) ) {
+    /* No task to go with it; the ID goes straight back. */
+    LOCK_MUTEX( scheduler->timer_pool_mutex );
+    scheduler->timer_free[ scheduler->timer_num_free++ ] = (uint32_t) IO_SCHEDULER_TIMER_INDEX( timer_id );
+    UNLOCK_MUTEX( scheduler->timer_pool_mutex );
+  }
+  return ptask;
 }
 
 /**
@@ -191,7 +494,7 @@ io_sched_create_writer_task ( p_io_scheduler_t scheduler,
   if ( time_out > 0 )
     opts |= IO_SCHEDULER_TIMER;
   LOGSVC_TRACE( "io_sched_create_writer_task(): fd == %d, time_out == %lu", fd, time_out );
-  return io_sched_create_task ( scheduler, fd, opts, time_out, user_data,
+  return io_sched_create_task ( scheduler, fd, opts, time_out, IO_SCHEDULER_NO_SLACK, user_data,
                                 NIL_IO_SCHEDULER_CBK, write_cbk, NIL_IO_SCHEDULER_CBK, write_cbk );
 }
 
@@ -202,10 +505,19 @@ void
 io_sched_destroy_scheduler ( p_io_scheduler_t scheduler )
 {
   p_io_scheduler_task_t ptask;
+  size_t ii;
   
   LOGSVC_DEBUG( "io_sched_destroy_scheduler()" );
   
   if ( scheduler ) {
+    /* Nothing left for the watchdog to look in on. */
+    io_sched_watchdog_stop ( scheduler );
+    /* Workers go before the tasks they may be working for; outstanding work is handed back here. */
+    io_sched_pool_stop ( scheduler );
+    
+    /* Catch up on anything submitted since the loop last ran, so that it is cleared below. */
+    inl_io_sched_drain_submissions ( scheduler, CMNUTIL_FALSE );
+    
     /* Clear any scheduled tasks */
     LOGSVC_DEBUG( "Clearing scheduled tasks" );
     LOCK_MUTEX( scheduler->task_list_mutex );
@@ -214,19 +526,35 @@ io_sched_destroy_scheduler ( p_io_scheduler_t scheduler )
       io_sched_destroy_task ( scheduler->scheduled_tasks );
       scheduler->scheduled_tasks = ptask;
     }
+    scheduler->scheduled_tasks_tail = NIL_IO_SCHEDULER_TASK;
+    scheduler->num_scheduled_tasks = 0;
+    scheduler->removed_tasks = NIL_IO_SCHEDULER_TASK;
     UNLOCK_MUTEX( scheduler->task_list_mutex );
     
-    /* Remove any tasks in the task pool. */
-    LOGSVC_DEBUG( "Clearing task pool" );
-    while ( (ptask = (p_io_scheduler_task_t) stack_fixed_pop_and_return ( scheduler->task_pool )) != NIL_IO_SCHEDULER_TASK ) {
-      free ( ptask );
+    /* Shut down the event notification backend. */
+    if ( scheduler->backend ) {
+      LOGSVC_DEBUG( "Destroying '%s' backend", scheduler->backend->name );
+      scheduler->backend->destroy ( scheduler );
     }
-    LOGSVC_DEBUG( "Destroying task pool" );
-    stack_fixed_destroy ( scheduler->task_pool );
+    inl_io_sched_close_wakeup ( scheduler );
+    
+    /* Release the task slab. */
+    LOGSVC_DEBUG( "Destroying task slab" );
+    if ( scheduler->slab_chunks ) {
+      for ( ii = 0; ii < scheduler->slab_num_chunks; ii++ )
+        free ( scheduler->slab_chunks[ ii ] );
+      free ( scheduler->slab_chunks );
+    }
+    free ( scheduler->slab_free );
     
     /* Remove the timer pool. */
-    LOGSVC_DEBUG( "Destroying timer pool" );
-    stack_fixed_destroy ( scheduler->timer_id_pool );
+    LOGSVC_DEBUG( "Destroying timer pool; at most %lu tasks and %lu timers were in use at once.",
+                  (unsigned long) scheduler->task_high_watermark, (unsigned long) scheduler->timer_high_watermark );
+    free ( scheduler->timer_free );
+    free ( scheduler->timer_heap );
+    free ( scheduler->fd_lookup );
+    free ( scheduler->timer_lookup );
+    free ( scheduler->stats );
     
     /* Free the mutexes */
     pthread_mutex_destroy ( &(scheduler->timer_pool_mutex) );
@@ -240,6 +568,75 @@ io_sched_destroy_scheduler ( p_io_scheduler_t scheduler )
   
 }
 
+/**
+ * Shuts the scheduler down cooperatively, letting its tasks run to completion up to a deadline.
+ **/
+size_t
+io_sched_drain_scheduler ( p_io_scheduler_t scheduler, int64_t time_out,
+                           io_sched_pending_fn_t pending_fn, void * arg )
+{
+  p_io_scheduler_task_t ptask;
+  struct timespec deadline;
+  size_t num_pending = 0;
+  int rc;
+  
+  if ( !(scheduler) )
+    return 0;
+  
+  LOGSVC_DEBUG( "io_sched_drain_scheduler(): Draining %lu tasks.", (unsigned long) scheduler->num_scheduled_tasks );
+  scheduler->draining = CMNUTIL_TRUE;
+  /* An idle loop has to see the flag to notice that it is done. */
+  inl_io_sched_wakeup ( scheduler );
+  
+  if ( scheduler->scheduler_thread && !pthread_equal ( scheduler->scheduler_thread, pthread_self () ) ) {
+    if ( time_out < 0 ) {
+      rc = pthread_join ( scheduler->scheduler_thread, NULL );
+    }
+    else {
+      /* The join deadline is on the wall clock; a step in it only moves the deadline about. */
+      clock_gettime ( CLOCK_REALTIME, &deadline );
+      deadline.tv_sec += (time_t) ( time_out / IO_SCHEDULER_NTIME_ONE_SECOND );
+      deadline.tv_nsec += (long) ( time_out % IO_SCHEDULER_NTIME_ONE_SECOND );
+      if ( deadline.tv_nsec >= IO_SCHEDULER_NTIME_ONE_SECOND ) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= IO_SCHEDULER_NTIME_ONE_SECOND;
+      }
+      rc = pthread_timedjoin_np ( scheduler->scheduler_thread, NULL, &deadline );
+      if ( rc == ETIMEDOUT ) {
+        LOGSVC_WARNING( "io_sched_drain_scheduler(): Out of time with %lu tasks scheduled; stopping.",
+                        (unsigned long) scheduler->num_scheduled_tasks );
+        scheduler->stop_scheduler = CMNUTIL_TRUE;
+        inl_io_sched_wakeup ( scheduler );
+        rc = pthread_join ( scheduler->scheduler_thread, NULL );
+      }
+    }
+    if ( rc != 0 )
+      LOGSVC_ERROR( "io_sched_drain_scheduler(): Unable to join scheduler thread: %s", strerror ( rc ) );
+    scheduler->scheduler_thread = (pthread_t) 0;
+  }
+  else {
+    /* Called from within the loop, or with no thread of its own to wait on; stop where it is. */
+    scheduler->stop_scheduler = CMNUTIL_TRUE;
+    inl_io_sched_wakeup ( scheduler );
+  }
+  scheduler->stop_scheduler = CMNUTIL_TRUE;
+  
+  /* Whatever is left never got to finish. */
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  for ( ptask = scheduler->scheduled_tasks; ptask; ptask = ptask->next ) {
+    if ( S_IOSCHED_OPTS_REMOVE( ptask ) )
+      continue;
+    num_pending++;
+    LOGSVC_NOTICE( "io_sched_drain_scheduler(): Task for FD %d still pending.", ptask->fd );
+    if ( pending_fn )
+      pending_fn ( ptask, arg );
+    inl_io_sched_unschedule_task_locked ( ptask );
+  }
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  
+  return num_pending;
+}
+
 /**
  * Locates a task in the scheduler based on its file descriptor / timer ID.
  **/
@@ -247,17 +644,187 @@ p_io_scheduler_task_t
 io_sched_find_task ( p_io_scheduler_t scheduler, fd_t fd )
 {
   p_io_scheduler_task_t ptask = NIL_IO_SCHEDULER_TASK;
+  p_io_scheduler_task_t * pp;
   LOGSVC_TRACE( "io_sched_find_task(): fd == %d", fd );
   if ( scheduler ) {
     LOCK_MUTEX( scheduler->task_list_mutex );
-    ptask = scheduler->scheduled_tasks;
+    pp = inl_io_sched_lookup_chain ( scheduler, fd, CMNUTIL_FALSE );
+    ptask = ( pp ? *pp : NIL_IO_SCHEDULER_TASK );
     while ( ptask && ( ptask->fd != fd ) )
-      ptask = ptask->next;
+      ptask = ptask->lookup_next;
+    UNLOCK_MUTEX( scheduler->task_list_mutex );
+  }
+  return ptask;
+}
+
+/**
+ * Locates a task in the scheduler by its handle; returns NULL when the handle is stale.
+ **/
+p_io_scheduler_task_t
+io_sched_find_task_by_handle ( p_io_scheduler_t scheduler, io_sched_handle_t handle )
+{
+  p_io_scheduler_task_t ptask = NIL_IO_SCHEDULER_TASK;
+  
+  if ( scheduler ) {
+    LOCK_MUTEX( scheduler->task_list_mutex );
+    ptask = inl_io_sched_slab_lookup ( scheduler, handle );
     UNLOCK_MUTEX( scheduler->task_list_mutex );
   }
   return ptask;
 }
 
+/**
+ * Reports the usage of the scheduler's task slab and timer ID pool.
+ **/
+bool_t
+io_sched_get_capacity ( p_io_scheduler_t scheduler, io_sched_capacity_t * tasks, io_sched_capacity_t * timers )
+{
+  if ( !(scheduler) )
+    return CMNUTIL_FALSE;
+  if ( tasks ) {
+    LOCK_MUTEX( scheduler->task_pool_mutex );
+    tasks->in_use = scheduler->slab_capacity - scheduler->slab_num_free;
+    tasks->capacity = scheduler->slab_capacity;
+    tasks->high_watermark = scheduler->task_high_watermark;
+    tasks->num_refused = scheduler->task_num_refused;
+    UNLOCK_MUTEX( scheduler->task_pool_mutex );
+  }
+  if ( timers ) {
+    LOCK_MUTEX( scheduler->timer_pool_mutex );
+    timers->in_use = scheduler->timer_capacity - scheduler->timer_num_free;
+    timers->capacity = scheduler->timer_capacity;
+    timers->high_watermark = scheduler->timer_high_watermark;
+    timers->num_refused = scheduler->timer_num_refused;
+    UNLOCK_MUTEX( scheduler->timer_pool_mutex );
+  }
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Returns the most reads or writes an edge-triggered callback should make in one pass.
+ **/
+size_t
+io_sched_get_edge_batch ( p_io_scheduler_t scheduler )
+{
+  return ( scheduler ? scheduler->edge_batch : 0 );
+}
+
+/**
+ * Takes a snapshot of the scheduler's instrumentation.
+ **/
+bool_t
+io_sched_get_stats ( p_io_scheduler_t scheduler, io_sched_stats_t * stats )
+{
+  if ( !(scheduler) || !(scheduler->stats) || !(stats) )
+    return CMNUTIL_FALSE;
+  memcpy ( stats, scheduler->stats, sizeof( io_sched_stats_t ) );
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Returns the number of tasks currently in the scheduler, including those waiting to be released.
+ **/
+size_t
+io_sched_get_task_count ( p_io_scheduler_t scheduler )
+{
+  return ( scheduler ? scheduler->num_scheduled_tasks : 0 );
+}
+
+/**
+ * Returns the task's handle.
+ **/
+io_sched_handle_t
+io_sched_get_task_handle ( p_io_scheduler_task_t io_task )
+{
+  return ( io_task ? io_task->handle : IO_SCHEDULER_INVALID_HANDLE );
+}
+
+/**
+ * Returns the smallest duration, in nanoseconds, that falls in the given histogram bucket.
+ **/
+uint64_t
+io_sched_histogram_bucket_floor ( size_t bucket )
+{
+  size_t msb;
+  
+  if ( bucket < IO_SCHEDULER_HIST_SUB_BUCKETS )
+    return (uint64_t) bucket;
+  if ( bucket >= IO_SCHEDULER_HIST_BUCKETS )
+    bucket = IO_SCHEDULER_HIST_BUCKETS - 1;
+  msb = ( bucket / IO_SCHEDULER_HIST_SUB_BUCKETS ) + IO_SCHEDULER_HIST_SUB_BITS - 1;
+  return (uint64_t) ( IO_SCHEDULER_HIST_SUB_BUCKETS + ( bucket % IO_SCHEDULER_HIST_SUB_BUCKETS ) ) << ( msb - IO_SCHEDULER_HIST_SUB_BITS );
+}
+
+/**
+ * Returns an estimate of the given percentile of the durations in a histogram, in nanoseconds.
+ **/
+uint64_t
+io_sched_histogram_percentile ( const io_sched_histogram_t * hist, double percentile )
+{
+  uint64_t rank, seen = 0, top;
+  size_t ii;
+  
+  if ( !(hist) || !(hist->count) )
+    return 0;
+  if ( percentile <= 0.0 )
+    rank = 1;
+  else if ( percentile >= 100.0 )
+    rank = hist->count;
+  else
+    rank = (uint64_t) ( ( percentile / 100.0 ) * (double) hist->count + 0.5 );
+  if ( rank < 1 )
+    rank = 1;
+  
+  for ( ii = 0; ii < IO_SCHEDULER_HIST_BUCKETS; ii++ ) {
+    seen += hist->buckets[ ii ];
+    if ( seen >= rank )
+      break;
+  }
+  if ( ii >= IO_SCHEDULER_HIST_BUCKETS - 1 )
+    return hist->max_ns;
+  top = io_sched_histogram_bucket_floor ( ii + 1 ) - 1;
+  return ( top < hist->max_ns ) ? top : hist->max_ns;
+}
+
+/**
+ * Returns the scheduler's clock reading, in nanoseconds, as of the current pass through its loop.
+ **/
+int64_t
+io_sched_now ( p_io_scheduler_t scheduler )
+{
+  if ( !(scheduler) )
+    return 0;
+  if ( !( scheduler->loop_running ) )
+    return inl_io_sched_read_clock ( scheduler );
+  return scheduler->now;
+}
+
+/**
+ * Queues a call to be made from the scheduler loop, at the top of its next pass.
+ **/
+bool_t
+io_sched_post ( p_io_scheduler_t scheduler, io_sched_post_fn_t fn, void * arg )
+{
+  p_io_sched_posted_call_t call;
+  
+  if ( !(scheduler) || !(fn) )
+    return CMNUTIL_FALSE;
+  
+  call = NEW_io_sched_posted_call();
+  if ( !(call) ) {
+    LOGSVC_ERROR( "io_sched_post(): Out of memory." );
+    return CMNUTIL_FALSE;
+  }
+  call->fn = fn;
+  call->arg = arg;
+  do {
+    call->next = scheduler->posted_calls;
+  } while ( !__sync_bool_compare_and_swap ( &( scheduler->posted_calls ), call->next, call ) );
+  
+  inl_io_sched_wakeup ( scheduler );
+  return CMNUTIL_TRUE;
+}
+
 /**
  * Reschedules a task, essentially updating its expiration time.
  **/
@@ -269,7 +836,8 @@ io_sched_reschedule_task ( p_io_scheduler_task_t io_task )
   if ( S_IOSCHED_OPTS_REMOVE( io_task ) )
     return CMNUTIL_FALSE;
   LOGSVC_TRACE( "io_sched_reschedule_task(): Rescheduling task FD == %d", io_task->fd );
-  inl_io_sched_populate_expire_time ( io_task );
+  if ( !( inl_io_sched_submit ( io_task, IO_SCHEDULER_CMD_RESCHEDULE ) ) )
+    inl_io_sched_reschedule_task_now ( io_task );
   return CMNUTIL_TRUE;
 }
 
@@ -284,9 +852,14 @@ io_sched_run_scheduler ( p_io_scheduler_t scheduler )
   if ( !(scheduler) )
     return;
   
-  while ( !( scheduler->stop_scheduler ) && ( scheduler->scheduled_tasks ) ) {
+  scheduler->loop_thread = pthread_self ();
+  scheduler->loop_running = CMNUTIL_TRUE;
+  io_sched_watchdog_attach ( scheduler, CMNUTIL_TRUE );
+  while ( !( scheduler->stop_scheduler ) && ( ( scheduler->scheduled_tasks ) || ( scheduler->submitted_tasks ) ) ) {
     inl_io_sched_pump ( scheduler );
   }
+  io_sched_watchdog_attach ( scheduler, CMNUTIL_FALSE );
+  scheduler->loop_running = CMNUTIL_FALSE;
   
 }
 
@@ -299,49 +872,24 @@ io_sched_schedule_task ( p_io_scheduler_task_t io_task )
   if ( !io_task )
     return CMNUTIL_FALSE;
   
-  if ( S_IOSCHED_OPTS_READ( io_task ) && !(io_task->on_read_rdy_cbk) )
-    io_task->opts &= ~IO_SCHEDULER_READ;
-  if ( S_IOSCHED_OPTS_WRITE( io_task ) && !(io_task->on_write_rdy_cbk) )
-    io_task->opts &= ~IO_SCHEDULER_WRITE;
-  if ( S_IOSCHED_OPTS_ERROR( io_task ) && !(io_task->on_err_rdy_cbk) )
-    io_task->opts &= ~IO_SCHEDULER_ERROR;
-  if ( S_IOSCHED_OPTS_TIMER( io_task ) &&
-       ( !(io_task->on_timeout_cbk) || ( io_task->time_out == IO_SCHEDULER_NO_TIMEOUT ) ) )
-    io_task->opts &= ~IO_SCHEDULER_TIMER;
-  if ( io_task->opts == IO_SCHEDULER_NONE )
-    io_task->opts |= IO_SCHEDULER_REMOVE;
-  
-  if ( S_IOSCHED_OPTS_TIMER( io_task ) ) {
-    inl_io_sched_populate_expire_time ( io_task );
-  }
-  
-  LOCK_MUTEX( io_task->owner->task_list_mutex );
-  do {
-    p_io_scheduler_task_t ttt = io_task->owner->scheduled_tasks;
-    if ( !ttt )
-      io_task->owner->scheduled_tasks = io_task;
-    else {
-      while ( ttt->next )
-        ttt = ttt->next;
-      ttt->next = io_task;
-    }
-    //io_task->next = io_task->owner->scheduled_tasks;
-    //io_task->owner->scheduled_tasks = io_task;
-  } while ( 0 );
-  
-  if ( CMNUTIL_DEBUG_ENABLED ) {
-    p_io_scheduler_task_t t = io_task->owner->scheduled_tasks;
-    int iii = 0;
-    while ( t ) {
-      iii++;
-      t = t->next;
-    }
-    LOGSVC_DEBUG( "Scheduler has %d tasks scheduled.", iii );
+  if ( io_task->owner->draining ) {
+    LOGSVC_WARNING( "io_sched_schedule_task(): Scheduler is draining; FD %d not scheduled.", io_task->fd );
+    return CMNUTIL_FALSE;
   }
   
-  UNLOCK_MUTEX( io_task->owner->task_list_mutex );
-  
-  return CMNUTIL_TRUE;
+  if ( inl_io_sched_submit ( io_task, IO_SCHEDULER_CMD_SCHEDULE ) )
+    return CMNUTIL_TRUE;
+  return inl_io_sched_schedule_task_now ( io_task );
+}
+
+/**
+ * Sets the priority class a task is dispatched in.
+ **/
+void
+io_sched_set_task_priority ( p_io_scheduler_task_t io_task, io_sched_priority_t priority )
+{
+  if ( io_task )
+    io_task->priority = ( priority < IO_SCHEDULER_PRIORITIES ) ? priority : IO_SCHEDULER_PRIORITY_BULK;
 }
 
 /**
@@ -351,6 +899,16 @@ io_sched_schedule_task ( p_io_scheduler_task_t io_task )
 bool_t
 io_sched_start_scheduler_thread ( p_io_scheduler_t scheduler )
 {
+  return io_sched_start_scheduler_thread_ex ( scheduler, (const io_sched_thread_attr_t *) 0 );
+}
+
+/**
+ * Runs the specified scheduler in a secondary thread of execution with the given settings.
+ **/
+bool_t
+io_sched_start_scheduler_thread_ex ( p_io_scheduler_t scheduler, const io_sched_thread_attr_t * attr )
+{
+  pthread_attr_t pattr;
   int rc;
   int tries_left = 3;
   
@@ -359,18 +917,35 @@ io_sched_start_scheduler_thread ( p_io_scheduler_t scheduler )
   if ( !(scheduler) || ( scheduler->stop_scheduler ) )
     return CMNUTIL_FALSE;
   
+  /* The thread applies the rest itself, once running; only the stack has to be settled up front. */
+  if ( attr )
+    memcpy ( &(scheduler->thread_attr), attr, sizeof( io_sched_thread_attr_t ) );
+  else
+    io_sched_thread_attr_init ( &(scheduler->thread_attr) );
+  pthread_attr_init ( &pattr );
+  if ( scheduler->thread_attr.stack_size ) {
+    rc = pthread_attr_setstacksize ( &pattr, scheduler->thread_attr.stack_size );
+    if ( rc != 0 ) {
+      LOGSVC_ERROR( "io_sched_start_scheduler_thread(): Bad stack size %lu: %s",
+                    (unsigned long) scheduler->thread_attr.stack_size, strerror ( rc ) );
+      pthread_attr_destroy ( &pattr );
+      return CMNUTIL_FALSE;
+    }
+  }
+  
   do
   {
-    rc = pthread_create ( &(scheduler->scheduler_thread),
-                          (const pthread_attr_t *) 0,
-                          io_sched_threadfn, scheduler );
+    rc = pthread_create ( &(scheduler->scheduler_thread), &pattr, io_sched_threadfn, scheduler );
     if ( rc == 0 )
-      return CMNUTIL_TRUE;
+      break;
     else if ( rc == EAGAIN )
       usleep ( IO_SCHEDULER_UTIME_QTR_SECOND );
   }
   while ( ( rc == EAGAIN ) && ( --tries_left > 0 ) );
+  pthread_attr_destroy ( &pattr );
   
+  if ( rc == 0 )
+    return CMNUTIL_TRUE;
   if ( rc == EAGAIN )
     LOGSVC_ERROR( "io_sched_start_scheduler_thread(): Too many threads; cannot create another." );
   return CMNUTIL_FALSE;
@@ -391,81 +966,268 @@ io_sched_stop_scheduler ( p_io_scheduler_t scheduler )
     LOCK_MUTEX( scheduler->task_list_mutex );
     task = scheduler->scheduled_tasks;
     while ( task ) {
-      task->opts |= IO_SCHEDULER_REMOVE;
+      inl_io_sched_unschedule_task_locked ( task );
       task = task->next;
     }
     scheduler->stop_scheduler = CMNUTIL_TRUE;
     UNLOCK_MUTEX( scheduler->task_list_mutex );
+    inl_io_sched_wakeup ( scheduler );
     
-    if ( scheduler->scheduler_thread ) {
-      //LOGSVC_DEBUG( "Killing scheduler thread" );
-      //pthread_kill ( scheduler->scheduler_thread, SIGKILL );
-      //LOGSVC_DEBUG( "Detaching scheduler thread" );
-      //pthread_detach ( scheduler->scheduler_thread );
-      LOGSVC_DEBUG( "Cancelling scheduler thread" );
-      if ( pthread_cancel ( scheduler->scheduler_thread ) == 0 ) {
-        LOGSVC_DEBUG( "Scheduler thread cancelled" );
-        pthread_join ( scheduler->scheduler_thread, NULL );
-        LOGSVC_DEBUG( "Scheduler thread joined" );
-      }
+    /* The loop checks the flag between callbacks and on waking, so let it finish whatever callback
+       it is in and end by itself, rather than cancelling the thread in the middle of it (holding who
+       knows what locks). From within the loop, returning is all it takes. */
+    if ( scheduler->scheduler_thread && !pthread_equal ( scheduler->scheduler_thread, pthread_self () ) ) {
+      LOGSVC_DEBUG( "Joining scheduler thread" );
+      pthread_join ( scheduler->scheduler_thread, NULL );
+      LOGSVC_DEBUG( "Scheduler thread joined" );
+      scheduler->scheduler_thread = (pthread_t) 0;
     }
-    //else {
-    //  LOGSVC_DEBUG( "Setting scheduler stop flag" );
-    //  scheduler->stop_scheduler = CMNUTIL_TRUE;
-    //}
   }
 }
 
+/**
+ * Fills in scheduler thread settings with the defaults.
+ **/
+void
+io_sched_thread_attr_init ( io_sched_thread_attr_t * attr )
+{
+  if ( attr )
+    memset ( attr, 0, sizeof( io_sched_thread_attr_t ) );
+}
+
+/**
+ * Tells the IO scheduler to remove the task with the given handle, if it is still there.
+ **/
+bool_t
+io_sched_unschedule_handle ( p_io_scheduler_t scheduler, io_sched_handle_t handle )
+{
+  p_io_scheduler_task_t ptask;
+  
+  if ( !(scheduler) )
+    return CMNUTIL_FALSE;
+  
+  /* Tasks are only ever released with the task list locked, so the handle stays good until this
+     is done with it. Once a command is pending, the task will not be released until the scheduler
+     loop has seen to it. */
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  ptask = inl_io_sched_slab_lookup ( scheduler, handle );
+  if ( ptask && ( ptask->fd != INVALID_GENERAL_FD ) ) {
+    LOGSVC_DEBUG( "io_sched_unschedule_handle(): FD == %d", ptask->fd );
+    if ( !( inl_io_sched_submit ( ptask, IO_SCHEDULER_CMD_UNSCHEDULE ) ) )
+      inl_io_sched_unschedule_task_locked ( ptask );
+  }
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  if ( !(ptask) )
+    return CMNUTIL_FALSE;
+  
+  inl_io_sched_wakeup ( scheduler );
+  return CMNUTIL_TRUE;
+}
+
 /**
  * Tells the IO scheduler to remove the task the next time through its loop.
  **/
 void
 io_sched_unschedule_task ( p_io_scheduler_task_t io_task )
 {
+  /* A task with no handle has already been released. */
+  if ( !( io_task ) || !( io_task->handle ) || ( io_task->fd == INVALID_GENERAL_FD ) )
+    return;
   LOGSVC_DEBUG( "io_sched_unschedule_task(): FD == %d", io_task->fd );
-  if ( io_task && ( io_task->fd != INVALID_GENERAL_FD ) )
-    io_task->opts |= IO_SCHEDULER_REMOVE;
+  if ( !( inl_io_sched_submit ( io_task, IO_SCHEDULER_CMD_UNSCHEDULE ) ) )
+    inl_io_sched_unschedule_task_now ( io_task );
 }
 
-/* ---------- ---------- ---------- ---------- */
+/**
+ * Called by a backend from within its wait operation once the scheduler's wakeup descriptor has
+ * become readable; consumes the wakeup so that the next wait blocks again.
+ **/
+void
+io_sched_clear_wakeup ( p_io_scheduler_t scheduler )
+{
+#ifdef HAVE_SYS_EVENTFD_H
+  eventfd_t value;
+#else
+  char buf[ 64 ];
+#endif
+  
+  /* Clear the flag first; a wakeup requested from here on writes again and is not lost. */
+  __sync_lock_release ( &( scheduler->wakeup_pending ) );
+#ifdef HAVE_SYS_EVENTFD_H
+  eventfd_read ( scheduler->wakeup_rd_fd, &value );
+#else
+  while ( read ( scheduler->wakeup_rd_fd, buf, sizeof( buf ) ) > 0 )
+    ;
+#endif
+}
 
 /**
- * Tries to process a scheduled task according to the options therein and whether or not its file
- * descriptor exists in one of the read/write/error FD sets.
- * @return True if task was completed and should be unscheduled; false if task was not completed and needs to remain scheduled.
+ * Maps a task handle onto its task for a backend; the caller must hold the task_list_mutex.
+ **/
+p_io_scheduler_task_t
+io_sched_lookup_handle ( p_io_scheduler_t scheduler, io_sched_handle_t handle )
+{
+  return inl_io_sched_slab_lookup ( scheduler, handle );
+}
+
+/**
+ * Called by a backend from within its wait operation to report that a task is ready for the
+ * given subset of its read/write/error options.
+ **/
+void
+io_sched_mark_task_ready ( p_io_scheduler_task_t io_task, io_task_opts_t ready_opts )
+{
+  p_io_scheduler_t scheduler = io_task->owner;
+  io_sched_priority_t prio = io_task->priority;
+  
+  /* Only queue the task once per pass, even when reported more than once. */
+  if ( io_task->ready_opts == IO_SCHEDULER_NONE ) {
+    io_task->ready_next = NIL_IO_SCHEDULER_TASK;
+    if ( scheduler->ready_tasks_tail[ prio ] )
+      scheduler->ready_tasks_tail[ prio ]->ready_next = io_task;
+    else
+      scheduler->ready_tasks[ prio ] = io_task;
+    scheduler->ready_tasks_tail[ prio ] = io_task;
+  }
+  io_task->ready_opts |= ready_opts;
+}
+
+/**
+ * Gives a task back its interest once its offloaded work has been handed back, or unschedules it.
+ **/
+void
+io_sched_resume_task ( p_io_scheduler_task_t io_task, bool_t complete )
+{
+  p_io_scheduler_t scheduler = io_task->owner;
+  
+  if ( complete ) {
+    /* Released no sooner than the next pass, so clearing the flag first is safe. */
+    io_task->is_offloaded = CMNUTIL_FALSE;
+    io_sched_unschedule_task ( io_task );
+    return;
+  }
+  
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  io_task->is_offloaded = CMNUTIL_FALSE;
+  /* Unscheduled while away, the task is simply left for the next pass to release. */
+  if ( !S_IOSCHED_OPTS_REMOVE( io_task ) ) {
+    if ( ( io_task->fd > INVALID_GENERAL_FD ) &&
+         ( io_task->opts & ( IO_SCHEDULER_READ | IO_SCHEDULER_WRITE | IO_SCHEDULER_ERROR ) ) )
+    {
+      io_task->is_registered = scheduler->backend->add_task ( scheduler, io_task );
+      if ( !( io_task->is_registered ) ) {
+        LOGSVC_ERROR( "io_sched_resume_task(): Backend '%s' refused FD %d; unscheduling it.", scheduler->backend->name, io_task->fd );
+        inl_io_sched_unschedule_task_locked ( io_task );
+      }
+    }
+    if ( !S_IOSCHED_OPTS_REMOVE( io_task ) && S_IOSCHED_OPTS_TIMER( io_task ) && !( io_task->timer_slot ) ) {
+      inl_io_sched_populate_expire_time ( io_task );
+      inl_io_sched_timer_insert ( scheduler, io_task );
+    }
+  }
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+}
+
+/**
+ * Suspends a task's interest and timeout while work for it is out with the worker pool.
  **/
 bool_t
-io_sched_process_task ( p_io_scheduler_task_t io_task, fd_set * rds, fd_set * wrs, fd_set * ers )
+io_sched_suspend_task ( p_io_scheduler_task_t io_task )
+{
+  p_io_scheduler_t scheduler = io_task->owner;
+  bool_t rv = CMNUTIL_FALSE;
+  
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  if ( io_task->is_scheduled && !( io_task->is_offloaded ) && !S_IOSCHED_TASK_LEAVING( io_task ) ) {
+    if ( io_task->is_registered ) {
+      scheduler->backend->remove_task ( scheduler, io_task );
+      io_task->is_registered = CMNUTIL_FALSE;
+    }
+    if ( io_task->timer_slot )
+      inl_io_sched_timer_remove ( scheduler, io_task );
+    io_task->is_offloaded = CMNUTIL_TRUE;
+    rv = CMNUTIL_TRUE;
+  }
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  return rv;
+}
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local functions       */
+/* ---------- ---------- */
+
+/**
+ * Destroys an IO scheduler task; user data is not destroyed, nor is the file descriptor closed -
+ * those are owned by the calling process.
+ **/
+static void
+io_sched_destroy_task ( p_io_scheduler_task_t io_task )
+{
+  p_io_scheduler_t scheduler;
+  p_io_sched_slab_slot_t slot;
+  uint32_t index;
+  
+  if ( io_task ) {
+    LOGSVC_TRACE( "io_sched_destroy_task(): fd == %d", io_task->fd );
+    scheduler = io_task->owner;
+    if ( io_task->is_registered ) {
+      scheduler->backend->remove_task ( scheduler, io_task );
+      io_task->is_registered = CMNUTIL_FALSE;
+    }
+    if ( io_task->timer_slot )
+      inl_io_sched_timer_remove ( scheduler, io_task );
+    /* Only an ID the pool could have handed out goes back to it; anything else made up by the
+       caller (or a pool that is somehow full already) would write past the end of it. */
+    if ( io_task->fd < INVALID_GENERAL_FD ) {
+      LOCK_MUTEX( scheduler->timer_pool_mutex );
+      if ( ( IO_SCHEDULER_TIMER_INDEX( io_task->fd ) < scheduler->timer_capacity ) &&
+           ( scheduler->timer_num_free < scheduler->timer_capacity ) )
+        scheduler->timer_free[ scheduler->timer_num_free++ ] = (uint32_t) IO_SCHEDULER_TIMER_INDEX( io_task->fd );
+      else
+        LOGSVC_WARNING( "io_sched_destroy_task(): Timer ID %d is not one of the pool's; not returned to it.", io_task->fd );
+      UNLOCK_MUTEX( scheduler->timer_pool_mutex );
+    }
+    /* Clear the task before its slot goes back on the free list; once there, another thread may
+       take it. Moving the generation on leaves every handle to this task stale. */
+    index = IO_SCHEDULER_HANDLE_INDEX( io_task->handle );
+    slot = (p_io_sched_slab_slot_t) io_task;
+    memset ( io_task, 0, IO_SCHEDULER_TASK_STRUCT_SIZE );
+    LOCK_MUTEX( scheduler->task_pool_mutex );
+    slot->generation = ( slot->generation & IO_SCHEDULER_HANDLE_GEN_MASK ) + 1;
+    if ( slot->generation > IO_SCHEDULER_HANDLE_GEN_MASK )
+      slot->generation = 1;
+    scheduler->slab_free[ scheduler->slab_num_free++ ] = index;
+    UNLOCK_MUTEX( scheduler->task_pool_mutex );
+  }
+}
+
+/**
+ * Tries to process a scheduled task according to the options therein and the readiness reported
+ * for its file descriptor by the backend.
+ * @return True if task was completed and should be unscheduled; false if task was not completed and needs to remain scheduled.
+ **/
+static bool_t
+io_sched_process_task ( p_io_scheduler_task_t io_task, io_task_opts_t ready_opts, bool_t task_expired )
 {
   bool_t rv = CMNUTIL_TRUE;
-  struct timespec ts_now;
-  bool_t task_expired;
   
   //LOGSVC_TRACE( "io_sched_process_task(): FD == %d", io_task->fd );
   
-  clock_gettime ( CLOCK_REALTIME, &ts_now );
-  task_expired = ( ( io_task->time_out != IO_SCHEDULER_NO_TIMEOUT ) &&
-                   ( ( ts_now.tv_sec > io_task->expire_time.tv_sec ) ||
-                     ( ( ts_now.tv_sec == io_task->expire_time.tv_sec ) &&
-                       ( ts_now.tv_nsec >= io_task->expire_time.tv_nsec ) ) ) );
-  
   if ( io_task->fd > INVALID_GENERAL_FD ) {
     /* IO */
     
     /* Check for error-ready (MOB) */
-    if ( S_IOSCHED_OPTS_ERROR( io_task ) && FD_ISSET( io_task->fd, ers ) ) {
-      io_task->on_err_rdy_cbk ( io_task, IO_SCHEDULER_ERR_NONE );
-      FD_CLR ( io_task->fd, ers );
+    if ( S_IOSCHED_OPTS_ERROR( io_task ) && ( ready_opts & IO_SCHEDULER_ERROR ) ) {
+      inl_io_sched_call ( io_task, io_task->on_err_rdy_cbk, IO_SCHEDULER_CBK_ERROR, IO_SCHEDULER_ERR_NONE );
     }
     
     /* Check for read-ready */
     if ( S_IOSCHED_OPTS_READ( io_task ) ) {
-      if ( FD_ISSET( io_task->fd, rds ) ) {
-        rv = rv && io_task->on_read_rdy_cbk ( io_task, IO_SCHEDULER_ERR_NONE );
-        FD_CLR ( io_task->fd, rds );
+      if ( ready_opts & IO_SCHEDULER_READ ) {
+        rv = rv && inl_io_sched_call ( io_task, io_task->on_read_rdy_cbk, IO_SCHEDULER_CBK_READ, IO_SCHEDULER_ERR_NONE );
       }
       else if ( task_expired ) {
-        rv = rv && io_task->on_timeout_cbk ( io_task, IO_SCHEDULER_ERR_OP_TIMEOUT );
+        rv = rv && inl_io_sched_call ( io_task, io_task->on_timeout_cbk, IO_SCHEDULER_CBK_TIMEOUT, IO_SCHEDULER_ERR_OP_TIMEOUT );
       }
       else {
         rv = CMNUTIL_FALSE;
@@ -474,12 +1236,11 @@ io_sched_process_task ( p_io_scheduler_task_t io_task, fd_set * rds, fd_set * wr
     
     /* Check for write-ready */
     if ( S_IOSCHED_OPTS_WRITE( io_task ) ) {
-      if ( FD_ISSET( io_task->fd, wrs ) ) {
-        rv = rv && io_task->on_write_rdy_cbk ( io_task, IO_SCHEDULER_ERR_NONE );
-        FD_CLR ( io_task->fd, wrs );
+      if ( ready_opts & IO_SCHEDULER_WRITE ) {
+        rv = rv && inl_io_sched_call ( io_task, io_task->on_write_rdy_cbk, IO_SCHEDULER_CBK_WRITE, IO_SCHEDULER_ERR_NONE );
       }
       else if ( task_expired ) {
-        rv = rv && io_task->on_timeout_cbk ( io_task, IO_SCHEDULER_ERR_OP_TIMEOUT );
+        rv = rv && inl_io_sched_call ( io_task, io_task->on_timeout_cbk, IO_SCHEDULER_CBK_TIMEOUT, IO_SCHEDULER_ERR_OP_TIMEOUT );
       }
       else {
         rv = CMNUTIL_FALSE;
@@ -490,9 +1251,8 @@ io_sched_process_task ( p_io_scheduler_task_t io_task, fd_set * rds, fd_set * wr
     /* Timer */
     
     if ( task_expired ) {
-      if ( !( io_task->on_timeout_cbk ( io_task, IO_SCHEDULER_ERR_OP_TIMEOUT ) ) ) {
-        /* Wants to repeat after the original timeout amount of time again */
-        inl_io_sched_populate_expire_time ( io_task );
+      if ( !( inl_io_sched_call ( io_task, io_task->on_timeout_cbk, IO_SCHEDULER_CBK_TIMEOUT, IO_SCHEDULER_ERR_OP_TIMEOUT ) ) ) {
+        /* Wants to repeat after the original timeout amount of time again; the caller re-arms it. */
         rv = CMNUTIL_FALSE;
       }
     }
@@ -507,28 +1267,6 @@ io_sched_process_task ( p_io_scheduler_task_t io_task, fd_set * rds, fd_set * wr
   return rv;
 }
 
-/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
-/* Local functions       */
-/* ---------- ---------- */
-
-/**
- * Destroys an IO scheduler task; user data is not destroyed, nor is the file descriptor closed -
- * those are owned by the calling process.
- **/
-static void
-io_sched_destroy_task ( p_io_scheduler_task_t io_task )
-{
-  if ( io_task ) {
-    LOGSVC_TRACE( "io_sched_destroy_task(): fd == %d", io_task->fd );
-    if ( io_task->fd < INVALID_GENERAL_FD )
-      stack_fixed_push_r ( io_task->owner->timer_pool_mutex, io_task->owner->timer_id_pool, (void*) io_task->fd );
-    if ( stack_fixed_push_r ( io_task->owner->task_pool_mutex, io_task->owner->task_pool, io_task ) == STACK_ERROR_FULL )
-      free ( io_task );
-    else
-      memset ( io_task, 0, IO_SCHEDULER_TASK_STRUCT_SIZE );
-  }
-}
-
 /**
  * Thread entry point for schedulers that run in secondary process threads.
  **/
@@ -540,9 +1278,18 @@ io_sched_threadfn ( void * ud )
   LOGSVC_DEBUG( "io_sched_threadfn()" );
   
   if ( scheduler ) {
+    inl_io_sched_apply_thread_attr ( scheduler );
+    scheduler->loop_thread = pthread_self ();
+    scheduler->loop_running = CMNUTIL_TRUE;
+    io_sched_watchdog_attach ( scheduler, CMNUTIL_TRUE );
     while ( !( scheduler->stop_scheduler ) ) {
+      /* Draining, and nothing left to drain. */
+      if ( scheduler->draining && !( scheduler->scheduled_tasks ) && !( scheduler->submitted_tasks ) )
+        break;
       inl_io_sched_pump ( scheduler );
     }
+    io_sched_watchdog_attach ( scheduler, CMNUTIL_FALSE );
+    scheduler->loop_running = CMNUTIL_FALSE;
     LOGSVC_DEBUG( "io_sched_threadfn(): scheduler->stop_scheduler set to true" );
   }
   
@@ -550,126 +1297,1147 @@ io_sched_threadfn ( void * ud )
 }
 
 /**
- * Inline helper function that calculates the expiry time for a task that has a timeout associated with it.
+ * Applies the scheduler's thread settings to the calling thread, which is about to run its loop.
+ * Anything that cannot be applied is logged, and left as it was.
  **/
 static inline void
-inl_io_sched_populate_expire_time ( p_io_scheduler_task_t io_task )
+inl_io_sched_apply_thread_attr ( p_io_scheduler_t scheduler )
+{
+  const io_sched_thread_attr_t * attr = &(scheduler->thread_attr);
+  struct sched_param param;
+  char name[ 16 ];
+  int rc;
+  
+  if ( attr->name[0] ) {
+    strncpy ( name, attr->name, sizeof( name ) - 1 );
+    name[ sizeof( name ) - 1 ] = '\0';
+    rc = pthread_setname_np ( pthread_self (), name );
+    if ( rc != 0 )
+      LOGSVC_WARNING( "io_sched_threadfn(): Unable to name thread '%s': %s", name, strerror ( rc ) );
+  }
+  
+#ifdef CPU_SETSIZE
+  if ( attr->use_cpus ) {
+    rc = pthread_setaffinity_np ( pthread_self (), sizeof( cpu_set_t ), &(attr->cpus) );
+    if ( rc != 0 )
+      LOGSVC_WARNING( "io_sched_threadfn(): Unable to set CPU affinity: %s", strerror ( rc ) );
+  }
+#endif
+  
+  if ( attr->fifo_priority > 0 ) {
+    memset ( &param, 0, sizeof( param ) );
+    param.sched_priority = attr->fifo_priority;
+    rc = pthread_setschedparam ( pthread_self (), SCHED_FIFO, &param );
+    if ( rc != 0 )
+      LOGSVC_WARNING( "io_sched_threadfn(): Unable to run at SCHED_FIFO priority %d: %s", attr->fifo_priority, strerror ( rc ) );
+  }
+  
+#if defined(HAVE_SYS_RESOURCE_H) && defined(SYS_gettid)
+  /* On Linux, a nice value belongs to the thread rather than the whole process. */
+  if ( attr->set_nice && ( setpriority ( PRIO_PROCESS, (id_t) syscall ( SYS_gettid ), attr->nice ) != 0 ) )
+    LOGSVC_WARNING( "io_sched_threadfn(): Unable to set nice value %d: %s", attr->nice, strerror ( errno ) );
+#endif
+  
+#ifdef HAVE_SYS_MMAN_H
+  if ( attr->lock_memory && ( mlockall ( MCL_CURRENT | MCL_FUTURE ) != 0 ) )
+    LOGSVC_WARNING( "io_sched_threadfn(): Unable to lock memory: %s", strerror ( errno ) );
+#endif
+}
+
+/**
+ * Makes one of a task's callbacks, timing it when the scheduler collects stats or has a watchdog.
+ **/
+static inline bool_t
+inl_io_sched_call ( p_io_scheduler_task_t io_task, io_scheduler_cbk_t cbk, io_sched_cbk_kind_t kind, int errcode )
 {
-  int64_t time_to_add = io_task->time_out;
-  struct timespec * pts = &( io_task->expire_time );
+  p_io_scheduler_t scheduler = io_task->owner;
+  p_io_sched_stats_t stats = scheduler->stats;
+  int64_t started, elapsed;
+  fd_t fd = io_task->fd;
+  bool_t rv;
   
-  LOGSVC_TRACE( "inl_io_sched_populate_expire_time(): Timeout: %lu", time_to_add );
+  if ( !(stats) && !(scheduler->watchdog) )
+    return cbk ( io_task, errcode );
   
-  clock_gettime ( CLOCK_REALTIME, &(io_task->expire_time) );
-  LOGSVC_TRACE( "inl_io_sched_populate_expire_time(): Current clock: %lu.%lu", pts->tv_sec, pts->tv_nsec );
-  while ( time_to_add > IO_SCHEDULER_TIME_ONE_SECOND ) {
-    pts->tv_sec++;
-    time_to_add -= IO_SCHEDULER_TIME_ONE_SECOND;
+  started = inl_io_sched_stats_clock ();
+  if ( scheduler->watchdog ) {
+    /* Everything else first: the watchdog takes an unchanged start time to mean the rest is current. */
+    scheduler->cbk_fd = fd;
+    scheduler->cbk_fn = cbk;
+    __atomic_add_fetch ( &(scheduler->cbk_seq), 1, __ATOMIC_RELEASE );
+    __atomic_store_n ( &(scheduler->cbk_started), started, __ATOMIC_RELEASE );
   }
-  assert ( time_to_add >= 0 );
-  pts->tv_nsec += time_to_add;
-  if ( pts->tv_nsec > IO_SCHEDULER_TIME_ONE_SECOND ) {
-    pts->tv_sec++;
-    pts->tv_nsec -= IO_SCHEDULER_TIME_ONE_SECOND;
+  rv = cbk ( io_task, errcode );
+  elapsed = inl_io_sched_stats_clock () - started;
+  if ( scheduler->watchdog ) {
+    __atomic_store_n ( &(scheduler->cbk_started), 0, __ATOMIC_RELEASE );
+    if ( elapsed > scheduler->watchdog_budget )
+      io_sched_watchdog_overran ( scheduler, fd, cbk, elapsed );
   }
-  LOGSVC_TRACE( "inl_io_sched_populate_expire_time(): Expire time: %lu.%lu", pts->tv_sec, pts->tv_nsec );
+  if ( stats ) {
+    /* The callback may have unscheduled its task, but it is not released before the next pass. */
+    inl_io_sched_hist_add ( &( stats->callback_time[ kind ] ), elapsed );
+    io_task->num_callbacks++;
+    io_task->callback_ns += (uint64_t) elapsed;
+  }
+  return rv;
 }
 
+/**
+ * Asks the kernel to busy-poll the device queue when reading the given descriptor, should it be
+ * a socket. Anything else, or a kernel without SO_BUSY_POLL, is left as it is; a kernel refusing
+ * the value (EPERM, without CAP_NET_ADMIN) is not asked again. The caller must hold the
+ * task_list_mutex.
+ **/
 static inline void
-inl_io_sched_pump ( p_io_scheduler_t scheduler )
+inl_io_sched_busy_poll_socket ( p_io_scheduler_t scheduler, fd_t fd )
+{
+#ifdef SO_BUSY_POLL
+  if ( ( fd > INVALID_GENERAL_FD ) &&
+       ( setsockopt ( fd, SOL_SOCKET, SO_BUSY_POLL, &( scheduler->busy_poll_usecs ), sizeof( scheduler->busy_poll_usecs ) ) < 0 ) ) {
+    if ( errno == EPERM ) {
+      LOGSVC_NOTICE( "inl_io_sched_busy_poll_socket(): SO_BUSY_POLL of %d usecs not permitted; sockets are left as they are.",
+                     scheduler->busy_poll_usecs );
+      scheduler->busy_poll_usecs = 0;
+    }
+    else if ( errno != ENOTSOCK )
+      LOGSVC_DEBUG( "inl_io_sched_busy_poll_socket(): SO_BUSY_POLL not set on FD %d: %s", fd, strerror ( errno ) );
+  }
+#else
+  (void) scheduler;
+  (void) fd;
+#endif
+}
+
+/**
+ * Inline helper function that maps the requested backend type onto an available backend.
+ **/
+static inline p_io_sched_backend_t
+inl_io_sched_choose_backend ( io_sched_backend_type_t backend )
+{
+  switch ( backend ) {
+    case IO_SCHEDULER_BACKEND_SELECT:
+      return &g_io_sched_select_backend;
+    case IO_SCHEDULER_BACKEND_IO_URING:
+#ifdef HAVE_LINUX_IO_URING_H
+      return &g_io_sched_uring_backend;
+#endif
+    case IO_SCHEDULER_BACKEND_AUTO:
+    case IO_SCHEDULER_BACKEND_EPOLL:
+    default:
+#ifdef HAVE_SYS_EPOLL_H
+      return &g_io_sched_epoll_backend;
+#else
+      return &g_io_sched_select_backend;
+#endif
+  }
+}
+
+/**
+ * Inline helper function that gives the backend to try when the given one cannot be started, or
+ * NULL once there is nothing simpler left.
+ **/
+static inline p_io_sched_backend_t
+inl_io_sched_fallback_backend ( p_io_sched_backend_t backend )
+{
+#ifdef HAVE_LINUX_IO_URING_H
+  if ( backend == &g_io_sched_uring_backend )
+    return inl_io_sched_choose_backend ( IO_SCHEDULER_BACKEND_EPOLL );
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+  if ( backend == &g_io_sched_epoll_backend )
+    return &g_io_sched_select_backend;
+#endif
+  return NIL_IO_SCHED_BACKEND;
+}
+
+/**
+ * Adds a duration to a histogram; negative durations (a clock read a tick behind) count as zero.
+ **/
+static inline void
+inl_io_sched_hist_add ( io_sched_histogram_t * hist, int64_t ns )
 {
-  fd_set rd, wr, er;
-  fd_t maxfd = INVALID_GENERAL_FD; /* -1 */
-  p_io_scheduler_task_t ptask, pnext_task;
-  struct timeval tv_select_timeout;
+  uint64_t value = ( ns > 0 ) ? (uint64_t) ns : 0;
+  size_t bucket, msb;
   
-  if ( !( scheduler->scheduled_tasks ) && ( scheduler->scheduler_thread ) ) {
-    /* Nothing to do, and we're running in a secondary thread; give the system a chance to do something else. */
-    memset ( &tv_select_timeout, 0, sizeof( struct timeval ) );
-    tv_select_timeout.tv_usec = 1000; /* 1 ms */
-    select ( 0, NULL, NULL, NULL, &tv_select_timeout );
-    return;
+  if ( value < IO_SCHEDULER_HIST_SUB_BUCKETS ) {
+    bucket = (size_t) value;
+  }
+  else {
+    msb = 63 - (size_t) __builtin_clzll ( value );
+    if ( msb >= IO_SCHEDULER_HIST_MAX_BITS )
+      bucket = IO_SCHEDULER_HIST_BUCKETS - 1;
+    else
+      bucket = ( ( msb - IO_SCHEDULER_HIST_SUB_BITS + 1 ) * IO_SCHEDULER_HIST_SUB_BUCKETS ) +
+               (size_t) ( ( value >> ( msb - IO_SCHEDULER_HIST_SUB_BITS ) ) & ( IO_SCHEDULER_HIST_SUB_BUCKETS - 1 ) );
   }
+  hist->buckets[ bucket ]++;
+  hist->count++;
+  hist->total_ns += value;
+  if ( value > hist->max_ns )
+    hist->max_ns = value;
+}
+
+/**
+ * Inline helper function that calculates the expiry time for a task that has a timeout associated with it.
+ **/
+static inline void
+inl_io_sched_populate_expire_time ( p_io_scheduler_task_t io_task )
+{
+  p_io_scheduler_t scheduler = io_task->owner;
+  int64_t now;
+  
+  LOGSVC_TRACE( "inl_io_sched_populate_expire_time(): Timeout: %ld", (long) io_task->time_out );
+  assert ( io_task->time_out >= 0 );
+  
+  /* Within the loop, go by the same reading the loop measures deadlines against; anywhere else,
+     that reading may be from before the loop went to sleep. */
+  if ( scheduler->loop_running && pthread_equal ( scheduler->loop_thread, pthread_self () ) )
+    now = scheduler->now;
+  else
+    now = inl_io_sched_read_clock ( scheduler );
+  io_task->expire_time = now + io_task->time_out;
+  LOGSVC_TRACE( "inl_io_sched_populate_expire_time(): Expire time: %ld", (long) io_task->expire_time );
+}
+
+/**
+ * Inline helper function that reads the scheduler's clock, in nanoseconds.
+ **/
+static inline int64_t
+inl_io_sched_read_clock ( p_io_scheduler_t scheduler )
+{
+  struct timespec ts;
   
-  FD_ZERO ( &rd );
-  FD_ZERO ( &wr );
-  FD_ZERO ( &er );
+  clock_gettime ( scheduler->clock_id, &ts );
+  return ( (int64_t) ts.tv_sec * IO_SCHEDULER_NTIME_ONE_SECOND ) + (int64_t) ts.tv_nsec;
+}
+
+static inline void
+inl_io_sched_pump ( p_io_scheduler_t scheduler )
+{
+  p_io_sched_stats_t stats = scheduler->stats;
+  p_io_scheduler_task_t ptask, pnext, ptail;
+  const io_sched_budget_t * budget;
+  io_task_opts_t ready;
+  int64_t time_out, started = 0, waited = 0, woke = 0;
+  uint64_t num_bytes;
+  size_t num_calls;
+  int rc, prio;
   
   /*
    *
-   * We lock a mutex here, specifically so that we do not break any links while someone else
-   * is possibly trying to add to our task list. We don't have to worry about that later; this
-   * is the only place where tasks are removed from the list - everyone else merely requests
-   * their removal. When we loop later to check for the file descriptors being in the FD sets
-   * it will not matter if a new file descriptor was added into our task list, simply because
-   * there is no way for it to be set in the FD sets since we were never checking for it.
-   *
-   * When removing, we do not allow the tasks with an FD of INVALID_FD to be removed. These are
-   * special, recurring system tasks that need to remain scheduled at all times.
+   * This is the only place where tasks are removed from the list - everyone else merely requests
+   * their removal, which drops the task's interest with the backend right away and queues it on
+   * the removed tasks chain. Only those tasks are visited here, rather than the whole list.
    *
    */
-  if ( scheduler->scheduled_tasks && !( scheduler->stop_scheduler ) ) {
-    LOCK_MUTEX( scheduler->task_list_mutex );
-    
-    /* Clear any removes from the front of the scheduled task list. */
-    while ( scheduler->scheduled_tasks &&
-            S_IOSCHED_OPTS_REMOVE( scheduler->scheduled_tasks ) &&
-            ( scheduler->scheduled_tasks->fd != INVALID_GENERAL_FD ) )
-    {
-      ptask = scheduler->scheduled_tasks->next;
-      io_sched_destroy_task ( scheduler->scheduled_tasks );
-      scheduler->scheduled_tasks = ptask;
-    }
-    
-    /* At this point we know that either (a) the list is empty, or (b) the first item is ready to be processed. */
-    ptask = scheduler->scheduled_tasks;
-    while ( ptask ) {
-      
-      /* If it is a timer task, we don't need to worry about the FD sets. */
-      if ( !(S_IOSCHED_OPTS_TIMER_ONLY( ptask )) ) {
-        if ( S_IOSCHED_OPTS_READ( ptask ) ) {
-          maxfd = ( ptask->fd > maxfd ) ? ptask->fd : maxfd;
-          FD_SET ( ptask->fd, &rd );
-        }
-        if ( S_IOSCHED_OPTS_WRITE( ptask ) ) {
-          maxfd = ( ptask->fd > maxfd ) ? ptask->fd : maxfd;
-          FD_SET ( ptask->fd, &wr );
-        }
-        if ( S_IOSCHED_OPTS_ERROR( ptask ) ) {
-          maxfd = ( ptask->fd > maxfd ) ? ptask->fd : maxfd;
-          FD_SET ( ptask->fd, &er );
+  if ( stats )
+    started = inl_io_sched_stats_clock ();
+  scheduler->now = inl_io_sched_read_clock ( scheduler );
+  inl_io_sched_drain_submissions ( scheduler, CMNUTIL_TRUE );
+  inl_io_sched_release_removed_tasks ( scheduler );
+  
+  if ( scheduler->stop_scheduler )
+    return;
+  
+  /* Run in the caller's own thread, or draining, the scheduler ends once it has run out of tasks; do
+     not wait on nothing (only its own thread, in the normal course, waits to be handed more). */
+  if ( !( scheduler->scheduled_tasks ) && !( scheduler->submitted_tasks ) &&
+       ( !( scheduler->scheduler_thread ) || scheduler->draining ) )
+    return;
+  
+  scheduler->pass_count++;
+  /* Tasks handed over from the last pass are already ready; only poll for anything else. */
+  for ( prio = 0; ( prio < IO_SCHEDULER_PRIORITIES ) && !( scheduler->ready_tasks[ prio ] ); prio++ )
+    ;
+  time_out = ( prio < IO_SCHEDULER_PRIORITIES ) ? 0 : inl_io_sched_next_timeout ( scheduler );
+  if ( stats )
+    waited = inl_io_sched_stats_clock ();
+  rc = inl_io_sched_wait ( scheduler, time_out );
+  /* The one reading every callback and deadline in this pass goes by. */
+  scheduler->now = inl_io_sched_read_clock ( scheduler );
+  if ( stats ) {
+    woke = inl_io_sched_stats_clock ();
+    stats->num_passes++;
+    stats->wait_ns += (uint64_t) ( woke - waited );
+  }
+  if ( rc < 0 )
+    return;
+  if ( scheduler->busy_poll && ( ( rc > 0 ) || ( time_out == 0 ) ) )
+    scheduler->last_active = inl_io_sched_stats_clock ();
+  
+  /* Dispatch only the tasks the backend reported as ready, plus those handed over from the last
+     pass, a priority class at a time. Their timeouts are left on the heap; a task's timeout runs
+     from when it was scheduled (or rescheduled), not from its last activity. A callback may queue
+     a task afresh for the next pass (io_sched_continue_task()), which relinks it, so each link is
+     read before the call. The whole chain is walked even once stopping, so that no task is left
+     marked ready. */
+  for ( prio = 0; prio < IO_SCHEDULER_PRIORITIES; prio++ ) {
+    budget = &( scheduler->budgets[ prio ] );
+    ptask = scheduler->ready_tasks[ prio ];
+    ptail = scheduler->ready_tasks_tail[ prio ];
+    scheduler->ready_tasks[ prio ] = scheduler->ready_tasks_tail[ prio ] = NIL_IO_SCHEDULER_TASK;
+    num_calls = 0;
+    num_bytes = 0;
+    for ( ; ptask; ptask = pnext ) {
+      /* Over budget: the rest stay ready, and go back ahead of anything queued for the class since.
+         Tasks still waiting are never relinked by a callback, so the rest of the chain is intact. */
+      if ( !( scheduler->stop_scheduler ) &&
+           ( ( budget->callbacks && ( num_calls >= budget->callbacks ) ) ||
+             ( budget->bytes && ( num_bytes >= budget->bytes ) ) ) )
+      {
+        if ( stats ) {
+          for ( pnext = ptask; pnext; pnext = pnext->ready_next )
+            stats->num_deferred++;
         }
+        ptail->ready_next = scheduler->ready_tasks[ prio ];
+        if ( !( scheduler->ready_tasks[ prio ] ) )
+          scheduler->ready_tasks_tail[ prio ] = ptail;
+        scheduler->ready_tasks[ prio ] = ptask;
+        break;
       }
-      
-      /* Scan ahead for removes ... */
-      while ( ptask->next && S_IOSCHED_OPTS_REMOVE( ptask->next ) && ( ptask->next->fd != INVALID_GENERAL_FD ) ) {
-        pnext_task = ptask->next->next;
-        io_sched_destroy_task ( ptask->next );
-        ptask->next = pnext_task;
+      pnext = ptask->ready_next;
+      ready = ptask->ready_opts;
+      ptask->ready_opts = IO_SCHEDULER_NONE;
+      ptask->dispatch_pass = scheduler->pass_count;
+      /* Readiness reported before a callback handed the task's work off to the pool is stale. */
+      if ( !S_IOSCHED_TASK_LEAVING( ptask ) && !( ptask->is_offloaded ) && !( scheduler->stop_scheduler ) ) {
+        if ( stats ) {
+          /* Measured from the end of the wait, so that time spent on earlier callbacks counts. */
+          stats->num_ready++;
+          inl_io_sched_hist_add ( &( stats->dispatch_latency ), inl_io_sched_stats_clock () - woke );
+        }
+        scheduler->dispatch_bytes = 0;
+        if ( io_sched_process_task ( ptask, ready, CMNUTIL_FALSE ) )
+          io_sched_unschedule_task ( ptask );
+        num_calls++;
+        num_bytes += scheduler->dispatch_bytes;
       }
-      
-      ptask = ptask->next;
     }
-    
-    UNLOCK_MUTEX( scheduler->task_list_mutex );
   }
   
-  if ( !( scheduler->stop_scheduler ) ) {
-    memset ( &tv_select_timeout, 0, sizeof( struct timeval ) );
-    tv_select_timeout.tv_usec = 10000; /* 10 ms */
-    if ( select ( maxfd + 1, &rd, &wr, &er, &tv_select_timeout ) < 0 )
-      return;
-    
-    ptask = scheduler->scheduled_tasks;
-    while ( ptask && !( scheduler->stop_scheduler ) ) {
-      if ( !S_IOSCHED_OPTS_REMOVE( ptask ) ) {
-        if ( io_sched_process_task ( ptask, &rd, &wr, &er ) )
-          io_sched_unschedule_task ( ptask );
-      }
-      ptask = ptask->next;
+  /* Timeouts and expired timers; only the tasks whose deadlines have passed are visited. */
+  if ( !( scheduler->stop_scheduler ) )
+    inl_io_sched_process_expired_tasks ( scheduler );
+  
+  if ( stats )
+    inl_io_sched_hist_add ( &( stats->loop_time ), ( inl_io_sched_stats_clock () - started ) - ( woke - waited ) );
+  
+}
+
+/**
+ * Releases the tasks that have been unscheduled since the last pass, unlinking each from the
+ * scheduled tasks list and returning it to the task pool.
+ **/
+static inline void
+inl_io_sched_release_removed_tasks ( p_io_scheduler_t scheduler )
+{
+  p_io_scheduler_task_t ptask, * pp;
+  
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  pp = &( scheduler->removed_tasks );
+  while ( *pp ) {
+    ptask = *pp;
+    /* Another thread submitted a command for the task after the last drain, or it was handed over
+       to this pass by io_sched_continue_task(); it stays until the pass has dealt with that, since
+       the submission queue or the ready chain still links through it. Work out with the pool keeps
+       it too, until handed back. */
+    if ( ptask->pending_cmds || ( ptask->ready_opts != IO_SCHEDULER_NONE ) || ptask->is_offloaded ) {
+      pp = &( ptask->removed_next );
+      continue;
     }
+    *pp = ptask->removed_next;
+    if ( scheduler->stats )
+      scheduler->stats->num_removed++;
+    if ( ptask->prev )
+      ptask->prev->next = ptask->next;
+    else
+      scheduler->scheduled_tasks = ptask->next;
+    if ( ptask->next )
+      ptask->next->prev = ptask->prev;
+    else
+      scheduler->scheduled_tasks_tail = ptask->prev;
+    scheduler->num_scheduled_tasks--;
+    inl_io_sched_lookup_remove ( scheduler, ptask );
+    io_sched_destroy_task ( ptask );
   }
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+}
+
+/**
+ * Recalculates a task's expiry time and moves it to its new place on the timer heap.
+ **/
+static inline void
+inl_io_sched_reschedule_task_now ( p_io_scheduler_task_t io_task )
+{
+  p_io_scheduler_t scheduler = io_task->owner;
+  
+  /* Submitted from another thread, and since removed by the task itself. */
+  if ( S_IOSCHED_OPTS_REMOVE( io_task ) )
+    return;
   
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  inl_io_sched_populate_expire_time ( io_task );
+  /* Only tasks already in the scheduler are queued on the heap; the rest will be when scheduled. */
+  if ( io_task->timer_slot ) {
+    inl_io_sched_timer_sift_down ( scheduler, io_task->timer_slot );
+    inl_io_sched_timer_sift_up ( scheduler, io_task->timer_slot );
+  }
+  else if ( io_task->is_scheduled && !( io_task->is_offloaded ) && S_IOSCHED_OPTS_TIMER( io_task ) ) {
+    inl_io_sched_timer_insert ( scheduler, io_task );
+  }
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  /* The new deadline may well be sooner than whatever the scheduler is waiting on. */
+  inl_io_sched_wakeup ( scheduler );
+}
+
+/**
+ * Reads the clock the instrumentation is measured against, in nanoseconds. This is always the
+ * fine-grained monotonic clock, whatever the scheduler measures its timeouts against, since
+ * callbacks generally take well under a coarse clock's tick; the busy-poll window is timed on it
+ * for the same reason.
+ **/
+static inline int64_t
+inl_io_sched_stats_clock ( void )
+{
+  struct timespec ts;
+  clock_gettime ( CLOCK_MONOTONIC, &ts );
+  return ( (int64_t) ts.tv_sec * IO_SCHEDULER_NTIME_ONE_SECOND ) + (int64_t) ts.tv_nsec;
+}
+
+/**
+ * Adds a task to its scheduler's task list, handing it to the backend if it has a descriptor to
+ * watch.
+ **/
+static inline bool_t
+inl_io_sched_schedule_task_now ( p_io_scheduler_task_t io_task )
+{
+  bool_t rv = CMNUTIL_TRUE;
+  p_io_scheduler_t scheduler;
+  
+  if ( S_IOSCHED_OPTS_READ( io_task ) && !(io_task->on_read_rdy_cbk) )
+    io_task->opts &= ~IO_SCHEDULER_READ;
+  if ( S_IOSCHED_OPTS_WRITE( io_task ) && !(io_task->on_write_rdy_cbk) )
+    io_task->opts &= ~IO_SCHEDULER_WRITE;
+  if ( S_IOSCHED_OPTS_ERROR( io_task ) && !(io_task->on_err_rdy_cbk) )
+    io_task->opts &= ~IO_SCHEDULER_ERROR;
+  if ( S_IOSCHED_OPTS_TIMER( io_task ) &&
+       ( !(io_task->on_timeout_cbk) || ( io_task->time_out == IO_SCHEDULER_NO_TIMEOUT ) ) )
+    io_task->opts &= ~IO_SCHEDULER_TIMER;
+  if ( io_task->opts == IO_SCHEDULER_NONE )
+    io_task->opts |= IO_SCHEDULER_REMOVE;
+  
+  /* Once the lock is dropped, the scheduler's thread may already have run the task to completion
+     and handed it back to the pool, so the owner is not looked up through the task after that. */
+  scheduler = io_task->owner;
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  
+  /* Tasks with something to watch on a real file descriptor are handed to the backend once,
+     here, rather than on every pass through the scheduler loop. */
+  if ( !( inl_io_sched_lookup_insert ( scheduler, io_task ) ) ) {
+    LOGSVC_ERROR( "io_sched_schedule_task(): Unable to index FD %d.", io_task->fd );
+    rv = CMNUTIL_FALSE;
+  }
+  else if ( !S_IOSCHED_OPTS_REMOVE( io_task ) && ( io_task->fd > INVALID_GENERAL_FD ) &&
+       ( io_task->opts & ( IO_SCHEDULER_READ | IO_SCHEDULER_WRITE | IO_SCHEDULER_ERROR ) ) )
+  {
+    io_task->is_registered = scheduler->backend->add_task ( scheduler, io_task );
+    if ( !( io_task->is_registered ) ) {
+      LOGSVC_ERROR( "io_sched_schedule_task(): Backend '%s' refused FD %d.", scheduler->backend->name, io_task->fd );
+      inl_io_sched_lookup_remove ( scheduler, io_task );
+      rv = CMNUTIL_FALSE;
+    }
+  }
+  
+  if ( rv ) {
+    io_task->next = NIL_IO_SCHEDULER_TASK;
+    io_task->prev = scheduler->scheduled_tasks_tail;
+    if ( io_task->prev )
+      io_task->prev->next = io_task;
+    else
+      scheduler->scheduled_tasks = io_task;
+    scheduler->scheduled_tasks_tail = io_task;
+    scheduler->num_scheduled_tasks++;
+    io_task->is_scheduled = CMNUTIL_TRUE;
+    
+    /* Nothing left for the task to do; let the scheduler release it on its next pass. */
+    if ( S_IOSCHED_OPTS_REMOVE( io_task ) ) {
+      io_task->removed_next = scheduler->removed_tasks;
+      scheduler->removed_tasks = io_task;
+    }
+    else if ( S_IOSCHED_OPTS_TIMER( io_task ) ) {
+      inl_io_sched_populate_expire_time ( io_task );
+      inl_io_sched_timer_insert ( scheduler, io_task );
+    }
+  }
+  
+  LOGSVC_DEBUG( "Scheduler has %lu tasks scheduled.", (unsigned long) scheduler->num_scheduled_tasks );
+  
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  
+  if ( rv )
+    inl_io_sched_wakeup ( scheduler );
+  
+  return rv;
+}
+
+/**
+ * Queues a command for the scheduler loop to carry out, when called from another thread while
+ * the loop is running; returns false if the caller should carry it out directly instead.
+ **/
+static inline bool_t
+inl_io_sched_submit ( p_io_scheduler_task_t io_task, int cmd )
+{
+  p_io_scheduler_t scheduler = io_task->owner;
+  
+  if ( !( scheduler->loop_running ) || pthread_equal ( scheduler->loop_thread, pthread_self () ) )
+    return CMNUTIL_FALSE;
+  
+  /* Only the command that finds the task idle puts it on the queue; any more are picked up along
+     with it. */
+  if ( __sync_fetch_and_or ( &( io_task->pending_cmds ), cmd ) == 0 ) {
+    do {
+      io_task->submit_next = scheduler->submitted_tasks;
+    } while ( !__sync_bool_compare_and_swap ( &( scheduler->submitted_tasks ), io_task->submit_next, io_task ) );
+  }
+  
+  inl_io_sched_wakeup ( scheduler );
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Flags a task for removal and drops its interest with the backend; the caller must hold the
+ * owning scheduler's task_list_mutex. Tasks that were never scheduled are released immediately.
+ **/
+static inline void
+inl_io_sched_unschedule_task_locked ( p_io_scheduler_task_t io_task )
+{
+  if ( S_IOSCHED_OPTS_REMOVE( io_task ) && io_task->is_scheduled )
+    return; /* Already waiting to be released. */
+  
+  io_task->opts |= IO_SCHEDULER_REMOVE;
+  
+  /* Drop the interest now, before the caller gets a chance to close the descriptor and have the
+     number handed out again. */
+  if ( io_task->is_registered ) {
+    io_task->owner->backend->remove_task ( io_task->owner, io_task );
+    io_task->is_registered = CMNUTIL_FALSE;
+  }
+  if ( io_task->timer_slot )
+    inl_io_sched_timer_remove ( io_task->owner, io_task );
+  
+  if ( io_task->is_scheduled ) {
+    io_task->removed_next = io_task->owner->removed_tasks;
+    io_task->owner->removed_tasks = io_task;
+  }
+  else {
+    io_sched_destroy_task ( io_task );
+  }
+}
+
+/**
+ * Flags a task for removal, taking the owning scheduler's task_list_mutex.
+ **/
+static inline void
+inl_io_sched_unschedule_task_now ( p_io_scheduler_task_t io_task )
+{
+  p_io_scheduler_t scheduler;
+  
+  /* A task that was never scheduled goes straight back to the pool, where another thread may
+     pick it up; hang on to the owner rather than looking it up through the task again. */
+  scheduler = io_task->owner;
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  inl_io_sched_unschedule_task_locked ( io_task );
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  /* Let the scheduler release the task now, rather than whenever it next sees some activity. */
+  inl_io_sched_wakeup ( scheduler );
+}
+
+/**
+ * Closes the scheduler's wakeup descriptor(s).
+ **/
+static inline void
+inl_io_sched_close_wakeup ( p_io_scheduler_t scheduler )
+{
+  if ( ( scheduler->wakeup_wr_fd != INVALID_GENERAL_FD ) && ( scheduler->wakeup_wr_fd != scheduler->wakeup_rd_fd ) )
+    close ( scheduler->wakeup_wr_fd );
+  if ( scheduler->wakeup_rd_fd != INVALID_GENERAL_FD )
+    close ( scheduler->wakeup_rd_fd );
+  scheduler->wakeup_rd_fd = scheduler->wakeup_wr_fd = INVALID_GENERAL_FD;
+}
+
+/**
+ * Carries out the commands and (when make_calls is set) the calls submitted from other threads
+ * since the last pass, in the order they were submitted.
+ **/
+static inline void
+inl_io_sched_drain_submissions ( p_io_scheduler_t scheduler, bool_t make_calls )
+{
+  p_io_scheduler_task_t ptask, pnext, fifo = NIL_IO_SCHEDULER_TASK;
+  p_io_sched_posted_call_t call, cnext, cfifo = (p_io_sched_posted_call_t) 0;
+  int cmds;
+  
+  /* Take everything at once; both queues are pushed onto at the head, so reverse them to get
+     back to submission order. */
+  ptask = __sync_lock_test_and_set ( &( scheduler->submitted_tasks ), NIL_IO_SCHEDULER_TASK );
+  while ( ptask ) {
+    pnext = ptask->submit_next;
+    ptask->submit_next = fifo;
+    fifo = ptask;
+    ptask = pnext;
+  }
+  
+  for ( ptask = fifo; ptask; ptask = pnext ) {
+    /* Read the link before clearing the commands; as soon as they are cleared, another thread may
+       submit the task again, which overwrites the link. */
+    pnext = ptask->submit_next;
+    cmds = __sync_lock_test_and_set ( &( ptask->pending_cmds ), 0 );
+    if ( cmds & IO_SCHEDULER_CMD_SCHEDULE ) {
+      if ( !( inl_io_sched_schedule_task_now ( ptask ) ) ) {
+        LOGSVC_ERROR( "inl_io_sched_drain_submissions(): Unable to schedule task for FD %d; releasing it.", ptask->fd );
+        /* The caller was told the task was scheduled; unless it has given up on it already, it
+           needs to hear otherwise. */
+        if ( cmds & IO_SCHEDULER_CMD_UNSCHEDULE )
+          inl_io_sched_unschedule_task_now ( ptask );
+        else
+          inl_io_sched_refuse_task ( ptask );
+        continue;
+      }
+    }
+    if ( ( cmds & IO_SCHEDULER_CMD_RESCHEDULE ) && !( cmds & IO_SCHEDULER_CMD_UNSCHEDULE ) )
+      inl_io_sched_reschedule_task_now ( ptask );
+    if ( cmds & IO_SCHEDULER_CMD_UNSCHEDULE )
+      inl_io_sched_unschedule_task_now ( ptask );
+  }
+  
+  call = __sync_lock_test_and_set ( &( scheduler->posted_calls ), (p_io_sched_posted_call_t) 0 );
+  while ( call ) {
+    cnext = call->next;
+    call->next = cfifo;
+    cfifo = call;
+    call = cnext;
+  }
+  for ( call = cfifo; call; call = cnext ) {
+    cnext = call->next;
+    if ( make_calls )
+      call->fn ( scheduler, call->arg );
+    free ( call );
+  }
+}
+
+/**
+ * Finds the lookup chain for a descriptor / timer ID; the caller must hold the task_list_mutex.
+ * When grow is set, the descriptor or timer table is enlarged to cover the ID if need be.
+ * Returns NULL for an ID beyond its table that could not (or was not to) be grown.
+ **/
+static inline p_io_scheduler_task_t *
+inl_io_sched_lookup_chain ( p_io_scheduler_t scheduler, fd_t fd, bool_t grow )
+{
+  p_io_scheduler_task_t * tmp;
+  size_t new_size;
+  
+  if ( fd > INVALID_GENERAL_FD ) {
+    if ( (size_t) fd < scheduler->fd_lookup_size )
+      return &( scheduler->fd_lookup[ fd ] );
+    if ( !( grow ) )
+      return NULL;
+    new_size = scheduler->fd_lookup_size;
+    while ( new_size <= (size_t) fd )
+      new_size <<= 1;
+    tmp = (p_io_scheduler_task_t *) realloc ( scheduler->fd_lookup, new_size * sizeof( p_io_scheduler_task_t ) );
+    if ( !( tmp ) )
+      return NULL;
+    memset ( tmp + scheduler->fd_lookup_size, 0, ( new_size - scheduler->fd_lookup_size ) * sizeof( p_io_scheduler_task_t ) );
+    scheduler->fd_lookup = tmp;
+    scheduler->fd_lookup_size = new_size;
+    return &( scheduler->fd_lookup[ fd ] );
+  }
+  
+  if ( fd < -2 ) {
+    if ( IO_SCHEDULER_TIMER_INDEX( fd ) < scheduler->timer_lookup_size )
+      return &( scheduler->timer_lookup[ IO_SCHEDULER_TIMER_INDEX( fd ) ] );
+    if ( !( grow ) )
+      return NULL;
+    /* The timer ID pool has grown past the table. */
+    new_size = scheduler->timer_lookup_size;
+    while ( new_size <= IO_SCHEDULER_TIMER_INDEX( fd ) )
+      new_size <<= 1;
+    tmp = (p_io_scheduler_task_t *) realloc ( scheduler->timer_lookup, new_size * sizeof( p_io_scheduler_task_t ) );
+    if ( !( tmp ) )
+      return NULL;
+    memset ( tmp + scheduler->timer_lookup_size, 0, ( new_size - scheduler->timer_lookup_size ) * sizeof( p_io_scheduler_task_t ) );
+    scheduler->timer_lookup = tmp;
+    scheduler->timer_lookup_size = new_size;
+    return &( scheduler->timer_lookup[ IO_SCHEDULER_TIMER_INDEX( fd ) ] );
+  }
+  
+  return &( scheduler->other_lookup );
+}
+
+/**
+ * Adds a task to the end of its lookup chain; the caller must hold the task_list_mutex.
+ **/
+static inline bool_t
+inl_io_sched_lookup_insert ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task )
+{
+  p_io_scheduler_task_t * pp = inl_io_sched_lookup_chain ( scheduler, io_task->fd, CMNUTIL_TRUE );
+  
+  if ( !( pp ) )
+    return CMNUTIL_FALSE;
+  /* A descriptor is set up for busy polling when it first turns up, not each time a task on it is
+     scheduled again. */
+  if ( !( *pp ) && scheduler->busy_poll_usecs )
+    inl_io_sched_busy_poll_socket ( scheduler, io_task->fd );
+  /* Chains only hold the few tasks sharing one ID, so walking to the end costs next to nothing
+     and keeps io_sched_find_task() returning the earliest scheduled task, as it always has. */
+  while ( *pp )
+    pp = &( (*pp)->lookup_next );
+  *pp = io_task;
+  io_task->lookup_next = NIL_IO_SCHEDULER_TASK;
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Takes a task out of its lookup chain; the caller must hold the task_list_mutex.
+ **/
+static inline void
+inl_io_sched_lookup_remove ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task )
+{
+  p_io_scheduler_task_t * pp = inl_io_sched_lookup_chain ( scheduler, io_task->fd, CMNUTIL_FALSE );
+  
+  if ( !( pp ) )
+    return;
+  while ( *pp && ( *pp != io_task ) )
+    pp = &( (*pp)->lookup_next );
+  if ( *pp )
+    *pp = io_task->lookup_next;
+  io_task->lookup_next = NIL_IO_SCHEDULER_TASK;
+}
+
+/**
+ * Works out how long the backend may wait before the earliest timer deadline comes due, slack
+ * included; with no timers pending, it may wait until some IO happens or another thread wakes it.
+ **/
+static inline int64_t
+inl_io_sched_next_timeout ( p_io_scheduler_t scheduler )
+{
+  int64_t rv = -1;
+  
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  if ( scheduler->timer_heap_count ) {
+    rv = scheduler->timer_heap[1]->expire_time + scheduler->timer_heap[1]->slack - scheduler->now;
+    if ( rv < 0 )
+      rv = 0;
+  }
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  
+  return rv;
+}
+
+/**
+ * Creates the descriptor(s) used to wake the scheduler loop: an eventfd where the system has
+ * one, otherwise a non-blocking pipe.
+ **/
+static inline bool_t
+inl_io_sched_open_wakeup ( p_io_scheduler_t scheduler )
+{
+#ifdef HAVE_SYS_EVENTFD_H
+  scheduler->wakeup_rd_fd = eventfd ( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  if ( scheduler->wakeup_rd_fd == INVALID_GENERAL_FD ) {
+    LOGSVC_ERROR( "inl_io_sched_open_wakeup(): eventfd() failed: %s", strerror ( errno ) );
+    return CMNUTIL_FALSE;
+  }
+  scheduler->wakeup_wr_fd = scheduler->wakeup_rd_fd;
+#else
+  fd_t fds[2];
+  int ii;
+  
+  if ( pipe ( fds ) != 0 ) {
+    LOGSVC_ERROR( "inl_io_sched_open_wakeup(): pipe() failed: %s", strerror ( errno ) );
+    return CMNUTIL_FALSE;
+  }
+  for ( ii = 0; ii < 2; ii++ ) {
+    fcntl ( fds[ii], F_SETFL, fcntl ( fds[ii], F_GETFL ) | O_NONBLOCK );
+    fcntl ( fds[ii], F_SETFD, FD_CLOEXEC );
+  }
+  scheduler->wakeup_rd_fd = fds[0];
+  scheduler->wakeup_wr_fd = fds[1];
+#endif
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Pops every task whose deadline has passed off the timer heap and processes its timeout. Tasks
+ * that want to carry on are put back on the heap with a fresh deadline.
+ *
+ * The heap is ordered by deadline plus slack, so the task on top is the one that can wait the
+ * least; once it has come due, so has every other task whose deadline (not counting its slack)
+ * has passed and which comes off the heap before the first that has not. Those are fired in the
+ * same pass, rather than each waking the scheduler on its own.
+ **/
+static inline void
+inl_io_sched_process_expired_tasks ( p_io_scheduler_t scheduler )
+{
+  p_io_scheduler_task_t expired = NIL_IO_SCHEDULER_TASK, last = NIL_IO_SCHEDULER_TASK, ptask;
+  
+  /* Collect the expired tasks first, so that no callback runs with the task list locked. They get
+     their own links, since a task may already be queued on the ready chain for the next pass. */
+  LOCK_MUTEX( scheduler->task_list_mutex );
+  while ( scheduler->timer_heap_count ) {
+    ptask = scheduler->timer_heap[1];
+    /* Early, but still within its slack; one not reached here has a later deadline of its own. */
+    if ( ptask->expire_time > scheduler->now )
+      break;
+    inl_io_sched_timer_remove ( scheduler, ptask );
+    ptask->expired_next = NIL_IO_SCHEDULER_TASK;
+    if ( last )
+      last->expired_next = ptask;
+    else
+      expired = ptask;
+    last = ptask;
+  }
+  UNLOCK_MUTEX( scheduler->task_list_mutex );
+  
+  for ( ptask = expired; ptask && !( scheduler->stop_scheduler ); ptask = ptask->expired_next ) {
+    if ( S_IOSCHED_TASK_LEAVING( ptask ) )
+      continue;
+    
+    /* Readiness dispatched on this very pass wins over the timeout; look at it again next pass. */
+    if ( ptask->dispatch_pass == scheduler->pass_count ) {
+      LOCK_MUTEX( scheduler->task_list_mutex );
+      if ( !( ptask->timer_slot ) && !S_IOSCHED_OPTS_REMOVE( ptask ) )
+        inl_io_sched_timer_insert ( scheduler, ptask );
+      UNLOCK_MUTEX( scheduler->task_list_mutex );
+      continue;
+    }
+    
+    if ( scheduler->stats ) {
+      scheduler->stats->num_expired++;
+      inl_io_sched_hist_add ( &( scheduler->stats->timer_lateness ), inl_io_sched_read_clock ( scheduler ) - ptask->expire_time );
+    }
+    
+    if ( io_sched_process_task ( ptask, IO_SCHEDULER_NONE, CMNUTIL_TRUE ) ) {
+      io_sched_unschedule_task ( ptask );
+    }
+    else {
+      /* Still going; re-arm it unless the callback already rescheduled, removed or offloaded it. */
+      LOCK_MUTEX( scheduler->task_list_mutex );
+      if ( !( ptask->timer_slot ) && !S_IOSCHED_OPTS_REMOVE( ptask ) && !( ptask->is_offloaded ) &&
+           S_IOSCHED_OPTS_TIMER( ptask ) ) {
+        inl_io_sched_populate_expire_time ( ptask );
+        inl_io_sched_timer_insert ( scheduler, ptask );
+      }
+      UNLOCK_MUTEX( scheduler->task_list_mutex );
+    }
+  }
+}
+
+/**
+ * Tells a task queued from another thread that it could not be scheduled after all: its error
+ * callback, or failing that the first of its read, write and timeout callbacks, is called with
+ * IO_SCHEDULER_ERR_NOT_SCHEDULED. The task is then released, unless the callback unscheduled it
+ * itself (which, the task never having been scheduled, releases it on the spot).
+ **/
+static inline void
+inl_io_sched_refuse_task ( p_io_scheduler_task_t io_task )
+{
+  io_sched_handle_t handle = io_task->handle;
+  io_scheduler_cbk_t cbk = io_task->on_err_rdy_cbk;
+  
+  if ( !(cbk) )
+    cbk = io_task->on_read_rdy_cbk;
+  if ( !(cbk) )
+    cbk = io_task->on_write_rdy_cbk;
+  if ( !(cbk) )
+    cbk = io_task->on_timeout_cbk;
+  if ( cbk )
+    inl_io_sched_call ( io_task, cbk, IO_SCHEDULER_CBK_ERROR, IO_SCHEDULER_ERR_NOT_SCHEDULED );
+  if ( io_task->handle == handle )
+    inl_io_sched_unschedule_task_now ( io_task );
+}
+
+/**
+ * Adds a chunk of slots to the task slab, putting them all on the free list; the caller must hold
+ * the task_pool_mutex (or be setting up the scheduler). Returns false if the slab cannot grow.
+ **/
+static inline bool_t
+inl_io_sched_slab_grow ( p_io_scheduler_t scheduler )
+{
+  p_io_sched_slab_slot_t chunk;
+  uint32_t * tmp;
+  size_t ii, base;
+  
+  if ( scheduler->slab_num_chunks >= IO_SCHEDULER_SLAB_MAX_CHUNKS ) {
+    LOGSVC_ERROR( "inl_io_sched_slab_grow(): Task slab is at its limit of %lu tasks.", (unsigned long) scheduler->slab_capacity );
+    return CMNUTIL_FALSE;
+  }
+  
+  tmp = (uint32_t *) realloc ( scheduler->slab_free, ( scheduler->slab_capacity + IO_SCHEDULER_SLAB_CHUNK ) * sizeof( uint32_t ) );
+  if ( !(tmp) )
+    return CMNUTIL_FALSE;
+  scheduler->slab_free = tmp;
+  if ( posix_memalign ( (void **) &chunk, IO_SCHEDULER_CACHE_LINE, IO_SCHEDULER_SLAB_CHUNK * sizeof( io_sched_slab_slot_t ) ) != 0 )
+    return CMNUTIL_FALSE;
+  memset ( chunk, 0, IO_SCHEDULER_SLAB_CHUNK * sizeof( io_sched_slab_slot_t ) );
+  
+  /* Pushed highest index first, so that tasks are handed out from the front of the chunk. */
+  base = scheduler->slab_capacity;
+  for ( ii = IO_SCHEDULER_SLAB_CHUNK; ii > 0; ii-- ) {
+    chunk[ ii - 1 ].generation = 1;
+    scheduler->slab_free[ scheduler->slab_num_free++ ] = (uint32_t) ( base + ii - 1 );
+  }
+  scheduler->slab_chunks[ scheduler->slab_num_chunks++ ] = chunk;
+  scheduler->slab_capacity += IO_SCHEDULER_SLAB_CHUNK;
+  
+  LOGSVC_DEBUG( "inl_io_sched_slab_grow(): Task slab now holds %lu tasks.", (unsigned long) scheduler->slab_capacity );
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Maps a handle onto its task, or NULL when the handle is stale; the caller must hold the
+ * task_list_mutex to keep the task from being released while it is in use.
+ **/
+static inline p_io_scheduler_task_t
+inl_io_sched_slab_lookup ( p_io_scheduler_t scheduler, io_sched_handle_t handle )
+{
+  uint32_t index = IO_SCHEDULER_HANDLE_INDEX( handle );
+  p_io_sched_slab_slot_t slot;
+  
+  if ( ( handle == IO_SCHEDULER_INVALID_HANDLE ) || ( index / IO_SCHEDULER_SLAB_CHUNK >= IO_SCHEDULER_SLAB_MAX_CHUNKS ) ||
+       !( scheduler->slab_chunks[ index / IO_SCHEDULER_SLAB_CHUNK ] ) )
+    return NIL_IO_SCHEDULER_TASK;
+  slot = IO_SCHEDULER_SLAB_SLOT( scheduler, index );
+  if ( ( slot->generation != IO_SCHEDULER_HANDLE_GEN( handle ) ) || ( slot->task.handle != handle ) )
+    return NIL_IO_SCHEDULER_TASK;
+  return &( slot->task );
+}
+
+/**
+ * Adds a chunk of IDs to the timer ID pool, putting them all on the free list; the caller must
+ * hold the timer_pool_mutex (or be setting up the scheduler). Returns false if the pool cannot grow.
+ **/
+static inline bool_t
+inl_io_sched_timer_id_grow ( p_io_scheduler_t scheduler )
+{
+  uint32_t * tmp;
+  size_t ii, base;
+  
+  if ( scheduler->timer_capacity + IO_SCHEDULER_TIMER_CHUNK > (size_t) INT_MAX - 3 ) {
+    LOGSVC_ERROR( "inl_io_sched_timer_id_grow(): Timer pool is at its limit of %lu timers.", (unsigned long) scheduler->timer_capacity );
+    return CMNUTIL_FALSE;
+  }
+  
+  tmp = (uint32_t *) realloc ( scheduler->timer_free, ( scheduler->timer_capacity + IO_SCHEDULER_TIMER_CHUNK ) * sizeof( uint32_t ) );
+  if ( !(tmp) )
+    return CMNUTIL_FALSE;
+  scheduler->timer_free = tmp;
+  
+  /* Pushed highest index first, so that IDs are handed out from -3 downwards. */
+  base = scheduler->timer_capacity;
+  for ( ii = IO_SCHEDULER_TIMER_CHUNK; ii > 0; ii-- )
+    scheduler->timer_free[ scheduler->timer_num_free++ ] = (uint32_t) ( base + ii - 1 );
+  scheduler->timer_capacity += IO_SCHEDULER_TIMER_CHUNK;
+  
+  LOGSVC_DEBUG( "inl_io_sched_timer_id_grow(): Timer pool now holds %lu timers.", (unsigned long) scheduler->timer_capacity );
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Heap ordering: true when the first task's deadline, slack included, comes before the second's.
+ **/
+static inline bool_t
+inl_io_sched_timer_before ( p_io_scheduler_task_t t1, p_io_scheduler_task_t t2 )
+{
+  return ( ( t1->expire_time + t1->slack ) < ( t2->expire_time + t2->slack ) );
+}
+
+/**
+ * Queues a task on the timer heap; the caller must hold the task_list_mutex.
+ **/
+static inline bool_t
+inl_io_sched_timer_insert ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task )
+{
+  p_io_scheduler_task_t * tmp;
+  
+  /* The task slab may have grown since the heap was sized; follow it. */
+  if ( scheduler->timer_heap_count + 1 >= scheduler->timer_heap_size ) {
+    tmp = (p_io_scheduler_task_t *) realloc ( scheduler->timer_heap, ( scheduler->timer_heap_size << 1 ) * sizeof( p_io_scheduler_task_t ) );
+    if ( !(tmp) ) {
+      LOGSVC_ERROR( "inl_io_sched_timer_insert(): Timer heap is full; FD %d will not time out.", io_task->fd );
+      return CMNUTIL_FALSE;
+    }
+    scheduler->timer_heap = tmp;
+    scheduler->timer_heap_size <<= 1;
+  }
+  scheduler->timer_heap_count++;
+  scheduler->timer_heap[ scheduler->timer_heap_count ] = io_task;
+  io_task->timer_slot = scheduler->timer_heap_count;
+  inl_io_sched_timer_sift_up ( scheduler, io_task->timer_slot );
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Takes a task off the timer heap; the caller must hold the task_list_mutex.
+ **/
+static inline void
+inl_io_sched_timer_remove ( p_io_scheduler_t scheduler, p_io_scheduler_task_t io_task )
+{
+  size_t slot = io_task->timer_slot;
+  p_io_scheduler_task_t last;
+  
+  if ( !( slot ) )
+    return;
+  
+  io_task->timer_slot = 0;
+  last = scheduler->timer_heap[ scheduler->timer_heap_count ];
+  scheduler->timer_heap_count--;
+  if ( last != io_task ) {
+    /* Move the last task into the hole and restore the ordering from there. */
+    scheduler->timer_heap[ slot ] = last;
+    last->timer_slot = slot;
+    inl_io_sched_timer_sift_down ( scheduler, slot );
+    inl_io_sched_timer_sift_up ( scheduler, last->timer_slot );
+  }
+}
+
+/**
+ * Moves the task in the given heap slot down past any child due before it.
+ **/
+static inline void
+inl_io_sched_timer_sift_down ( p_io_scheduler_t scheduler, size_t slot )
+{
+  p_io_scheduler_task_t * heap = scheduler->timer_heap;
+  p_io_scheduler_task_t ptask = heap[ slot ];
+  size_t child;
+  
+  while ( ( child = slot << 1 ) <= scheduler->timer_heap_count ) {
+    if ( ( child < scheduler->timer_heap_count ) && inl_io_sched_timer_before ( heap[ child + 1 ], heap[ child ] ) )
+      child++;
+    if ( !( inl_io_sched_timer_before ( heap[ child ], ptask ) ) )
+      break;
+    heap[ slot ] = heap[ child ];
+    heap[ slot ]->timer_slot = slot;
+    slot = child;
+  }
+  heap[ slot ] = ptask;
+  ptask->timer_slot = slot;
+}
+
+/**
+ * Moves the task in the given heap slot up past any parent due after it.
+ **/
+static inline void
+inl_io_sched_timer_sift_up ( p_io_scheduler_t scheduler, size_t slot )
+{
+  p_io_scheduler_task_t * heap = scheduler->timer_heap;
+  p_io_scheduler_task_t ptask = heap[ slot ];
+  
+  while ( ( slot > 1 ) && inl_io_sched_timer_before ( ptask, heap[ slot >> 1 ] ) ) {
+    heap[ slot ] = heap[ slot >> 1 ];
+    heap[ slot ]->timer_slot = slot;
+    slot >>= 1;
+  }
+  heap[ slot ] = ptask;
+  ptask->timer_slot = slot;
+}
+
+/**
+ * Counts a task or timer refused by its pool, whether at the hard limit or for want of memory;
+ * the caller must hold the pool's mutex. Logged on the first refusal and then on every one that
+ * doubles the count, so that a pool stuck at its limit is seen without flooding the log.
+ **/
+static inline void
+inl_io_sched_usage_refused ( const char * what, const io_sched_limits_t * limits, uint64_t * num_refused )
+{
+  ( *num_refused )++;
+  if ( !( *num_refused & ( *num_refused - 1 ) ) )
+    LOGSVC_WARNING( "io_sched_create_task(): %s is %s; %llu refused so far.",
+                    what, ( limits->hard ? "at its hard limit" : "unable to grow" ), (unsigned long long) *num_refused );
+}
+
+/**
+ * Counts a task or timer handed out by its pool, now with in_use in use, against the pool's high
+ * watermark; the caller must hold the pool's mutex. The first time the watermark passes the soft
+ * limit, it is logged.
+ **/
+static inline void
+inl_io_sched_usage_taken ( const char * what, const io_sched_limits_t * limits, size_t in_use, size_t * high_watermark )
+{
+  if ( in_use <= *high_watermark )
+    return;
+  *high_watermark = in_use;
+  if ( limits->soft && ( in_use == limits->soft + 1 ) )
+    LOGSVC_WARNING( "io_sched_create_task(): %s has grown past its soft limit of %lu.", what, (unsigned long) limits->soft );
+}
+
+/**
+ * Waits on the backend for up to time_out nanoseconds (forever if negative). Within the busy-poll
+ * window of the loop's last activity, the backend is first polled without blocking, over and over,
+ * until it reports something, the window closes or the timeout runs out; the spin also gives up
+ * on anything that would have woken a blocking wait (commands submitted, calls posted, a stop).
+ * Only then is whatever is left of the timeout waited out blocking.
+ **/
+static inline int
+inl_io_sched_wait ( p_io_scheduler_t scheduler, int64_t time_out )
+{
+  p_io_sched_stats_t stats = scheduler->stats;
+  int64_t started, now, spin_end;
+  int rc;
+  
+  if ( scheduler->busy_poll && ( time_out != 0 ) ) {
+    started = now = inl_io_sched_stats_clock ();
+    spin_end = scheduler->last_active + scheduler->busy_poll;
+    if ( ( time_out > 0 ) && ( started + time_out < spin_end ) )
+      spin_end = started + time_out;
+    while ( now < spin_end ) {
+      rc = scheduler->backend->wait ( scheduler, 0 );
+      now = inl_io_sched_stats_clock ();
+      if ( stats )
+        stats->num_spin_polls++;
+      if ( ( rc != 0 ) || scheduler->submitted_tasks || scheduler->posted_calls || scheduler->stop_scheduler ) {
+        if ( stats ) {
+          if ( rc > 0 )
+            stats->num_spin_hits++;
+          stats->spin_ns += (uint64_t) ( now - started );
+        }
+        return rc;
+      }
+    }
+    if ( now > started ) {
+      if ( stats )
+        stats->spin_ns += (uint64_t) ( now - started );
+      if ( time_out > 0 )
+        time_out = ( time_out > now - started ) ? ( time_out - ( now - started ) ) : 0;
+    }
+  }
+  
+  if ( !( stats ) || ( time_out == 0 ) )
+    return scheduler->backend->wait ( scheduler, time_out );
+  started = inl_io_sched_stats_clock ();
+  rc = scheduler->backend->wait ( scheduler, time_out );
+  stats->num_blocking_waits++;
+  stats->blocked_ns += (uint64_t) ( inl_io_sched_stats_clock () - started );
+  return rc;
+}
+
+/**
+ * Wakes the scheduler loop out of its wait, so that it picks up a change to its tasks. Nothing
+ * is written when called from the loop itself, which looks again before it next waits, or when
+ * a wakeup is already pending.
+ **/
+static inline void
+inl_io_sched_wakeup ( p_io_scheduler_t scheduler )
+{
+  if ( ( scheduler->loop_running ) && pthread_equal ( scheduler->loop_thread, pthread_self () ) )
+    return;
+  if ( __sync_lock_test_and_set ( &( scheduler->wakeup_pending ), 1 ) )
+    return;
+#ifdef HAVE_SYS_EVENTFD_H
+  eventfd_write ( scheduler->wakeup_wr_fd, 1 );
+#else
+  if ( write ( scheduler->wakeup_wr_fd, "", 1 ) < 0 )
+    LOGSVC_TRACE( "inl_io_sched_wakeup(): write() failed: %s", strerror ( errno ) );
+#endif
 }
 
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
@@ -11,24 +11,107 @@
    definitions. */
 #include "gccpch.h"
 
-#include "stack.h"
-
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 
 // Forward declarations for use in the scheduler task structure.
 
 struct _io_scheduler;
 struct _io_scheduler_task;
+struct _io_sched_backend;
+struct _io_sched_pool;
+struct _io_sched_posted_call;
+struct _io_sched_slab_slot;
+struct _io_sched_watchdog;
 
+/**
+ * Task options. IO_SCHEDULER_EDGE asks for edge-triggered readiness: the callback is only called
+ * when the descriptor becomes ready anew, rather than on every pass for as long as it stays
+ * ready, and must therefore keep reading (or writing) until the call fails with EAGAIN. One
+ * that stops short of that, because it has used up its batch for the pass (see
+ * io_sched_get_edge_batch()), hands the rest over to the next pass with io_sched_continue_task().
+ * Backends that cannot watch for edges (select) carry on reporting readiness level-triggered,
+ * which a callback following the above sees no difference from.
+ **/
 typedef enum {
   IO_SCHEDULER_NONE                       = 0x00000000,
     IO_SCHEDULER_READ                     = 0x00000001,
     IO_SCHEDULER_WRITE                    = 0x00000002,
     IO_SCHEDULER_ERROR                    = 0x00000004,
     IO_SCHEDULER_TIMER                    = 0x00000008,
+    IO_SCHEDULER_EDGE                     = 0x00000010,
     IO_SCHEDULER_REMOVE                   = 0x80000000
 } io_task_opts_t;
 
+/**
+ * Event notification mechanisms the scheduler can use to wait on its file descriptors. The
+ * "auto" selection picks epoll where the build environment supports it, and select otherwise;
+ * io_uring is only used when asked for by name. Should the chosen mechanism be unavailable at
+ * run time, the scheduler falls back from io_uring to epoll, and from epoll to select.
+ **/
+typedef enum {
+  IO_SCHEDULER_BACKEND_AUTO               = 0,
+    IO_SCHEDULER_BACKEND_SELECT           = 1,
+    IO_SCHEDULER_BACKEND_EPOLL            = 2,
+    IO_SCHEDULER_BACKEND_IO_URING         = 3
+} io_sched_backend_type_t;
+
+/**
+ * Clocks the scheduler can measure timeouts against. Neither moves when the wall clock is set or
+ * stepped; the coarse clock is cheaper to read, but only advances once per kernel tick (typically
+ * every 1-4 ms), so timeouts may fire up to a tick late.
+ **/
+typedef enum {
+  IO_SCHEDULER_CLOCK_MONOTONIC            = 0,
+    IO_SCHEDULER_CLOCK_MONOTONIC_COARSE   = 1
+} io_sched_clock_t;
+
+/**
+ * Priority classes for tasks. Ready tasks are dispatched a class at a time, control first, so
+ * that health checks, management ports and monitoring timers stay responsive however busy the
+ * rest is; each class can be held to a budget per pass through the loop (io_sched_budget_t),
+ * with whatever is over the budget carried over to the next pass. Tasks are interactive unless
+ * set otherwise with io_sched_set_task_priority().
+ **/
+typedef enum {
+  IO_SCHEDULER_PRIORITY_CONTROL           = 0,
+    IO_SCHEDULER_PRIORITY_INTERACTIVE     = 1,
+    IO_SCHEDULER_PRIORITY_BULK            = 2,
+    IO_SCHEDULER_PRIORITIES               = 3
+} io_sched_priority_t;
+
+/**
+ * Most work a priority class may be dispatched for in one pass through the loop: ready callbacks
+ * made, and bytes reported through io_sched_account_bytes(). Once either is used up, the class's
+ * remaining ready tasks wait for the next pass. Zero for no limit. Timeouts are not budgeted.
+ **/
+typedef struct _io_sched_budget {
+  size_t callbacks;
+  uint64_t bytes;
+} io_sched_budget_t;
+
+/**
+ * Limits on how far a scheduler's task slab or timer ID pool may grow. Past the soft limit, the
+ * growth is logged as a warning, the first time only, so that a pool outgrowing what it was sized
+ * for gets noticed; at the hard limit, no more are handed out until some are released, and each
+ * refusal is counted (see io_sched_get_capacity()). Zero for no limit.
+ **/
+typedef struct _io_sched_limits {
+  size_t soft;
+  size_t hard;
+} io_sched_limits_t;
+
+/**
+ * Usage of a scheduler's task slab or timer ID pool, as reported by io_sched_get_capacity(): how
+ * many are in use, how many there is room for, the most ever in use at once, and how many were
+ * refused, whether at the hard limit or for want of memory.
+ **/
+typedef struct _io_sched_capacity {
+  size_t in_use;
+  size_t capacity;
+  size_t high_watermark;
+  uint64_t num_refused;
+} io_sched_capacity_t;
+
 #define IO_SCHEDULER_TASK_COMPLETE        CMNUTIL_TRUE
 #define IO_SCHEDULER_TASK_INCOMPLETE      CMNUTIL_FALSE
 
@@ -47,6 +130,123 @@ typedef enum {
 typedef bool_t ( *io_scheduler_cbk_t ) ( struct _io_scheduler_task * task, int errcode );
 //typedef bool_t ( *io_scheduler_cbk_t ) ( struct _io_scheduler * scheduler, fd_t fd, int errcode, void * userdata );
 
+/**
+ * Signature of a call posted to a scheduler with io_sched_post(); made from the scheduler loop.
+ **/
+typedef void ( *io_sched_post_fn_t ) ( struct _io_scheduler * scheduler, void * arg );
+
+/**
+ * Signature of work handed to the scheduler's worker pool with io_sched_offload(); runs on a
+ * worker thread, and returns a result for the done function.
+ **/
+typedef void * ( *io_sched_work_fn_t ) ( struct _io_scheduler_task * task, void * arg );
+
+/**
+ * Signature of the function that takes the result of offloaded work, back on the scheduler's own
+ * thread. Returns IO_SCHEDULER_TASK_COMPLETE to have the task unscheduled, just as a callback does,
+ * or IO_SCHEDULER_TASK_INCOMPLETE to have it carry on watching its descriptor.
+ **/
+typedef bool_t ( *io_sched_done_fn_t ) ( struct _io_scheduler_task * task, void * result, void * arg );
+
+/**
+ * Signature of the function io_sched_drain_scheduler() reports each task still pending to.
+ **/
+typedef void ( *io_sched_pending_fn_t ) ( struct _io_scheduler_task * task, void * arg );
+
+/**
+ * Handle to a task, for holding on to it past the point where it may have completed: the index
+ * of the task's slot in its scheduler's slab (low 20 bits) and the generation of that slot (high
+ * 12 bits). The generation moves on every time the slot is released, so a handle kept after its
+ * task is gone no longer matches, even once the slot has been handed out again. Zero is never a
+ * valid handle.
+ **/
+typedef uint32_t io_sched_handle_t;
+
+#define IO_SCHEDULER_INVALID_HANDLE     ((io_sched_handle_t) 0)
+#define IO_SCHEDULER_HANDLE_INDEX_BITS  20
+#define IO_SCHEDULER_HANDLE_INDEX_MASK  ((uint32_t) 0x000FFFFF)
+#define IO_SCHEDULER_HANDLE_GEN_MASK    ((uint32_t) 0x00000FFF)
+#define IO_SCHEDULER_HANDLE(idx, gen)   ((io_sched_handle_t) ( ( ( (uint32_t) (gen) & IO_SCHEDULER_HANDLE_GEN_MASK ) << IO_SCHEDULER_HANDLE_INDEX_BITS ) | \
+                                                               ( (uint32_t) (idx) & IO_SCHEDULER_HANDLE_INDEX_MASK ) ))
+#define IO_SCHEDULER_HANDLE_INDEX(h)    ((uint32_t) ( (h) & IO_SCHEDULER_HANDLE_INDEX_MASK ))
+#define IO_SCHEDULER_HANDLE_GEN(h)      ((uint32_t) ( (h) >> IO_SCHEDULER_HANDLE_INDEX_BITS ))
+
+/**
+ * Log-linear histogram of durations, in nanoseconds. Each power of two is split into
+ * IO_SCHEDULER_HIST_SUB_BUCKETS equal buckets, so a duration is placed to within a quarter of its
+ * size whatever its magnitude. Durations of 2^36 ns (about 69 seconds) and up all land in the last
+ * bucket; see io_sched_histogram_bucket_floor() and io_sched_histogram_percentile().
+ **/
+#define IO_SCHEDULER_HIST_SUB_BITS      2
+#define IO_SCHEDULER_HIST_SUB_BUCKETS   ( 1 << IO_SCHEDULER_HIST_SUB_BITS )
+#define IO_SCHEDULER_HIST_MAX_BITS      36
+#define IO_SCHEDULER_HIST_BUCKETS       ( ( IO_SCHEDULER_HIST_MAX_BITS - IO_SCHEDULER_HIST_SUB_BITS + 1 ) * IO_SCHEDULER_HIST_SUB_BUCKETS )
+
+typedef struct _io_sched_histogram {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[ IO_SCHEDULER_HIST_BUCKETS ];
+} io_sched_histogram_t;
+
+/**
+ * Kinds of callback a task is called back for; callback run times are kept separately for each.
+ **/
+typedef enum {
+  IO_SCHEDULER_CBK_READ                   = 0,
+    IO_SCHEDULER_CBK_WRITE                = 1,
+    IO_SCHEDULER_CBK_ERROR                = 2,
+    IO_SCHEDULER_CBK_TIMEOUT              = 3,
+    IO_SCHEDULER_CBK_KINDS                = 4
+} io_sched_cbk_kind_t;
+
+/**
+ * Instrumentation kept by a scheduler created with collect_stats set; see io_sched_get_stats().
+ * Everything is counted from when the scheduler was created.
+ **/
+typedef struct _io_sched_stats {
+  
+  /** Passes through the scheduler loop, and the total time spent waiting in the backend. */
+  uint64_t num_passes;
+  uint64_t wait_ns;
+  
+  /** Tasks dispatched for readiness, tasks dispatched for an expired timeout, and tasks released. */
+  uint64_t num_ready;
+  uint64_t num_expired;
+  uint64_t num_removed;
+  
+  /** Ready tasks carried over to the next pass because their priority class was over budget. */
+  uint64_t num_deferred;
+  
+  /**
+   * Busy polling (see io_scheduler_config_t): non-blocking polls made while spinning, how many of
+   * them turned something up, and the time spent spinning; then the waits that went on to block,
+   * and the time spent blocked, which is the scheduler's idle time. Few hits for a lot of spinning
+   * means the window is longer than the gaps in the traffic are worth; many blocking waits
+   * followed closely by activity means it is too short.
+   **/
+  uint64_t num_spin_polls;
+  uint64_t num_spin_hits;
+  uint64_t spin_ns;
+  uint64_t num_blocking_waits;
+  uint64_t blocked_ns;
+  
+  /** Time taken by each pass through the loop, not counting the wait. */
+  io_sched_histogram_t loop_time;
+  
+  /** Time from the backend reporting a task ready to the task's callback being made. */
+  io_sched_histogram_t dispatch_latency;
+  
+  /** How late timeouts and timers fire: time of the callback less the task's expire_time. */
+  io_sched_histogram_t timer_lateness;
+  
+  /** Time spent in callbacks, by kind of callback. */
+  io_sched_histogram_t callback_time[ IO_SCHEDULER_CBK_KINDS ];
+  
+} io_sched_stats_t;
+
+typedef struct _io_sched_stats * p_io_sched_stats_t;
+
 /* ---------- ---------- ---------- ---------- */
 
 typedef struct _io_scheduler_task {
@@ -54,11 +254,48 @@ typedef struct _io_scheduler_task {
   struct _io_scheduler_task * next;
   struct _io_scheduler_task * prev;
   struct _io_scheduler * owner;
+  /** Handle of the task while it is allocated; IO_SCHEDULER_INVALID_HANDLE once released. */
+  io_sched_handle_t handle;
   fd_t fd;
   volatile io_task_opts_t opts;
+  
+  /** Set once the task has been linked into its owner's scheduled tasks list. */
+  bool_t is_scheduled;
+  /** Set while the backend is watching the file descriptor on behalf of this task. */
+  bool_t is_registered;
+  /** Set while work for the task is out with the worker pool; its interest is suspended meanwhile. */
+  volatile bool_t is_offloaded;
+  /** Priority class the task is dispatched in; see io_sched_set_task_priority(). */
+  io_sched_priority_t priority;
+  /** Readiness reported by the backend for the current pass through the scheduler loop. */
+  io_task_opts_t ready_opts;
+  /** Pass through the scheduler loop in which the task was last dispatched for readiness. */
+  uint64_t dispatch_pass;
+  /** Callbacks made for the task and the total time spent in them; only kept when collecting stats. */
+  uint64_t num_callbacks;
+  uint64_t callback_ns;
+  /** Links used for the ready, expired and removed task chains, and for tasks sharing a descriptor. */
+  struct _io_scheduler_task * ready_next;
+  struct _io_scheduler_task * expired_next;
+  struct _io_scheduler_task * removed_next;
+  struct _io_scheduler_task * fd_next;
+  /** Link to the next task scheduled under the same descriptor / timer ID, for lookups. */
+  struct _io_scheduler_task * lookup_next;
+  /**
+   * Commands (schedule, reschedule, unschedule) submitted from other threads and not yet carried
+   * out by the scheduler loop, and the link used while the task is on its submission queue.
+   **/
+  volatile int pending_cmds;
+  struct _io_scheduler_task * submit_next;
+  
   int64_t time_out;
   struct timespec time_scheduled;
-  struct timespec expire_time;
+  /** Deadline of the task's timeout, in nanoseconds on its owner's clock. */
+  int64_t expire_time;
+  /** How much later than expire_time the timeout may fire, so as to share a wakeup; see io_sched_create_task(). */
+  int64_t slack;
+  /** Position of the task in its owner's timer heap (1-based); zero when not waiting on a timer. */
+  size_t timer_slot;
   void * user_data;
   io_scheduler_cbk_t on_read_rdy_cbk;
   io_scheduler_cbk_t on_write_rdy_cbk;
@@ -73,20 +310,190 @@ typedef struct _io_scheduler_task * p_io_scheduler_task_t;
 
 /* ---------- ---------- ---------- ---------- */
 
+/**
+ * Settings for the thread io_sched_start_scheduler_thread_ex() runs a scheduler in. Always prepare
+ * one with io_sched_thread_attr_init(), so that any settings not explicitly given are left as the
+ * system has them. Apart from the stack size, each is applied by the thread itself as it starts;
+ * one that cannot be applied (for want of privilege, say) is logged, and the thread runs anyway.
+ **/
+typedef struct _io_sched_thread_attr {
+  
+  /** Name for the thread, as shown by ps and top (at most 15 characters); empty for none. */
+  char name[ 16 ];
+  
+  /** Stack size, in bytes; zero for the system's default. */
+  size_t stack_size;
+  
+#ifdef CPU_SETSIZE
+  /** CPUs the thread may run on, when use_cpus is set; otherwise it may run on any. */
+  bool_t use_cpus;
+  cpu_set_t cpus;
+#endif
+  
+  /**
+   * Priority (1 to 99) to run the thread at under the SCHED_FIFO real-time policy; zero (the
+   * default) to stay with the normal policy. Needs CAP_SYS_NICE or a suitable RLIMIT_RTPRIO.
+   **/
+  int fifo_priority;
+  
+  /** Nice value (-20 to 19) for the thread under the normal policy, when set_nice is set. */
+  bool_t set_nice;
+  int nice;
+  
+  /**
+   * Set to lock the process's memory, present and future, into RAM (mlockall()), so that the
+   * scheduler never waits on a page fault. This is process-wide, since the scheduler's memory is
+   * shared with the callbacks it makes; it needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK.
+   **/
+  bool_t lock_memory;
+  
+} io_sched_thread_attr_t;
+
+/* ---------- ---------- ---------- ---------- */
+
 typedef struct _io_scheduler {
   
-  /** Linked list of currently scheduled tasks. */
+  /** Linked list of currently scheduled tasks, its last task and the number of tasks on it. */
   p_io_scheduler_task_t scheduled_tasks;
+  p_io_scheduler_task_t scheduled_tasks_tail;
+  size_t num_scheduled_tasks;
+  
+  /**
+   * Scheduled tasks indexed for io_sched_find_task(): by descriptor, by timer ID (-3 being the
+   * first entry), and a single chain for any other ID (the special system tasks). Tasks with the
+   * same ID are chained through lookup_next in the order they were scheduled. All of these are
+   * guarded by task_list_mutex.
+   **/
+  p_io_scheduler_task_t * fd_lookup;
+  size_t fd_lookup_size;
+  p_io_scheduler_task_t * timer_lookup;
+  size_t timer_lookup_size;
+  p_io_scheduler_task_t other_lookup;
   
   /** Mutex used to lock the task list. */
   pthread_mutex_t task_list_mutex;
   
-  /** A pool of tasks; rather than malloc/free a lot of times, make a bunch up front. */
-  p_stack_t task_pool;
+  /**
+   * Tasks the backend found ready during the current pass, along with any handed over from the
+   * last pass by io_sched_continue_task() or for want of budget, by priority class (owned by the
+   * scheduler thread).
+   **/
+  p_io_scheduler_task_t ready_tasks[ IO_SCHEDULER_PRIORITIES ];
+  p_io_scheduler_task_t ready_tasks_tail[ IO_SCHEDULER_PRIORITIES ];
+  
+  /** Per-pass budget of each priority class, and the bytes accounted to the callback under way. */
+  io_sched_budget_t budgets[ IO_SCHEDULER_PRIORITIES ];
+  uint64_t dispatch_bytes;
+  
+  /** Tasks that have been unscheduled and are waiting to be released; guarded by task_list_mutex. */
+  p_io_scheduler_task_t removed_tasks;
+  
+  /**
+   * Binary min-heap of tasks waiting on a timeout, ordered by expire time plus slack; guarded by
+   * task_list_mutex. Slot zero is unused so that a task's slot of zero means "not queued".
+   **/
+  p_io_scheduler_task_t * timer_heap;
+  size_t timer_heap_count;
+  size_t timer_heap_size;
+  
+  /** Count of passes made through the scheduler loop. */
+  uint64_t pass_count;
+  
+  /** Reads or writes an edge-triggered callback should make per pass; see io_sched_get_edge_batch(). */
+  size_t edge_batch;
+  
+  /**
+   * Busy-poll window, in nanoseconds (zero when not busy polling), the SO_BUSY_POLL value given to
+   * the sockets scheduled (zero for none, or once the kernel refused it), and when (on the stats clock) the loop last found
+   * anything to do.
+   **/
+  int64_t busy_poll;
+  int busy_poll_usecs;
+  int64_t last_active;
+  
+  /**
+   * Instrumentation, when collecting stats; NULL otherwise. Only ever written by the scheduler
+   * loop, and read by io_sched_get_stats() without locking.
+   **/
+  p_io_sched_stats_t stats;
+  
+  /**
+   * Callback in progress on the scheduler loop, for the watchdog: when it started (zero while
+   * none is running), which descriptor and callback it is, and a count of the callbacks made.
+   * Only kept when watchdog_budget is set.
+   **/
+  volatile int64_t cbk_started;
+  volatile fd_t cbk_fd;
+  io_scheduler_cbk_t volatile cbk_fn;
+  volatile uint64_t cbk_seq;
+  
+  /** Budget for a single callback, in nanoseconds, and the watchdog enforcing it; NULL if none. */
+  int64_t watchdog_budget;
+  struct _io_sched_watchdog * watchdog;
+  
+  /** Worker threads that callbacks can hand work off to (see io_sched_offload()); NULL if none. */
+  struct _io_sched_pool * worker_pool;
+  
+  /**
+   * Clock that timeouts are measured against, and its reading (in nanoseconds) as taken by the
+   * scheduler loop, once before waiting and once after; see io_sched_now().
+   **/
+  clockid_t clock_id;
+  volatile int64_t now;
+  
+  /** Event notification backend and its private state. */
+  const struct _io_sched_backend * backend;
+  void * backend_data;
+  
+  /**
+   * Descriptor(s) the backend watches alongside the tasks, so that other threads can wake the
+   * scheduler loop out of its wait. Both are the same eventfd where available, else the ends
+   * of a pipe. The pending flag keeps more than one wakeup from being queued at a time.
+   **/
+  fd_t wakeup_rd_fd;
+  fd_t wakeup_wr_fd;
+  volatile int wakeup_pending;
+  
+  /** Thread running the scheduler loop, while loop_running is set; it never needs waking. */
+  pthread_t loop_thread;
+  volatile bool_t loop_running;
+  
+  /**
+   * Lock-free submission queues, pushed onto by any thread and drained by the scheduler loop at
+   * the top of each pass: tasks with commands pending, and calls posted with io_sched_post().
+   **/
+  struct _io_scheduler_task * volatile submitted_tasks;
+  struct _io_sched_posted_call * volatile posted_calls;
+  
+  /**
+   * Slab the tasks are allocated from, rather than malloc/free a lot of times: chunks of
+   * cache-line-aligned slots that are added as needed and never moved, the indices of the free
+   * slots (lowest index on top), and the number of slots in all. Guarded by task_pool_mutex,
+   * other than the chunk pointers themselves, which never change once set.
+   **/
+  struct _io_sched_slab_slot ** slab_chunks;
+  size_t slab_num_chunks;
+  uint32_t * slab_free;
+  size_t slab_num_free;
+  size_t slab_capacity;
   pthread_mutex_t task_pool_mutex;
   
-  /** A pool of timer IDs for non-IO tasks. */
-  p_stack_t timer_id_pool;
+  /** Growth limits of the task slab, the most tasks in use at once, and the tasks refused. */
+  io_sched_limits_t task_limits;
+  size_t task_high_watermark;
+  uint64_t task_num_refused;
+  
+  /**
+   * Pool of timer IDs for non-IO tasks, handed out from -3 downwards and grown by chunks as
+   * needed: the indices of the free IDs (lowest index on top), the number of IDs in all, and the
+   * same limits and counts as for tasks. All guarded by timer_pool_mutex.
+   **/
+  uint32_t * timer_free;
+  size_t timer_num_free;
+  size_t timer_capacity;
+  io_sched_limits_t timer_limits;
+  size_t timer_high_watermark;
+  uint64_t timer_num_refused;
   pthread_mutex_t timer_pool_mutex;
   
   /**
@@ -95,9 +502,15 @@ typedef struct _io_scheduler {
    **/
   pthread_t scheduler_thread;
   
+  /** Settings the scheduler's own thread applies to itself as it starts. */
+  io_sched_thread_attr_t thread_attr;
+  
   /** Flag indicating whether scheduler should stop. */
   volatile bool_t stop_scheduler;
   
+  /** Set once the scheduler is draining: no new tasks are taken on, and the loop ends once idle. */
+  volatile bool_t draining;
+  
 } io_scheduler_t;
 
 typedef struct _io_scheduler * p_io_scheduler_t;
@@ -106,6 +519,90 @@ typedef struct _io_scheduler * p_io_scheduler_t;
 
 /* ---------- ---------- ---------- ---------- */
 
+/**
+ * Creation-time settings for a scheduler. Always prepare one with io_sched_config_init() so
+ * that any settings not explicitly given take on their defaults.
+ **/
+typedef struct _io_scheduler_config {
+  
+  /** Number of tasks to make room for up front; the task slab grows by chunks beyond this. */
+  size_t max_concurrent_tasks;
+  
+  /** Number of timers to make room for up front; the timer ID pool grows by chunks beyond this. */
+  size_t max_num_timers;
+  
+  /** Limits on the growth of the task slab and the timer ID pool; none by default. */
+  io_sched_limits_t task_limits;
+  io_sched_limits_t timer_limits;
+  
+  /** Event notification backend used to wait on the scheduled file descriptors. */
+  io_sched_backend_type_t backend;
+  
+  /** Clock that timeouts are measured against. */
+  io_sched_clock_t clock;
+  
+  /**
+   * Most reads or writes an edge-triggered callback should make in one pass before handing the
+   * rest over to the next, so that one busy stream cannot hold up every other task; zero for no
+   * limit.
+   **/
+  size_t edge_batch;
+  
+  /**
+   * Per-pass budget of each priority class, indexed by io_sched_priority_t. By default only the
+   * bulk class is held to one, of 64 callbacks and 1 MiB.
+   **/
+  io_sched_budget_t budgets[ IO_SCHEDULER_PRIORITIES ];
+  
+  /**
+   * Busy-poll window, in nanoseconds. For this long after the loop last found something to do,
+   * it polls without blocking, over and over, rather than sleep in the kernel and pay for being
+   * woken; once the window goes by with nothing doing, it blocks as usual. This trades a CPU kept
+   * busy for tens of microseconds off the latency of each event. Zero (the default) never spins.
+   **/
+  int64_t busy_poll;
+  
+  /**
+   * SO_BUSY_POLL value, in microseconds, to set on the sockets scheduled while busy polling, so
+   * that the kernel polls the device queue on a read rather than wait for an interrupt; zero (the
+   * default) for the busy-poll window, negative to leave sockets alone. It is set once per socket,
+   * when the first task on it is scheduled. Values above the system's net.core.busy_read need
+   * CAP_NET_ADMIN; without it, the first refusal stops the scheduler trying on any other socket.
+   **/
+  int busy_poll_usecs;
+  
+  /**
+   * Set to have the scheduler keep timing and counts of its work (see io_sched_get_stats()); off
+   * by default, since it takes a few more clock readings for every callback.
+   **/
+  bool_t collect_stats;
+  
+  /**
+   * Budget for a single callback, in nanoseconds. When set, a watchdog thread logs any callback
+   * that runs longer, with its task's descriptor, the callback and the time taken so far; zero
+   * (the default) for no watchdog.
+   **/
+  int64_t watchdog_budget;
+  
+  /**
+   * Set to have the watchdog also log the scheduler thread's backtrace when it reports a callback.
+   * The backtrace is taken by interrupting the thread with a signal, which cuts short any call
+   * that is not restarted afterwards (sleeps, poll() and the like fail with EINTR).
+   **/
+  bool_t watchdog_backtrace;
+  
+  /**
+   * Number of worker threads to start for io_sched_offload(); zero (the default) for none, in
+   * which case all work stays on the scheduler's own thread.
+   **/
+  size_t num_workers;
+  
+} io_scheduler_config_t;
+
+typedef struct _io_scheduler_config * p_io_scheduler_config_t;
+
+/* ---------- ---------- ---------- ---------- */
+
 /* "NULL" indicators for pointers to the aforementioned structures. */
 #define NIL_IO_SCHEDULER                ((p_io_scheduler_t) 0)
 #define NIL_IO_SCHEDULER_CBK            ((io_scheduler_cbk_t) 0)
@@ -114,6 +611,9 @@ typedef struct _io_scheduler * p_io_scheduler_t;
 // Tells scheduler that task never times out.
 #define IO_SCHEDULER_NO_TIMEOUT         ((int64_t) -1)
 
+// Tells scheduler that task's timeout is to fire as close to its deadline as it can.
+#define IO_SCHEDULER_NO_SLACK           ((int64_t) 0)
+
 // We default to using microseconds; in the event we need to switch to nanoseconds, both are defined here.
 #define IO_SCHEDULER_NTIME_ONE_SECOND   1000000000
 #define IO_SCHEDULER_UTIME_ONE_SECOND   1000000
@@ -128,16 +628,43 @@ typedef struct _io_scheduler * p_io_scheduler_t;
 #define IO_SCHEDULER_ERR_OP_TIMEOUT     ETIME
 #define IO_SCHEDULER_ERR_FD_CLOSED      ECONNRESET
 #define IO_SCHEDULER_ERR_FD_EOF         ENODATA
+#define IO_SCHEDULER_ERR_NOT_SCHEDULED  ECANCELED
 
 #define S_IOSCHED_OPTS_READ(t)          ((t)->opts & IO_SCHEDULER_READ)
 #define S_IOSCHED_OPTS_WRITE(t)         ((t)->opts & IO_SCHEDULER_WRITE)
 #define S_IOSCHED_OPTS_ERROR(t)         ((t)->opts & IO_SCHEDULER_ERROR)
 #define S_IOSCHED_OPTS_TIMER(t)         ((t)->opts & IO_SCHEDULER_TIMER)
+#define S_IOSCHED_OPTS_EDGE(t)          ((t)->opts & IO_SCHEDULER_EDGE)
 #define S_IOSCHED_OPTS_TIMER_ONLY(t)    ((t)->opts == IO_SCHEDULER_TIMER)
 #define S_IOSCHED_OPTS_REMOVE(t)        ((t)->opts & IO_SCHEDULER_REMOVE)
 
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 
+/**
+ * Counts bytes read or written by the callback under way against its priority class's per-pass
+ * budget; called from within the callback.
+ **/
+void io_sched_account_bytes ( p_io_scheduler_task_t io_task, size_t num_bytes );
+
+/**
+ * Returns the name of the event notification backend in use by the scheduler.
+ **/
+const char * io_sched_backend_name ( p_io_scheduler_t scheduler );
+
+/**
+ * Fills in a scheduler configuration with the default settings.
+ **/
+void io_sched_config_init ( io_scheduler_config_t * config );
+
+/**
+ * Hands a pass's worth of readiness over to the next pass: called from within an edge-triggered
+ * task's callback that has used up its batch before reaching EAGAIN, so that the task is called
+ * again for the given readiness (IO_SCHEDULER_READ and/or IO_SCHEDULER_WRITE) without waiting
+ * on an edge that will not come. The scheduler does not block in its next wait while any task
+ * has been continued. Must only be called from the scheduler's own thread.
+ **/
+void io_sched_continue_task ( p_io_scheduler_task_t io_task, io_task_opts_t ready_opts );
+
 /**
  * Creates a read-only task for the given file descriptor; will wait only time_out microseconds
  * before calling the read callback method with a timeout error.
@@ -157,20 +684,34 @@ p_io_scheduler_task_t io_sched_create_reader_task_ex ( p_io_scheduler_t schedule
 
 /**
  * Creates a scheduler and tells it how many tasks it can handle concurrently.
- * @param max_concurrent_tasks Max number of tasks scheduler can have scheduled at any given time.
- * @param max_num_timers Max number of timers scheduler can have scheduled at any given time.
+ * @param max_concurrent_tasks Number of tasks to make room for up front; more are added as needed.
+ * @param max_num_timers Number of timers to make room for up front; more are added as needed.
  * @return The IO scheduler, or NULL if unable to create the scheduler.
  **/
 p_io_scheduler_t io_sched_create_scheduler ( size_t max_concurrent_tasks, size_t max_num_timers );
 
+/**
+ * Creates a scheduler using the given settings.
+ * @param config Scheduler settings, prepared with io_sched_config_init().
+ * @return The IO scheduler, or NULL if unable to create the scheduler.
+ **/
+p_io_scheduler_t io_sched_create_scheduler_ex ( const io_scheduler_config_t * config );
+
 /**
  * Creates a task to be added to our IO scheduler; may specify the file descriptor, timeout length,
  * read/write/error/timeout callbacks.
+ *
+ * The slack is how much later than its deadline the task's timeout may fire. The scheduler wakes
+ * no later than the earliest deadline plus slack of any task, and fires every timeout whose
+ * deadline has passed by then, so that timeouts falling within one another's slack share a single
+ * wakeup. Timeouts never fire early; IO_SCHEDULER_NO_SLACK has them fire as close to their
+ * deadlines as the scheduler can.
  **/
 p_io_scheduler_task_t io_sched_create_task ( p_io_scheduler_t scheduler,
                                              fd_t fd,
                                              io_task_opts_t opts,
                                              int64_t time_out,
+                                             int64_t slack,
                                              void * user_data,
                                              io_scheduler_cbk_t read_cbk,
                                              io_scheduler_cbk_t write_cbk,
@@ -179,9 +720,10 @@ p_io_scheduler_task_t io_sched_create_task ( p_io_scheduler_t scheduler,
 
 /**
  * Creates a task that will execute after the specified amount of time; no file descriptor is provided.
+ * The slack is as for io_sched_create_task().
  **/
 p_io_scheduler_task_t io_sched_create_timer_task ( p_io_scheduler_t scheduler,
-                                                   int64_t time_out, void * user_data,
+                                                   int64_t time_out, int64_t slack, void * user_data,
                                                    io_scheduler_cbk_t time_out_cbk );
 
 /**
@@ -197,11 +739,109 @@ p_io_scheduler_task_t io_sched_create_writer_task ( p_io_scheduler_t scheduler,
  **/
 void io_sched_destroy_scheduler ( p_io_scheduler_t scheduler );
 
+/**
+ * Shuts the scheduler down cooperatively: new tasks are refused from here on, while the tasks
+ * already scheduled (and any submitted from other threads) are left to run to completion. Once
+ * none are left, or time_out nanoseconds have passed (negative to wait as long as it takes), the
+ * loop is told to stop and its thread joined; the loop only ever stops between callbacks, never in
+ * the middle of one. Each task still pending at that point is logged, handed to pending_fn (if
+ * given, with the scheduler's task list locked, so it must not call back into the scheduler), and
+ * unscheduled.
+ *
+ * Stop accepting new work (listeners and the like) before draining; anything that keeps a task
+ * scheduled for good holds the drain up until the time out.
+ * @return The number of tasks that were still pending.
+ **/
+size_t io_sched_drain_scheduler ( p_io_scheduler_t scheduler, int64_t time_out,
+                                  io_sched_pending_fn_t pending_fn, void * arg );
+
 /**
  * Locates a task in the scheduler based on its file descriptor / timer ID.
  **/
 p_io_scheduler_task_t io_sched_find_task ( p_io_scheduler_t scheduler, fd_t fd );
 
+/**
+ * Locates a task in the scheduler by its handle; returns NULL when the handle is stale (the task
+ * has since been released) or does not belong to this scheduler. The task may complete at any time
+ * after this returns, so outside the scheduler's own thread prefer io_sched_unschedule_handle().
+ **/
+p_io_scheduler_task_t io_sched_find_task_by_handle ( p_io_scheduler_t scheduler, io_sched_handle_t handle );
+
+/**
+ * Reports the usage of the scheduler's task slab and timer ID pool, into either of tasks and
+ * timers that is not NULL; the high watermarks show what the pools ought to be sized for up front.
+ * Returns false if there is no scheduler.
+ **/
+bool_t io_sched_get_capacity ( p_io_scheduler_t scheduler, io_sched_capacity_t * tasks, io_sched_capacity_t * timers );
+
+/**
+ * Returns the most reads or writes an edge-triggered callback on this scheduler should make in
+ * one pass before handing over with io_sched_continue_task(); zero when there is no limit.
+ **/
+size_t io_sched_get_edge_batch ( p_io_scheduler_t scheduler );
+
+/**
+ * Takes a snapshot of the scheduler's instrumentation. The loop carries on updating it while it
+ * is copied, so figures may be a callback or so apart from one another. Returns false, leaving
+ * stats untouched, if the scheduler was not created with collect_stats set.
+ **/
+bool_t io_sched_get_stats ( p_io_scheduler_t scheduler, io_sched_stats_t * stats );
+
+/**
+ * Returns the number of tasks currently in the scheduler, including those waiting to be released.
+ **/
+size_t io_sched_get_task_count ( p_io_scheduler_t scheduler );
+
+/**
+ * Returns the smallest duration, in nanoseconds, that falls in the given histogram bucket.
+ **/
+uint64_t io_sched_histogram_bucket_floor ( size_t bucket );
+
+/**
+ * Returns an estimate of the given percentile (0 to 100) of the durations in a histogram, in
+ * nanoseconds: the top of the bucket the percentile falls in, or the largest duration seen when
+ * that is smaller. Zero for an empty histogram.
+ **/
+uint64_t io_sched_histogram_percentile ( const io_sched_histogram_t * hist, double percentile );
+
+/**
+ * Returns the task's handle, for finding or unscheduling it later without risk of reaching some
+ * other task that has since taken its place.
+ **/
+io_sched_handle_t io_sched_get_task_handle ( p_io_scheduler_task_t io_task );
+
+/**
+ * Returns the scheduler's clock reading, in nanoseconds, as of the current pass through its loop;
+ * timeouts are measured against the same reading, so callbacks wanting the time should use this
+ * rather than reading a clock themselves. Before the loop is running, the clock is read afresh.
+ **/
+int64_t io_sched_now ( p_io_scheduler_t scheduler );
+
+/**
+ * Hands work for a task off to the scheduler's worker pool, from within one of the task's own
+ * callbacks: work_fn is run on a worker thread, and done_fn (if given) is then called with its
+ * result back on the scheduler's thread, where writes for the task can safely be made. Until
+ * then, the task is neither watched for readiness nor timed out; its timeout starts over once
+ * done_fn has returned. The workers steal from one another, so one long job does not hold up
+ * the rest.
+ *
+ * The callback should return IO_SCHEDULER_TASK_INCOMPLETE after offloading; done_fn decides
+ * whether the task completes. Should the task be unscheduled in the meantime, done_fn is still
+ * called (so that it can release the result), but its return is ignored. Work not yet started
+ * when the scheduler is destroyed is handed back with a NULL result, without being run.
+ *
+ * Returns false, leaving the task as it was, if the scheduler has no workers (num_workers) or
+ * the task cannot be suspended; the caller then does the work itself.
+ **/
+bool_t io_sched_offload ( p_io_scheduler_task_t io_task, io_sched_work_fn_t work_fn, io_sched_done_fn_t done_fn, void * arg );
+
+/**
+ * Queues a call to fn(scheduler, arg) to be made from the scheduler loop, at the top of its next
+ * pass; safe to use from any thread. Calls still queued when the scheduler is destroyed are
+ * discarded without being made. Returns false if the call could not be queued.
+ **/
+bool_t io_sched_post ( p_io_scheduler_t scheduler, io_sched_post_fn_t fn, void * arg );
+
 /**
  * Reschedules a task, essentially updating its expiration time.
  **/
@@ -213,10 +853,21 @@ bool_t io_sched_reschedule_task ( p_io_scheduler_task_t io_task );
 void io_sched_run_scheduler ( p_io_scheduler_t scheduler );
 
 /**
- * Adds a task to the IO scheduler.
+ * Adds a task to the IO scheduler. When called from another thread while the scheduler loop is
+ * running, the task is queued for the loop to add, and true is returned straight away. Should the
+ * loop then fail to add it, the task's error callback (or, without one, the first of its read,
+ * write and timeout callbacks) is called with IO_SCHEDULER_ERR_NOT_SCHEDULED, from the scheduler's
+ * thread, and the task is released once that returns. Returns false once the scheduler is draining.
  **/
 bool_t io_sched_schedule_task ( p_io_scheduler_task_t io_task );
 
+/**
+ * Sets the priority class a task is dispatched in. Best done before the task is scheduled, or
+ * else from one of its own callbacks; a task already waiting to be dispatched is dispatched in
+ * the class it was waiting in.
+ **/
+void io_sched_set_task_priority ( p_io_scheduler_task_t io_task, io_sched_priority_t priority );
+
 /**
  * Runs the specified scheduler in a secondary thread of execution.
  * @return True if able to successfully start the scheduler; otherwise, false.
@@ -224,12 +875,34 @@ bool_t io_sched_schedule_task ( p_io_scheduler_task_t io_task );
 bool_t io_sched_start_scheduler_thread ( p_io_scheduler_t scheduler );
 
 /**
- * Tells the specified scheduler it should stop processing its tasks.
+ * Runs the specified scheduler in a secondary thread of execution with the given settings (which
+ * are copied); NULL for the defaults, just as io_sched_start_scheduler_thread().
+ * @return True if able to successfully start the scheduler; otherwise, false.
+ **/
+bool_t io_sched_start_scheduler_thread_ex ( p_io_scheduler_t scheduler, const io_sched_thread_attr_t * attr );
+
+/**
+ * Tells the specified scheduler it should stop processing its tasks, unscheduling all of them.
+ * Unless called from the scheduler's own thread, waits for its thread to finish the callback in
+ * progress (if any) and end. For letting the tasks finish first, see io_sched_drain_scheduler().
  **/
 void io_sched_stop_scheduler ( p_io_scheduler_t scheduler );
 
 /**
- * Tells the IO scheduler to remove the task the next time through its loop.
+ * Fills in scheduler thread settings with the defaults: no name, the system's stack size and
+ * policy, any CPU, and memory left unlocked.
+ **/
+void io_sched_thread_attr_init ( io_sched_thread_attr_t * attr );
+
+/**
+ * Tells the IO scheduler to remove the task with the given handle, if it is still there; returns
+ * false when the handle is stale. Otherwise just like io_sched_unschedule_task().
+ **/
+bool_t io_sched_unschedule_handle ( p_io_scheduler_t scheduler, io_sched_handle_t handle );
+
+/**
+ * Tells the IO scheduler to remove the task the next time through its loop. None of the task's
+ * callbacks are made once this returns (other than one already in progress in the loop thread).
  **/
 void io_sched_unschedule_task ( p_io_scheduler_task_t io_task );
 
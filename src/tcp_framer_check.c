@@ -0,0 +1,132 @@
+/**
+ * @file    tcp_framer_check.c
+ *
+ * Standalone check of the TCP framers: feeds byte streams to tcp_framer_feed() in the pieces a
+ * connection might read them in, and compares the frames delivered with those expected. The
+ * framing functions are local to tcp_service.c, which is therefore built in here whole rather
+ * than taken from the library. Exits non-zero should any case fail.
+ **/
+
+#include "tcp_service.c"
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local types                      */
+/* ---------- ---------- ---------- */
+
+/* The frames delivered so far, each followed by a '|'. */
+typedef struct _check_frames {
+  char                                  text[256];
+  size_t                                length;
+  int                                   count;
+} check_frames_t, * p_check_frames_t;
+
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local functions                  */
+/* ---------- ---------- ---------- */
+
+static int
+check_deliver ( void * ctx, char * data, size_t length )
+{
+  p_check_frames_t frames = (p_check_frames_t) ctx;
+  
+  if ( frames->length + length + 1 < sizeof( frames->text ) ) {
+    memcpy ( frames->text + frames->length, data, length );
+    frames->length += length;
+    frames->text[ frames->length++ ] = '|';
+    frames->text[ frames->length ] = '\0';
+  }
+  frames->count++;
+  return TCP_FEED_MORE;
+}
+
+/**
+ * Feeds the reads (lengths given, zero-terminated) one after another, and checks what came of
+ * them: the frames delivered, the result of the last feed, and the bytes left in the ring.
+ **/
+static bool_t
+check_feed ( const char * name, const tcp_framer_t * framer, const char * stream, const size_t * reads,
+             const char * frames_expected, int rc_expected, size_t left_expected )
+{
+  check_frames_t frames;
+  tcp_frame_ring_t ring;
+  char data[256];
+  size_t idx, offset = 0;
+  int rc = TCP_FEED_MORE;
+  bool_t ok;
+  
+  memset ( &frames, 0, sizeof( frames ) );
+  memset ( &ring, 0, sizeof( ring ) );
+  for ( idx = 0; reads[idx] && ( rc == TCP_FEED_MORE ); idx++ ) {
+    // Each read lands in a buffer of its own, as it would off the socket.
+    memcpy ( data, stream + offset, reads[idx] );
+    offset += reads[idx];
+    rc = tcp_framer_feed ( framer, &ring, data, reads[idx], check_deliver, (void*) &frames );
+  }
+  
+  ok = ( strcmp ( frames.text, frames_expected ) == 0 ) && ( rc == rc_expected ) && ( ring.count == left_expected );
+  printf ( "%s %s: frames \"%s\" rc %d left %lu\n", ok ? "ok  " : "FAIL", name, frames.text, rc,
+           (unsigned long) ring.count );
+  tcp_frame_ring_clear ( &ring );
+  return ok;
+}
+
+int
+main ( int argc, char * argv[] )
+{
+  static const size_t delimiter_reads[] = { 4, 8, 0 };
+  static const size_t prefix_reads[] = { 1, 11, 0 };
+  static const size_t several_reads[] = { 14, 0 };
+  static const size_t overflow_reads[] = { 4, 0 };
+  static const size_t run_on_reads[] = { 6, 6, 0 };
+  static const size_t fixed_reads[] = { 3, 4, 5, 0 };
+  tcp_framer_t delimiter, prefix, fixed;
+  tcp_frame_ring_t ring;
+  tcp_frame_scan_t scan;
+  bool_t ok = CMNUTIL_TRUE;
+  
+  (void) argc;
+  (void) argv;
+  tcp_framer_init_delimiter ( &delimiter, "\r\n", 2, 8 );
+  tcp_framer_init_length_prefix ( &prefix, 2, 8 );
+  tcp_framer_init_fixed ( &fixed, 10 );
+  
+  // A delimiter split across reads: the ring holds "abc\r", and takes only the "\n" that ends it.
+  memset ( &ring, 0, sizeof( ring ) );
+  tcp_frame_ring_append ( &ring, "abc\r", 4 );
+  ring.scanned = ring.count;
+  if ( tcp_frame_ring_wanted ( &delimiter, &ring, "\ndef\r\n", 6 ) != 1 ) {
+    printf ( "FAIL delimiter split: tcp_frame_ring_wanted() took more than the delimiter's last byte\n" );
+    ok = CMNUTIL_FALSE;
+  }
+  tcp_frame_ring_clear ( &ring );
+  ok &= check_feed ( "delimiter split", &delimiter, "abc\r\ndef\r\ngh", delimiter_reads, "abc|def|", TCP_FEED_MORE, 2 );
+  
+  // A length prefix split inside the prefix itself.
+  ok &= check_feed ( "prefix split", &prefix, "\x00\x05hello\x00\x02hi\x00", prefix_reads, "hello|hi|",
+                     TCP_FEED_MORE, 1 );
+  
+  // Several frames in one read, none of them touching the ring.
+  ok &= check_feed ( "several frames", &delimiter, "a\r\nbb\r\nccc\r\ndd", several_reads, "a|bb|ccc|", TCP_FEED_MORE, 2 );
+  
+  // Frames larger than max_frame are malformed, whether their length says so or no delimiter turns up in time.
+  memset ( &scan, 0, sizeof( scan ) );
+  if ( prefix.scan ( &prefix, "\x00\x09", 2, &scan ) != TCP_FRAME_MALFORMED ) {
+    printf ( "FAIL overflow: tcp_framer_scan_length_prefix() took a 9-byte payload over an 8-byte max_frame\n" );
+    ok = CMNUTIL_FALSE;
+  }
+  ok &= check_feed ( "prefix overflow", &prefix, "\x01\x00zz", overflow_reads, "", TCP_FEED_FAILED, 0 );
+  ok &= check_feed ( "delimiter overflow", &delimiter, "abcdefghijkl", run_on_reads, "", TCP_FEED_FAILED, 12 );
+  
+  // A fixed-size record spanning three reads, the ring taking no more of the last than it needs.
+  memset ( &ring, 0, sizeof( ring ) );
+  tcp_frame_ring_append ( &ring, "abcdefg", 7 );
+  ring.needed = 10;
+  if ( tcp_frame_ring_wanted ( &fixed, &ring, "hijXY", 5 ) != 3 ) {
+    printf ( "FAIL fixed over three: tcp_frame_ring_wanted() took more than the record's last 3 bytes\n" );
+    ok = CMNUTIL_FALSE;
+  }
+  tcp_frame_ring_clear ( &ring );
+  ok &= check_feed ( "fixed over three", &fixed, "abcdefghijXY", fixed_reads, "abcdefghij|", TCP_FEED_MORE, 2 );
+  
+  return ok ? 0 : 1;
+}
@@ -16,6 +16,27 @@
 /* Shared (global) variables        */
 /* ---------- ---------- ---------- */
 
+/* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
+/* Local types                      */
+/* ---------- ---------- ---------- */
+
+/* What handing data to the application, and framing it on the way, came to. */
+#define TCP_FEED_FAILED                 -1      /* malformed frame, or out of memory */
+#define TCP_FEED_MORE                   0       /* ready for more data */
+#define TCP_FEED_CLOSE                  1       /* the callback asked for the connection to be closed */
+#define TCP_FEED_GONE                   2       /* the callback stopped or dropped the connection itself */
+
+typedef int ( *tcp_frame_deliver_t ) ( void * ctx, char * data, size_t length );
+
+/* A call made on a scheduler's own thread, which the caller waits for; see tcp_sched_call(). */
+typedef struct _tcp_sched_call {
+  io_sched_post_fn_t                    fn;
+  void *                                arg;
+  pthread_mutex_t                       mutex;
+  pthread_cond_t                        cond;
+  volatile bool_t                       done;
+} tcp_sched_call_t, * p_tcp_sched_call_t;
+
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 /* Local function prototypes        */
 /* ---------- ---------- ---------- */
@@ -29,16 +50,261 @@ static bool_t on_tcp_listener_client_request ( p_io_scheduler_task_t task, int e
 // I/O scheduler read callback: when listener socket becomes "read" ready, a client is waiting.
 static bool_t on_tcp_listener_client_waiting ( p_io_scheduler_task_t task, int errcode );
 
+// I/O scheduler write callbacks: the client's socket has room for more of its queued data.
+static bool_t on_tcp_client_writable ( p_io_scheduler_task_t task, int errcode );
+
+static bool_t on_tcp_remote_client_writable ( p_io_scheduler_task_t task, int errcode );
+
+static void tcp_buffer_pool_free ( p_tcp_buffer_pool_t pool );
+
+// Hand one read's worth of data, or one frame's payload, to the application's callback.
+static int tcp_client_deliver ( void * ctx, char * data, size_t length );
+
+static bool_t tcp_frame_ring_append ( p_tcp_frame_ring_t ring, const char * data, size_t length );
+
+static void tcp_frame_ring_clear ( p_tcp_frame_ring_t ring );
+
+static void tcp_frame_ring_consume ( p_tcp_frame_ring_t ring, size_t length );
+
+static bool_t tcp_frame_ring_linearize ( p_tcp_frame_ring_t ring );
+
+static size_t tcp_frame_ring_wanted ( const tcp_framer_t * framer, p_tcp_frame_ring_t ring, const char * data, size_t length );
+
+static int tcp_framer_feed ( const tcp_framer_t * framer, p_tcp_frame_ring_t ring, char * data, size_t length,
+                             tcp_frame_deliver_t deliver, void * ctx );
+
+static int tcp_framer_scan_delimiter ( const tcp_framer_t * framer, const char * data, size_t length,
+                                       tcp_frame_scan_t * scan );
+
+static int tcp_framer_scan_fixed ( const tcp_framer_t * framer, const char * data, size_t length,
+                                   tcp_frame_scan_t * scan );
+
+static int tcp_framer_scan_length_prefix ( const tcp_framer_t * framer, const char * data, size_t length,
+                                           tcp_frame_scan_t * scan );
+
+static void tcp_listener_close_shards ( p_tcp_listener_t listener );
+
 static void tcp_listener_drop_client ( p_tcp_listener_t listener, p_tcp_remote_client_t remcli );
 
+static bool_t tcp_listener_open_shards ( p_tcp_listener_t listener, p_io_sched_group_t group );
+
+static void tcp_listener_recycle_client ( p_tcp_listener_t listener, p_tcp_remote_client_t remcli );
+
+static p_tcp_remote_client_t tcp_listener_reuse_client ( p_tcp_listener_t listener );
+
+static void tcp_listener_stop_shards ( p_tcp_listener_t listener );
+
+static void tcp_listener_sweep_clients ( p_io_scheduler_t scheduler, void * arg );
+
+static void tcp_listener_take_client ( p_tcp_listener_t listener, p_io_scheduler_task_t task,
+                                       sock_fd_t fd, in_addr_t rem_ip, uint16_t rem_port );
+
+static void tcp_listener_unshard ( p_tcp_listener_t listener );
+
+static bool_t tcp_out_queue_append ( p_tcp_out_queue_t queue, const char * data, size_t length );
+
+static void tcp_out_queue_clear ( p_tcp_out_queue_t queue, p_io_scheduler_t scheduler );
+
+static int tcp_out_queue_flush ( p_tcp_out_queue_t queue, sock_fd_t fd );
+
+static void tcp_out_queue_release ( p_tcp_out_queue_t queue, p_tcp_out_chunk_t chunk );
+
+static bool_t tcp_out_queue_send ( p_tcp_out_queue_t queue, p_io_scheduler_t scheduler, sock_fd_t fd,
+                                   const void * data, size_t length, io_sched_priority_t priority,
+                                   void * user_data, io_scheduler_cbk_t write_cbk );
+
+static int tcp_remote_client_deliver ( void * ctx, char * data, size_t length );
+
+static p_tcp_remote_client_t tcp_remote_client_init_on ( p_tcp_listener_t owner, p_io_scheduler_t scheduler,
+                                                         sock_fd_t fd, in_addr_t rem_ip, uint16_t rem_port );
+
+static void tcp_remote_client_release ( p_tcp_remote_client_t remcli );
+
+static bool_t tcp_read_frame_borrow ( p_tcp_buffer_pool_t pool, p_tcp_buffer_t * frame );
+
+static void tcp_read_frame_return ( p_tcp_buffer_t * frame );
+
+static void tcp_sched_call ( p_io_scheduler_t scheduler, io_sched_post_fn_t fn, void * arg );
+
+static void tcp_sched_call_made ( p_io_scheduler_t scheduler, void * arg );
+
+static void tcp_sched_unschedule ( p_io_scheduler_t scheduler, void * arg );
+
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 /* Module variables      */
 /* ---------- ---------- */
 
+/* Smallest chunk allocated for queued outgoing data; small sends are packed together into one. */
+#define TCP_OUT_CHUNK_SIZE              4096
+
+/* Most chunks handed to the socket in one scatter-gather write. */
+#define TCP_OUT_QUEUE_MAX_IOV           64
+
+/* Smallest allocation of a frame ring, which doubles from there as a frame needs. */
+#define TCP_FRAME_RING_MIN_SIZE         1024
+
+/* Shared buffer pools, one for each power of two from TCP_BUFFER_POOL_MIN_SHARED up to
+   TCP_BUFFER_POOL_MAX_SHARED; created on first use, and kept for the life of the process. */
+#define TCP_BUFFER_POOL_NUM_SHARED      8
+
+static p_tcp_buffer_pool_t shared_buffer_pools[TCP_BUFFER_POOL_NUM_SHARED];
+static pthread_mutex_t mutex_shared_buffer_pools = PTHREAD_MUTEX_INITIALIZER;
+
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 /* Exposed functions     */
 /* ---------- ---------- */
 
+//////////////////////////////////////////////////////////////////////////////////////////
+//// tcp_buffer_pool
+//////////////////////////////////////////////////////////////////////////////////////////
+
+p_tcp_buffer_pool_t
+tcp_buffer_pool_create ( size_t buffer_size, size_t max_idle )
+{
+  p_tcp_buffer_pool_t rv;
+  
+  if ( !( buffer_size ) ) {
+    LOGSVC_DEBUG( "tcp_buffer_pool_create(): Buffer size not given." );
+    return NIL_tcp_buffer_pool;
+  }
+  
+  rv = (p_tcp_buffer_pool_t) malloc ( sizeof( tcp_buffer_pool_t ) );
+  if ( rv ) {
+    memset ( rv, 0, sizeof( tcp_buffer_pool_t ) );
+    pthread_mutex_init ( &( rv->mutex ), (const pthread_mutexattr_t*) 0 );
+    rv->buffer_size = buffer_size;
+    rv->max_idle = max_idle;
+  }
+  else {
+    LOGSVC_ERROR( "tcp_buffer_pool_create(): Unable to allocate buffer pool." );
+  }
+  return rv;
+}
+
+void
+tcp_buffer_pool_destroy ( p_tcp_buffer_pool_t pool )
+{
+  p_tcp_buffer_t buffer;
+  bool_t done;
+  
+  if ( !( pool ) || pool->shared )
+    return;
+  
+  // Buffers still on loan hand the pool itself back along with the last of them.
+  LOCK_MUTEX( pool->mutex );
+  pool->destroyed = CMNUTIL_TRUE;
+  while ( ( buffer = pool->idle ) ) {
+    pool->idle = buffer->next;
+    free ( buffer );
+  }
+  pool->num_idle = 0;
+  done = ( pool->num_out == 0 );
+  UNLOCK_MUTEX( pool->mutex );
+  
+  if ( done )
+    tcp_buffer_pool_free ( pool );
+  else
+    LOGSVC_DEBUG( "tcp_buffer_pool_destroy(): %lu buffers still on loan; pool freed once they are back.",
+                  (unsigned long) pool->num_out );
+}
+
+p_tcp_buffer_t
+tcp_buffer_pool_get ( p_tcp_buffer_pool_t pool )
+{
+  p_tcp_buffer_t rv;
+  
+  assert ( pool );
+  assert ( !( pool->destroyed ) );
+  
+  LOCK_MUTEX( pool->mutex );
+  rv = pool->idle;
+  if ( rv ) {
+    pool->idle = rv->next;
+    pool->num_idle--;
+  }
+  pool->num_out++;
+  if ( pool->num_out > pool->high_watermark )
+    pool->high_watermark = pool->num_out;
+  UNLOCK_MUTEX( pool->mutex );
+  
+  if ( !( rv ) ) {
+    rv = (p_tcp_buffer_t) malloc ( sizeof( tcp_buffer_t ) + pool->buffer_size );
+    if ( !( rv ) ) {
+      LOGSVC_ERROR( "tcp_buffer_pool_get(): Unable to allocate %lu-byte buffer.", (unsigned long) pool->buffer_size );
+      LOCK_MUTEX( pool->mutex );
+      pool->num_out--;
+      UNLOCK_MUTEX( pool->mutex );
+      return NIL_tcp_buffer;
+    }
+    rv->pool = pool;
+    rv->size = pool->buffer_size;
+  }
+  rv->next = NIL_tcp_buffer;
+  rv->refs = 1;
+  return rv;
+}
+
+p_tcp_buffer_pool_t
+tcp_buffer_pool_shared ( size_t buffer_size )
+{
+  p_tcp_buffer_pool_t rv;
+  size_t size = TCP_BUFFER_POOL_MIN_SHARED;
+  unsigned int idx = 0;
+  
+  if ( buffer_size > TCP_BUFFER_POOL_MAX_SHARED ) {
+    LOGSVC_DEBUG( "tcp_buffer_pool_shared(): No shared pool of %lu-byte buffers.", (unsigned long) buffer_size );
+    return NIL_tcp_buffer_pool;
+  }
+  while ( size < buffer_size ) {
+    size <<= 1;
+    idx++;
+  }
+  
+  LOCK_MUTEX( mutex_shared_buffer_pools );
+  if ( !( shared_buffer_pools[idx] ) ) {
+    shared_buffer_pools[idx] = tcp_buffer_pool_create ( size, TCP_BUFFER_POOL_SHARED_IDLE );
+    if ( shared_buffer_pools[idx] )
+      shared_buffer_pools[idx]->shared = CMNUTIL_TRUE;
+  }
+  rv = shared_buffer_pools[idx];
+  UNLOCK_MUTEX( mutex_shared_buffer_pools );
+  
+  return rv;
+}
+
+void
+tcp_buffer_release ( p_tcp_buffer_t buffer )
+{
+  p_tcp_buffer_pool_t pool;
+  bool_t done;
+  
+  if ( !( buffer ) || ( __sync_sub_and_fetch ( &( buffer->refs ), 1 ) > 0 ) )
+    return;
+  
+  pool = buffer->pool;
+  LOCK_MUTEX( pool->mutex );
+  pool->num_out--;
+  if ( !( pool->destroyed ) && ( pool->num_idle < pool->max_idle ) ) {
+    buffer->next = pool->idle;
+    pool->idle = buffer;
+    pool->num_idle++;
+    buffer = NIL_tcp_buffer;
+  }
+  done = ( pool->destroyed && ( pool->num_out == 0 ) );
+  UNLOCK_MUTEX( pool->mutex );
+  
+  free ( buffer );
+  if ( done )
+    tcp_buffer_pool_free ( pool );
+}
+
+void
+tcp_buffer_retain ( p_tcp_buffer_t buffer )
+{
+  if ( buffer )
+    __sync_fetch_and_add ( &( buffer->refs ), 1 );
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////
 //// tcp_client
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -87,10 +353,15 @@ tcp_client_disconnect ( p_tcp_client_t client )
   // We are disconnecting from the server, rather than handling the server closing its side of the socket.
   if ( client ) {
     if ( client->io_task ) {
-      // Remember to unschedule the I/O task since we are closing the socket.
-      io_sched_unschedule_task ( client->io_task );
+      // Remember to unschedule the I/O task since we are closing the socket. Going through the
+      // handle means a task that has already completed (and been recycled) is left alone.
+      io_sched_unschedule_handle ( client->io_scheduler, client->io_task_handle );
       client->io_task = NIL_IO_SCHEDULER_TASK;
+      client->io_task_handle = IO_SCHEDULER_INVALID_HANDLE;
     }
+    tcp_out_queue_clear ( &( client->out_queue ), client->io_scheduler );
+    tcp_read_frame_return ( &( client->read_frame ) );
+    tcp_frame_ring_clear ( &( client->frame_ring ) );
     if ( client->fd != INVALID_SOCKET_FD ) {
       LOGSVC_DEBUG( "Closing socket connected to %s:%d", client->remote_ip_str, client->remote_port );
       close ( client->fd );
@@ -112,21 +383,41 @@ tcp_client_init ( const char * rem_ip_str, uint16_t rem_port, size_t buffer_size
     rv->remote_port = rem_port;
     inet_aton ( rem_ip_str, (struct in_addr*)(void*) &( rv->remote_ip ) ); // check return value??
     
-    rv->read_buffer_size = ( buffer_size > 0 ) ? buffer_size : 512; // default buffer size??
-    rv->read_buffer = (char*) malloc ( rv->read_buffer_size );
-    if ( !( rv->read_buffer ) ) {
-      LOGSVC_ERROR( "tcp_client_init(): Unable to allocate read buffer." );
-      free ( rv );
-      return NIL_tcp_client;
+    // The read buffer is borrowed from the shared pool while there is data to read; only a size
+    // too large for any shared pool gets a buffer of its own.
+    rv->read_buffer_size = ( buffer_size > 0 ) ? buffer_size : TCP_SERVICE_DEFAULT_READ_SIZE;
+    rv->buffer_pool = tcp_buffer_pool_shared ( rv->read_buffer_size );
+    if ( !( rv->buffer_pool ) ) {
+      rv->read_buffer = (char*) malloc ( rv->read_buffer_size );
+      if ( !( rv->read_buffer ) ) {
+        LOGSVC_ERROR( "tcp_client_init(): Unable to allocate read buffer." );
+        free ( rv );
+        return NIL_tcp_client;
+      }
     }
     
     rv->user_data = client_userdata;
+    rv->priority = IO_SCHEDULER_PRIORITY_INTERACTIVE;
     
     // Callbacks need to be set up by caller of tcp_client_init().
   }
   return rv;
 }
 
+bool_t
+tcp_client_send ( p_tcp_client_t client, const void * data, size_t length )
+{
+  assert ( client );
+  
+  if ( client->fd == INVALID_SOCKET_FD ) {
+    LOGSVC_DEBUG( "tcp_client_send(): Not connected to '%s:%d'.", client->remote_ip_str, client->remote_port );
+    return CMNUTIL_FALSE;
+  }
+  
+  return tcp_out_queue_send ( &( client->out_queue ), client->io_scheduler, client->fd, data, length,
+                              client->priority, (void*) client, on_tcp_client_writable );
+}
+
 bool_t
 tcp_client_start ( p_tcp_client_t client, p_io_scheduler_t scheduler )
 {
@@ -136,9 +427,13 @@ tcp_client_start ( p_tcp_client_t client, p_io_scheduler_t scheduler )
   
   LOGSVC_DEBUG( "tcp_client_start(): Starting I/O handler for '%s:%d' ...", client->remote_ip_str, client->remote_port );
   client->io_task =
-    io_sched_create_reader_task ( scheduler,
-                                  client->fd, IO_SCHEDULER_NO_TIMEOUT, (void*) client,
-                                  on_tcp_client_server_responded );
+    io_sched_create_task ( scheduler,
+                           client->fd, IO_SCHEDULER_READ | IO_SCHEDULER_EDGE, IO_SCHEDULER_NO_TIMEOUT, IO_SCHEDULER_NO_SLACK, (void*) client,
+                           on_tcp_client_server_responded,
+                           NIL_IO_SCHEDULER_CBK, NIL_IO_SCHEDULER_CBK, NIL_IO_SCHEDULER_CBK );
+  io_sched_set_task_priority ( client->io_task, client->priority );
+  client->io_scheduler = scheduler;
+  client->io_task_handle = io_sched_get_task_handle ( client->io_task );
   
   return io_sched_schedule_task ( client->io_task );
 }
@@ -149,10 +444,68 @@ tcp_client_stop ( p_tcp_client_t client )
   if ( client ) {
     if ( client->io_task ) {
       LOGSVC_DEBUG( "tcp_client_stop(): Stopping I/O handler for '%s:%d' ...", client->remote_ip_str, client->remote_port );
-      io_sched_unschedule_task ( client->io_task );
+      io_sched_unschedule_handle ( client->io_scheduler, client->io_task_handle );
       client->io_task = NIL_IO_SCHEDULER_TASK;
+      client->io_task_handle = IO_SCHEDULER_INVALID_HANDLE;
     }
+    tcp_out_queue_clear ( &( client->out_queue ), client->io_scheduler );
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//// tcp_framer
+//////////////////////////////////////////////////////////////////////////////////////////
+
+bool_t
+tcp_framer_init_delimiter ( tcp_framer_t * framer, const char * delimiter, size_t delimiter_length, size_t max_frame )
+{
+  assert ( framer );
+  
+  if ( !( delimiter ) || !( delimiter_length ) || ( delimiter_length > TCP_FRAMER_MAX_DELIMITER ) ) {
+    LOGSVC_DEBUG( "tcp_framer_init_delimiter(): Delimiter of %lu bytes not supported.", (unsigned long) delimiter_length );
+    return CMNUTIL_FALSE;
+  }
+  
+  memset ( framer, 0, sizeof( tcp_framer_t ) );
+  framer->scan = tcp_framer_scan_delimiter;
+  framer->max_frame = max_frame ? max_frame : TCP_FRAMER_DEFAULT_MAX_FRAME;
+  memcpy ( framer->delimiter, delimiter, delimiter_length );
+  framer->delimiter_length = delimiter_length;
+  return CMNUTIL_TRUE;
+}
+
+bool_t
+tcp_framer_init_fixed ( tcp_framer_t * framer, size_t record_size )
+{
+  assert ( framer );
+  
+  if ( !( record_size ) ) {
+    LOGSVC_DEBUG( "tcp_framer_init_fixed(): Record size not given." );
+    return CMNUTIL_FALSE;
+  }
+  
+  memset ( framer, 0, sizeof( tcp_framer_t ) );
+  framer->scan = tcp_framer_scan_fixed;
+  framer->max_frame = record_size;
+  framer->record_size = record_size;
+  return CMNUTIL_TRUE;
+}
+
+bool_t
+tcp_framer_init_length_prefix ( tcp_framer_t * framer, size_t prefix_size, size_t max_frame )
+{
+  assert ( framer );
+  
+  if ( ( prefix_size != 1 ) && ( prefix_size != 2 ) && ( prefix_size != 4 ) && ( prefix_size != 8 ) ) {
+    LOGSVC_DEBUG( "tcp_framer_init_length_prefix(): Prefix of %lu bytes not supported.", (unsigned long) prefix_size );
+    return CMNUTIL_FALSE;
   }
+  
+  memset ( framer, 0, sizeof( tcp_framer_t ) );
+  framer->scan = tcp_framer_scan_length_prefix;
+  framer->max_frame = max_frame ? max_frame : TCP_FRAMER_DEFAULT_MAX_FRAME;
+  framer->prefix_size = prefix_size;
+  return CMNUTIL_TRUE;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////
@@ -174,11 +527,19 @@ tcp_listener_destroy ( p_tcp_listener_t listener )
     
     // Close up the listening socket, get rid of our clients list & mutex, and free up our instance.
     if ( listener->fd != INVALID_SOCKET_FD ) {
-      sockmgr_close_tcp ( listener->fd );
+      if ( listener->num_shards )
+        tcp_listener_close_shards ( listener );
+      else
+        sockmgr_close_tcp ( listener->fd );
       if ( listener->on_closed )
         listener->on_closed ( listener );
     }
     tcp_remote_client_destroy ( listener->clients );
+    while ( listener->idle_clients ) {
+      p_tcp_remote_client_t idle = listener->idle_clients;
+      listener->idle_clients = idle->next;
+      free ( idle );
+    }
     pthread_mutex_destroy ( &( listener->clients_list_mutex ) );
     free ( listener );
   }
@@ -203,6 +564,14 @@ tcp_listener_init ( uint16_t port, void * listener_userdata )
     rv->clients->next = rv->clients->prev = rv->clients; // circular list; empty when (HEAD->n == HEAD->p == HEAD)
     pthread_mutex_init ( &( rv->clients_list_mutex ), (const pthread_mutexattr_t*) 0 );
     rv->user_data = listener_userdata;
+    rv->priority = IO_SCHEDULER_PRIORITY_INTERACTIVE;
+    rv->max_idle_clients = TCP_LISTENER_DEFAULT_IDLE_CLIENTS;
+    rv->buffer_pool = tcp_buffer_pool_shared ( TCP_SERVICE_DEFAULT_READ_SIZE );
+    if ( !( rv->buffer_pool ) ) {
+      LOGSVC_ERROR( "tcp_listener_init(): No read buffer pool for listener on port %d.", port );
+      tcp_listener_destroy ( rv );
+      return NIL_tcp_listener;
+    }
   }
   return rv;
 }
@@ -216,18 +585,25 @@ tcp_listener_start ( p_tcp_listener_t listener, p_io_scheduler_t scheduler )
   }
   
   // We want to create a reader task to watch the listener socket for incoming connections. These will show up
-  // as the socket being "read ready" when checked by select().
+  // as the socket being "read ready" when checked by select(). Each time it is, as many as are waiting get accepted
+  // (up to the budget), and the last accept() has to find the socket non-blocking.
   //
+  tcp_set_socket_nonblocking ( listener->fd, CMNUTIL_TRUE );
   listener->io_task =
     io_sched_create_reader_task ( scheduler,
                                   listener->fd, IO_SCHEDULER_NO_TIMEOUT, (void*) listener,
                                   on_tcp_listener_client_waiting );
+  io_sched_set_task_priority ( listener->io_task, listener->priority );
+  listener->io_scheduler = scheduler;
+  listener->io_task_handle = io_sched_get_task_handle ( listener->io_task );
   if ( !( io_sched_schedule_task ( listener->io_task ) ) ) {
     LOGSVC_ERROR( "Unable to create/schedule I/O task for listener on port %d", listener->port );
     if ( listener->io_task ) {
-      free ( listener->io_task );
+      // The task was never scheduled; unscheduling it hands it straight back to the scheduler.
+      io_sched_unschedule_task ( listener->io_task );
       listener->io_task = NIL_IO_SCHEDULER_TASK;
     }
+    listener->io_task_handle = IO_SCHEDULER_INVALID_HANDLE;
     return CMNUTIL_FALSE;
   }
   
@@ -235,32 +611,104 @@ tcp_listener_start ( p_tcp_listener_t listener, p_io_scheduler_t scheduler )
   return CMNUTIL_TRUE;
 }
 
+bool_t
+tcp_listener_start_group ( p_tcp_listener_t listener, p_io_sched_group_t group, io_sched_group_assign_t assign )
+{
+  if ( !( listener ) || !( group ) ) {
+    LOGSVC_DEBUG( "tcp_listener_start_group(): Missing listener or I/O scheduler group." );
+    return CMNUTIL_FALSE;
+  }
+  
+  // The listening socket itself gets a scheduler of its own from the group; the clients are
+  // assigned one each as they are accepted (see tcp_remote_client_init()).
+  //
+  listener->client_group = group;
+  listener->client_assign = assign;
+  if ( !( tcp_listener_start ( listener, io_sched_group_pick ( group, IO_SCHED_GROUP_ASSIGN_FD_HASH, listener->fd ) ) ) ) {
+    listener->client_group = NIL_IO_SCHED_GROUP;
+    return CMNUTIL_FALSE;
+  }
+  return CMNUTIL_TRUE;
+}
+
+bool_t
+tcp_listener_start_sharded ( p_tcp_listener_t listener, p_io_sched_group_t group, bool_t steer_by_cpu )
+{
+  size_t idx;
+  
+  if ( !( listener ) || !( group ) || !( group->num_schedulers ) ) {
+    LOGSVC_DEBUG( "tcp_listener_start_sharded(): Missing listener or I/O scheduler group." );
+    return CMNUTIL_FALSE;
+  }
+  assert ( listener->io_task == NIL_IO_SCHEDULER_TASK );
+  
+  // The socket tcp_listener_init() opened has no SO_REUSEPORT set, and would keep the others off
+  // the port; give it back before opening one socket per scheduler in its place. Should that
+  // fail, it is taken back again, so that the listener can still be started unsharded.
+  //
+  if ( listener->fd != INVALID_SOCKET_FD ) {
+    sockmgr_close_tcp ( listener->fd );
+    listener->fd = INVALID_SOCKET_FD;
+  }
+  if ( !( tcp_listener_open_shards ( listener, group ) ) ) {
+    tcp_listener_unshard ( listener );
+    return CMNUTIL_FALSE;
+  }
+  if ( steer_by_cpu && ( listener->num_shards > 1 ) )
+    tcp_steer_reuseport_by_cpu ( listener->fd, (unsigned int) listener->num_shards );
+  
+  // Every socket is listening by now; start accepting on all of them.
+  for ( idx = 0; idx < listener->num_shards; idx++ ) {
+    if ( !( io_sched_schedule_task ( listener->shard_tasks[idx] ) ) ) {
+      LOGSVC_ERROR( "Unable to schedule I/O task for shard %lu of listener on port %d", (unsigned long) idx, listener->port );
+      tcp_listener_stop_shards ( listener );
+      tcp_listener_unshard ( listener );
+      return CMNUTIL_FALSE;
+    }
+  }
+  listener->io_task = listener->shard_tasks[0];
+  listener->io_scheduler = group->schedulers[0];
+  listener->io_task_handle = io_sched_get_task_handle ( listener->io_task );
+  
+  LOGSVC_INFO( "Listener started for TCP port %d, sharded over %lu schedulers", listener->port,
+               (unsigned long) listener->num_shards );
+  return CMNUTIL_TRUE;
+}
+
 void
 tcp_listener_stop ( p_tcp_listener_t listener )
 {
+  p_io_scheduler_t scheduler;
+  
   if ( listener ) {
-    // Unschedule our I/O task so that no new clients are added.
+    // Unschedule our I/O task so that no new clients are added. This is done on the task's own
+    // thread, so that no accept is still under way once it returns.
     //
     if ( listener->io_task != NIL_IO_SCHEDULER_TASK ) {
-      io_sched_unschedule_task ( listener->io_task );
+      if ( listener->num_shards )
+        tcp_listener_stop_shards ( listener );
+      else
+        tcp_sched_call ( listener->io_scheduler, tcp_sched_unschedule, (void*)(uintptr_t) listener->io_task_handle );
       listener->io_task = NIL_IO_SCHEDULER_TASK;
+      listener->io_task_handle = IO_SCHEDULER_INVALID_HANDLE;
     }
     
     // Since we are stopping the listener, we stop all the clients as well.
     // TODO: look into this; do we really want to stop all the clients at this point? Would it be better to separate this step out?
     //
-    p_tcp_remote_client_t remcli, nn;
-    LOCK_MUTEX( listener->clients_list_mutex );
-    while ( listener->clients->next != listener->clients ) {
-      // Unlink the client from the list; no need to worry about the back links here since we are clearing the list.
-      nn = listener->clients->next;
-      listener->clients->next = nn->next;
-      tcp_remote_client_stop ( nn );
-      tcp_remote_client_destroy ( nn );
-    }
-    // At this point, the list is empty, and HEAD->N == HEAD; remember to reset HEAD->P to HEAD.
-    listener->clients->prev = listener->clients;
-    UNLOCK_MUTEX( listener->clients_list_mutex );
+    // Clients of a listener started on a group are spread over its schedulers. Each scheduler
+    // in turn tears down its own clients on its own thread, where none of their callbacks can be
+    // running. The list is not held locked while waiting, since a client's callback may be
+    // waiting on it to drop the client.
+    //
+    do {
+      LOCK_MUTEX( listener->clients_list_mutex );
+      scheduler = ( listener->clients->next != listener->clients ) ? listener->clients->next->io_scheduler
+                                                                  : NIL_IO_SCHEDULER;
+      UNLOCK_MUTEX( listener->clients_list_mutex );
+      if ( scheduler )
+        tcp_sched_call ( scheduler, tcp_listener_sweep_clients, (void*) listener );
+    } while ( scheduler );
   }
 }
 
@@ -272,12 +720,7 @@ void
 tcp_remote_client_destroy ( p_tcp_remote_client_t remcli )
 {
   if ( remcli ) {
-    // The task does not get free()-ed here; only needs to be unscheduled -
-    // the scheduler will take care of releasing the memory.
-    if ( remcli->io_task )
-      io_sched_unschedule_task ( remcli->io_task );
-    if ( remcli->fd != INVALID_SOCKET_FD )
-      close ( remcli->fd );
+    tcp_remote_client_release ( remcli );
     free ( remcli );
   }
 }
@@ -286,20 +729,21 @@ p_tcp_remote_client_t
 tcp_remote_client_init ( p_tcp_listener_t owner,
                          sock_fd_t fd, in_addr_t rem_ip, uint16_t rem_port)
 {
-  p_tcp_remote_client_t rv = NEW_tcp_remote_client();
-  if ( rv ) {
-    memset ( rv, 0, SIZE_tcp_remote_client );
-    rv->fd = fd;
-    rv->remote_ip = rem_ip;
-    strcpy ( rv->remote_ip_str, inet_ntoa ( *( (struct in_addr*)(void*) &rem_ip ) ) );
-    rv->remote_port = rem_port;
-    rv->io_task =
-      io_sched_create_reader_task ( owner->io_task->owner,
-                                    fd, IO_SCHEDULER_NO_TIMEOUT, (void*) rv,
-                                    on_tcp_listener_client_request );
-    rv->owner = owner;
+  return tcp_remote_client_init_on ( owner, NIL_IO_SCHEDULER, fd, rem_ip, rem_port );
+}
+
+bool_t
+tcp_remote_client_send ( p_tcp_remote_client_t remcli, const void * data, size_t length )
+{
+  assert ( remcli );
+  
+  if ( ( remcli->fd == INVALID_SOCKET_FD ) || !( remcli->io_scheduler ) ) {
+    LOGSVC_DEBUG( "tcp_remote_client_send(): Client '%s:%d' is not connected.", remcli->remote_ip_str, remcli->remote_port );
+    return CMNUTIL_FALSE;
   }
-  return rv;
+  
+  return tcp_out_queue_send ( &( remcli->out_queue ), remcli->io_scheduler, remcli->fd, data, length,
+                              remcli->owner->priority, (void*) remcli, on_tcp_remote_client_writable );
 }
 
 bool_t
@@ -315,8 +759,10 @@ void
 tcp_remote_client_stop ( p_tcp_remote_client_t remcli )
 {
   if ( remcli ) {
-    io_sched_unschedule_task ( remcli->io_task );
+    io_sched_unschedule_handle ( remcli->io_scheduler, remcli->io_task_handle );
     remcli->io_task = NIL_IO_SCHEDULER_TASK;
+    remcli->io_task_handle = IO_SCHEDULER_INVALID_HANDLE;
+    tcp_out_queue_clear ( &( remcli->out_queue ), remcli->io_scheduler );
   }
 }
 
@@ -337,6 +783,9 @@ on_tcp_client_connected_to_server ( p_io_scheduler_t scheduler, sock_fd_t fd, in
   }
   
   LOGSVC_INFO( "Connected to '%s:%d'", client->remote_ip_str, client->remote_port );
+  
+  // The client belongs to this scheduler from here on, so that on_connected may already send.
+  client->io_scheduler = scheduler;
   if ( client->on_connected )
     client->on_connected ( client );
   
@@ -355,42 +804,136 @@ static bool_t
 on_tcp_client_server_responded ( p_io_scheduler_task_t task, int errcode )
 {
   p_tcp_client_t client = AS_PTR_tcp_client( task->user_data );
-  int bytes_read;
+  size_t batch, num_reads, buffer_size;
+  ssize_t bytes_read;
+  char * buffer;
+  int rc;
   
   if ( !( client ) || ( client->fd == INVALID_SOCKET_FD ) ) {
     LOGSVC_DEBUG( "on_tcp_client_server_responded(): client not set or file descriptor invalid." );
     return IO_SCHEDULER_TASK_COMPLETE;
   }
   
-  assert ( client->read_buffer != (char*) 0 );
-  bytes_read = tcp_receive ( client->fd, client->read_buffer, client->read_buffer_size );
+  if ( errcode == IO_SCHEDULER_ERR_NOT_SCHEDULED ) {
+    LOGSVC_ERROR( "on_tcp_client_server_responded(): I/O handler for '%s:%d' could not be scheduled; disconnecting.",
+                  client->remote_ip_str, client->remote_port );
+    tcp_client_disconnect ( client );
+    return IO_SCHEDULER_TASK_COMPLETE;
+  }
   
-  if ( bytes_read <= 0 ) {
-    if ( bytes_read < 0 ) {
-      if ( ( errno == EAGAIN ) || ( errno == EINTR ) )
-        return IO_SCHEDULER_TASK_INCOMPLETE;
-      LOGSVC_ERROR( "on_tcp_client_server_responded(): Failed to read from server: %s", strerror ( errno ) );
+  // The task is edge-triggered: keep reading until the socket runs dry, or until this pass's
+  // batch is used up, in which case the rest is picked up on the next pass.
+  //
+  batch = io_sched_get_edge_batch ( task->owner );
+  for ( num_reads = 0; ; num_reads++ ) {
+    if ( batch && ( num_reads >= batch ) ) {
+      io_sched_continue_task ( task, IO_SCHEDULER_READ );
+      return IO_SCHEDULER_TASK_INCOMPLETE;
+    }
+    
+    if ( client->read_buffer ) {
+      buffer = client->read_buffer;
+      buffer_size = client->read_buffer_size;
+    }
+    else if ( tcp_read_frame_borrow ( client->buffer_pool, &( client->read_frame ) ) ) {
+      buffer = client->read_frame->data;
+      buffer_size = client->read_frame->size;
     }
     else {
-      LOGSVC_INFO( "Server '%s:%d' disconnected.", client->remote_ip_str, client->remote_port );
+      // No buffer to be had just now; try again on the next pass.
+      io_sched_continue_task ( task, IO_SCHEDULER_READ );
+      return IO_SCHEDULER_TASK_INCOMPLETE;
     }
-    client->io_task = NIL_IO_SCHEDULER_TASK;
-    close ( client->fd );
-    client->fd = INVALID_SOCKET_FD;
-    if ( client->on_closed )
-      client->on_closed ( client, TCP_CLIENT_CLOSED_REMOTE );
-    return IO_SCHEDULER_TASK_COMPLETE;
+    
+    bytes_read = tcp_receive_nowait ( client->fd, buffer, buffer_size );
+    
+    if ( bytes_read <= 0 ) {
+      if ( bytes_read < 0 ) {
+        if ( errno == EINTR )
+          continue;
+        if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) ) {
+          // Nothing more to read; an idle connection holds on to no buffer.
+          tcp_read_frame_return ( &( client->read_frame ) );
+          return IO_SCHEDULER_TASK_INCOMPLETE;
+        }
+        LOGSVC_ERROR( "on_tcp_client_server_responded(): Failed to read from server: %s", strerror ( errno ) );
+      }
+      else {
+        LOGSVC_INFO( "Server '%s:%d' disconnected.", client->remote_ip_str, client->remote_port );
+      }
+      client->io_task = NIL_IO_SCHEDULER_TASK;
+      client->io_task_handle = IO_SCHEDULER_INVALID_HANDLE;
+      tcp_out_queue_clear ( &( client->out_queue ), client->io_scheduler );
+      tcp_read_frame_return ( &( client->read_frame ) );
+      tcp_frame_ring_clear ( &( client->frame_ring ) );
+      close ( client->fd );
+      client->fd = INVALID_SOCKET_FD;
+      if ( client->on_closed )
+        client->on_closed ( client, TCP_CLIENT_CLOSED_REMOTE );
+      return IO_SCHEDULER_TASK_COMPLETE;
+    }
+    io_sched_account_bytes ( task, (size_t) bytes_read );
+    
+    if ( client->framer )
+      rc = tcp_framer_feed ( client->framer, &( client->frame_ring ), buffer, (size_t) bytes_read,
+                             tcp_client_deliver, (void*) task );
+    else
+      rc = tcp_client_deliver ( (void*) task, buffer, (size_t) bytes_read );
+    
+    if ( rc == TCP_FEED_FAILED )
+      LOGSVC_ERROR( "on_tcp_client_server_responded(): Unable to frame data from server '%s:%d'; disconnecting.",
+                    client->remote_ip_str, client->remote_port );
+    if ( ( rc == TCP_FEED_CLOSE ) || ( rc == TCP_FEED_FAILED ) ) {
+      // Server response indicated that the connection/conversation has terminated; close the socket.
+      tcp_client_disconnect ( client );
+      return IO_SCHEDULER_TASK_COMPLETE;
+    }
+    
+    // The callback may have stopped (or even destroyed) the client itself; its task is unscheduled
+    // on the spot, being on this thread, but is not released before the next pass.
+    //
+    if ( rc == TCP_FEED_GONE )
+      return IO_SCHEDULER_TASK_INCOMPLETE;
   }
+}
+
+static bool_t
+on_tcp_client_writable ( p_io_scheduler_task_t task, int errcode )
+{
+  p_tcp_client_t client = AS_PTR_tcp_client( task->user_data );
+  size_t num_bytes;
+  int rc;
   
-  if ( client->on_server_responded &&
-       client->on_server_responded ( client, client->read_buffer, (size_t) bytes_read ) )
-  {
-    // Server response indicated that the connection/conversation has terminated; close the socket.
-    tcp_client_disconnect ( client );
+  if ( !( client ) || ( client->fd == INVALID_SOCKET_FD ) )
     return IO_SCHEDULER_TASK_COMPLETE;
+  
+  // A writer task that never made it onto the scheduler fails the queue, as a write would.
+  if ( errcode == IO_SCHEDULER_ERR_NOT_SCHEDULED ) {
+    errno = errcode;
+    rc = -1;
+  }
+  else {
+    num_bytes = client->out_queue.num_bytes;
+    rc = tcp_out_queue_flush ( &( client->out_queue ), client->fd );
+    io_sched_account_bytes ( task, num_bytes - client->out_queue.num_bytes );
+    if ( rc == 0 )
+      return IO_SCHEDULER_TASK_INCOMPLETE;
   }
   
-  return IO_SCHEDULER_TASK_INCOMPLETE;
+  // The writer task is finished with either way, and is released once this returns.
+  client->out_queue.io_task = NIL_IO_SCHEDULER_TASK;
+  client->out_queue.io_task_handle = IO_SCHEDULER_INVALID_HANDLE;
+  
+  if ( rc < 0 ) {
+    // Leave the connection itself to the reader, which hears about it soon enough.
+    LOGSVC_ERROR( "on_tcp_client_writable(): Failed to write to server '%s:%d': %s",
+                  client->remote_ip_str, client->remote_port, strerror ( errno ) );
+    tcp_out_queue_clear ( &( client->out_queue ), client->io_scheduler );
+  }
+  else if ( client->on_write_complete ) {
+    client->on_write_complete ( client );
+  }
+  return IO_SCHEDULER_TASK_COMPLETE;
 }
 
 static bool_t
@@ -398,7 +941,10 @@ on_tcp_listener_client_request ( p_io_scheduler_task_t task, int errcode )
 {
   p_tcp_remote_client_t remcli = AS_PTR_tcp_remote_client( task->user_data );
   p_tcp_listener_t listener;
-  int bytes_read;
+  size_t batch, num_reads, buffer_size;
+  ssize_t bytes_read;
+  char * buffer;
+  int rc;
   
   if ( !( remcli ) || ( remcli->fd == INVALID_SOCKET_FD ) )
     return IO_SCHEDULER_TASK_COMPLETE;
@@ -408,38 +954,88 @@ on_tcp_listener_client_request ( p_io_scheduler_task_t task, int errcode )
   if ( !( listener ) || ( listener->fd == INVALID_SOCKET_FD ) )
     return IO_SCHEDULER_TASK_COMPLETE;
   
-  assert ( remcli->read_buffer != (char*) 0 );
-  bytes_read = tcp_receive ( remcli->fd, remcli->read_buffer, remcli->read_buffer_size );
-  
-  if ( bytes_read <= 0 ) {
-    // An error occurred, or the remote client closed the connection.
-    if ( bytes_read < 0 ) {
-      if ( ( errno == EAGAIN ) || ( errno == EINTR ) )
-        return IO_SCHEDULER_TASK_INCOMPLETE;
-      LOGSVC_ERROR( "on_tcp_listener_client_request(): Failed to read from client: %s", strerror ( errno ) );
-    }
-    else {
-      LOGSVC_INFO( "Client '%s:%d' disconnected.", remcli->remote_ip_str, remcli->remote_port );
-    }
-    if ( listener->on_client_disconnected )
-      listener->on_client_disconnected ( listener, remcli );
-    tcp_listener_drop_client ( listener, remcli );
-    return IO_SCHEDULER_TASK_COMPLETE;
-  }
-  
-  // If we got here, then we successfully read something from the remote client.
-  if ( listener->on_client_request &&
-       listener->on_client_request ( listener, remcli, remcli->read_buffer, (size_t) bytes_read ) )
-  {
-    // The client request resulted in the transaction being "completed". Disconnect the client.
-    //
+  if ( errcode == IO_SCHEDULER_ERR_NOT_SCHEDULED ) {
+    LOGSVC_ERROR( "on_tcp_listener_client_request(): I/O task for client '%s:%d' could not be scheduled; disconnecting.",
+                  remcli->remote_ip_str, remcli->remote_port );
     if ( listener->on_client_disconnected )
       listener->on_client_disconnected ( listener, remcli );
     tcp_listener_drop_client ( listener, remcli );
     return IO_SCHEDULER_TASK_COMPLETE;
   }
   
-  return IO_SCHEDULER_TASK_INCOMPLETE;
+  // The task is edge-triggered: keep reading until the socket runs dry, or until this pass's
+  // batch is used up, in which case the rest is picked up on the next pass.
+  //
+  batch = io_sched_get_edge_batch ( task->owner );
+  for ( num_reads = 0; ; num_reads++ ) {
+    if ( batch && ( num_reads >= batch ) ) {
+      io_sched_continue_task ( task, IO_SCHEDULER_READ );
+      return IO_SCHEDULER_TASK_INCOMPLETE;
+    }
+    
+    if ( remcli->read_buffer ) {
+      buffer = remcli->read_buffer;
+      buffer_size = remcli->read_buffer_size;
+    }
+    else if ( tcp_read_frame_borrow ( listener->buffer_pool, &( remcli->read_frame ) ) ) {
+      buffer = remcli->read_frame->data;
+      buffer_size = remcli->read_frame->size;
+    }
+    else {
+      // No buffer to be had just now; try again on the next pass.
+      io_sched_continue_task ( task, IO_SCHEDULER_READ );
+      return IO_SCHEDULER_TASK_INCOMPLETE;
+    }
+    
+    bytes_read = tcp_receive_nowait ( remcli->fd, buffer, buffer_size );
+    
+    if ( bytes_read <= 0 ) {
+      // An error occurred, or the remote client closed the connection.
+      if ( bytes_read < 0 ) {
+        if ( errno == EINTR )
+          continue;
+        if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) ) {
+          // Nothing more to read; an idle connection holds on to no buffer.
+          tcp_read_frame_return ( &( remcli->read_frame ) );
+          return IO_SCHEDULER_TASK_INCOMPLETE;
+        }
+        LOGSVC_ERROR( "on_tcp_listener_client_request(): Failed to read from client: %s", strerror ( errno ) );
+      }
+      else {
+        LOGSVC_INFO( "Client '%s:%d' disconnected.", remcli->remote_ip_str, remcli->remote_port );
+      }
+      if ( listener->on_client_disconnected )
+        listener->on_client_disconnected ( listener, remcli );
+      tcp_listener_drop_client ( listener, remcli );
+      return IO_SCHEDULER_TASK_COMPLETE;
+    }
+    
+    // If we got here, then we successfully read something from the remote client.
+    io_sched_account_bytes ( task, (size_t) bytes_read );
+    if ( listener->framer )
+      rc = tcp_framer_feed ( listener->framer, &( remcli->frame_ring ), buffer, (size_t) bytes_read,
+                             tcp_remote_client_deliver, (void*) task );
+    else
+      rc = tcp_remote_client_deliver ( (void*) task, buffer, (size_t) bytes_read );
+    
+    if ( rc == TCP_FEED_FAILED )
+      LOGSVC_ERROR( "on_tcp_listener_client_request(): Unable to frame data from client '%s:%d'; disconnecting.",
+                    remcli->remote_ip_str, remcli->remote_port );
+    if ( ( rc == TCP_FEED_CLOSE ) || ( rc == TCP_FEED_FAILED ) ) {
+      // The client request resulted in the transaction being "completed". Disconnect the client.
+      //
+      if ( listener->on_client_disconnected )
+        listener->on_client_disconnected ( listener, remcli );
+      tcp_listener_drop_client ( listener, remcli );
+      return IO_SCHEDULER_TASK_COMPLETE;
+    }
+    
+    // The callback may have dropped the client itself; its task is unscheduled on the spot, being
+    // on this thread, but is not released before the next pass.
+    //
+    if ( rc == TCP_FEED_GONE )
+      return IO_SCHEDULER_TASK_INCOMPLETE;
+  }
 }
 
 static bool_t
@@ -450,73 +1046,377 @@ on_tcp_listener_client_waiting ( p_io_scheduler_task_t task, int errcode )
   if ( !( listener ) || ( listener->fd == INVALID_SOCKET_FD ) )
     return IO_SCHEDULER_TASK_COMPLETE;
   
-  // Call "client waiting" callback and see if we should accept the new client.
-  //
-  if ( listener->on_client_waiting && !( listener->on_client_waiting ( listener ) ) )
-    return IO_SCHEDULER_TASK_INCOMPLETE;
+  if ( errcode == IO_SCHEDULER_ERR_NOT_SCHEDULED ) {
+    LOGSVC_ERROR( "on_tcp_listener_client_waiting(): I/O task for listener on port %d could not be scheduled; "
+                  "not accepting on socket %d.", listener->port, task->fd );
+    return IO_SCHEDULER_TASK_COMPLETE;
+  }
   
-  // If no "client waiting" callback was specified, or if one was specified and
-  // returned TRUE, we can accept the connection and create the tcp_remote_client
-  // instance.
+  // Accept as many of the connections waiting as the budget allows; the socket being watched
+  // level-triggered, any left over are seen to on the next pass, after the scheduler's other work.
   //
+  size_t budget = listener->accept_budget ? listener->accept_budget : TCP_LISTENER_DEFAULT_ACCEPT_BUDGET;
+  size_t num_accepted;
   sock_fd_t fd;
   in_addr_t remip;
   uint16_t remport;
-  fd = tcp_accept_full ( listener->fd, &remip, &remport );
-  if ( fd != INVALID_SOCKET_FD ) {
-    // Successfully accepted the client connection. Add to the remote clients list.
-    // The on_client_connected callback should be set, or the client's I/O task will
-    // not be set, effectively providing no actual service to the client. If left
-    // NULL, we simply want to log the issue, close the client socket and return.
+  for ( num_accepted = 0; num_accepted < budget; num_accepted++ ) {
+    // Call "client waiting" callback and see if we should accept the new client.
     //
-    if ( !( listener->on_client_connected ) ) {
-      LOGSVC_NOTICE( "on_tcp_listener_client_waiting(): Listener's on_client_connected callback not set?! Closing remote socket." );
-      close ( fd );
-      return IO_SCHEDULER_TASK_INCOMPLETE;
-    }
+    if ( listener->on_client_waiting && !( listener->on_client_waiting ( listener ) ) )
+      break;
     
-    // Create a remote client instance that we will add to our list of clients.
+    // If no "client waiting" callback was specified, or if one was specified and
+    // returned TRUE, we can accept the connection and create the tcp_remote_client
+    // instance.
     //
-    p_tcp_remote_client_t remcli = tcp_remote_client_init ( listener, fd, remip, remport );
-    if ( !( remcli ) ) {
-      LOGSVC_ERROR( "on_tcp_listener_client_waiting(): Failed to create remote client instance; closing remote socket." );
-      close ( fd );
+    fd = tcp_accept_nonblocking ( task->fd, &remip, &remport );
+    if ( fd == INVALID_SOCKET_FD ) {
+      // A connection reset while still queued is simply gone; anything else but running out of
+      // connections (EAGAIN) is worth a word, and is left for the next pass.
+      if ( ( errno == EINTR ) || ( errno == ECONNABORTED ) )
+        continue;
+      if ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) )
+        LOGSVC_ERROR( "on_tcp_listener_client_waiting(): Failed to accept client on port %d: %s", listener->port,
+                      strerror ( errno ) );
+      break;
+    }
+    tcp_listener_take_client ( listener, task, fd, remip, remport );
+  }
+  
+  return IO_SCHEDULER_TASK_INCOMPLETE;
+}
+
+static bool_t
+on_tcp_remote_client_writable ( p_io_scheduler_task_t task, int errcode )
+{
+  p_tcp_remote_client_t remcli = AS_PTR_tcp_remote_client( task->user_data );
+  p_tcp_listener_t listener;
+  size_t num_bytes;
+  int rc;
+  
+  if ( !( remcli ) || ( remcli->fd == INVALID_SOCKET_FD ) )
+    return IO_SCHEDULER_TASK_COMPLETE;
+  
+  // A writer task that never made it onto the scheduler fails the queue, as a write would.
+  if ( errcode == IO_SCHEDULER_ERR_NOT_SCHEDULED ) {
+    errno = errcode;
+    rc = -1;
+  }
+  else {
+    num_bytes = remcli->out_queue.num_bytes;
+    rc = tcp_out_queue_flush ( &( remcli->out_queue ), remcli->fd );
+    io_sched_account_bytes ( task, num_bytes - remcli->out_queue.num_bytes );
+    if ( rc == 0 )
       return IO_SCHEDULER_TASK_INCOMPLETE;
+  }
+  
+  // The writer task is finished with either way, and is released once this returns.
+  remcli->out_queue.io_task = NIL_IO_SCHEDULER_TASK;
+  remcli->out_queue.io_task_handle = IO_SCHEDULER_INVALID_HANDLE;
+  
+  listener = remcli->owner;
+  if ( rc < 0 ) {
+    // Leave the connection itself to the reader, which hears about it soon enough.
+    LOGSVC_ERROR( "on_tcp_remote_client_writable(): Failed to write to client '%s:%d': %s",
+                  remcli->remote_ip_str, remcli->remote_port, strerror ( errno ) );
+    tcp_out_queue_clear ( &( remcli->out_queue ), remcli->io_scheduler );
+  }
+  else if ( listener && listener->on_client_write_complete ) {
+    listener->on_client_write_complete ( listener, remcli );
+  }
+  return IO_SCHEDULER_TASK_COMPLETE;
+}
+
+static void
+tcp_buffer_pool_free ( p_tcp_buffer_pool_t pool )
+{
+  LOGSVC_DEBUG( "tcp_buffer_pool_free(): Pool of %lu-byte buffers had at most %lu on loan.",
+                (unsigned long) pool->buffer_size, (unsigned long) pool->high_watermark );
+  pthread_mutex_destroy ( &( pool->mutex ) );
+  free ( pool );
+}
+
+static int
+tcp_client_deliver ( void * ctx, char * data, size_t length )
+{
+  p_io_scheduler_task_t task = (p_io_scheduler_task_t) ctx;
+  p_tcp_client_t client = AS_PTR_tcp_client( task->user_data );
+  
+  if ( client->on_server_responded && client->on_server_responded ( client, data, length ) )
+    return TCP_FEED_CLOSE;
+  return S_IOSCHED_OPTS_REMOVE( task ) ? TCP_FEED_GONE : TCP_FEED_MORE;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//// tcp_frame_ring
+//////////////////////////////////////////////////////////////////////////////////////////
+
+static bool_t
+tcp_frame_ring_append ( p_tcp_frame_ring_t ring, const char * data, size_t length )
+{
+  size_t size, tail, num_bytes;
+  char * grown;
+  
+  // Grow by doubling, straightening the contents out on the way.
+  if ( ring->count + length > ring->size ) {
+    for ( size = ( ring->size ? ring->size : TCP_FRAME_RING_MIN_SIZE ); size < ring->count + length; size <<= 1 )
+      ;
+    grown = (char*) malloc ( size );
+    if ( !( grown ) ) {
+      LOGSVC_ERROR( "tcp_frame_ring_append(): Unable to allocate %lu-byte frame ring.", (unsigned long) size );
+      return CMNUTIL_FALSE;
     }
-    
-    listener->on_client_connected ( listener, remcli );
-    
-    // If the I/O task is not set, then we assume that the client was handled to
-    // completion (successfully or otherwise) in the on_client_connected callback.
-    //
-    if ( !( remcli->io_task ) ) {
-      LOGSVC_DEBUG( "on_tcp_listener_client_waiting(): Remote client's I/O task not set; closing remote socket." );
-      tcp_remote_client_destroy ( remcli );
+    if ( ring->count ) {
+      num_bytes = ring->size - ring->head;
+      if ( num_bytes > ring->count )
+        num_bytes = ring->count;
+      memcpy ( grown, ring->data + ring->head, num_bytes );
+      memcpy ( grown + num_bytes, ring->data, ring->count - num_bytes );
     }
-    else {
-      p_tcp_remote_client_t last_elem;
-      
-      // Circular list, appending to "end" of list.
-      LOCK_MUTEX( listener->clients_list_mutex );
-      last_elem = listener->clients->prev;
-      last_elem->next = remcli;               // LAST->N = NEW
-      remcli->prev = last_elem;               // NEW->P = LAST
-      remcli->next = listener->clients;       // NEW->N = HEAD
-      listener->clients->prev = remcli;       // HEAD->P = NEW
-      UNLOCK_MUTEX( listener->clients_list_mutex );
-      
-      if ( !( tcp_remote_client_start ( remcli ) ) ) {
-        LOGSVC_ERROR( "on_tcp_listener_client_waiting(): Failed to start client's I/O task; closing remote socket." );
-        tcp_listener_drop_client ( listener, remcli );
-      }
-      else {
-        LOGSVC_DEBUG( "on_tcp_listener_client_waiting(): Remote client %s:%d started.",
-                      remcli->remote_ip_str, remcli->remote_port );
+    free ( ring->data );
+    ring->data = grown;
+    ring->size = size;
+    ring->head = 0;
+  }
+  
+  tail = ( ring->head + ring->count ) % ring->size;
+  num_bytes = ring->size - tail;
+  if ( num_bytes > length )
+    num_bytes = length;
+  memcpy ( ring->data + tail, data, num_bytes );
+  memcpy ( ring->data, data + num_bytes, length - num_bytes );
+  ring->count += length;
+  return CMNUTIL_TRUE;
+}
+
+static void
+tcp_frame_ring_clear ( p_tcp_frame_ring_t ring )
+{
+  free ( ring->data );
+  memset ( ring, 0, sizeof( tcp_frame_ring_t ) );
+}
+
+static void
+tcp_frame_ring_consume ( p_tcp_frame_ring_t ring, size_t length )
+{
+  assert ( length <= ring->count );
+  
+  // Once the last frame has been taken out, the ring is let go of until the next one is split.
+  ring->count -= length;
+  if ( !( ring->count ) ) {
+    tcp_frame_ring_clear ( ring );
+    return;
+  }
+  ring->head = ( ring->head + length ) % ring->size;
+  ring->needed = 0;
+  ring->scanned = 0;
+}
+
+static bool_t
+tcp_frame_ring_linearize ( p_tcp_frame_ring_t ring )
+{
+  char * straight;
+  size_t num_bytes;
+  
+  if ( ring->head + ring->count <= ring->size )
+    return CMNUTIL_TRUE;
+  
+  straight = (char*) malloc ( ring->size );
+  if ( !( straight ) ) {
+    LOGSVC_ERROR( "tcp_frame_ring_linearize(): Unable to allocate %lu-byte frame ring.", (unsigned long) ring->size );
+    return CMNUTIL_FALSE;
+  }
+  num_bytes = ring->size - ring->head;
+  memcpy ( straight, ring->data + ring->head, num_bytes );
+  memcpy ( straight + num_bytes, ring->data, ring->count - num_bytes );
+  free ( ring->data );
+  ring->data = straight;
+  ring->head = 0;
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Works out how much of data the frame pending in the ring takes: what the framer said it still
+ * needs or, with a delimiter and no such word, up to the end of the first delimiter, even one split
+ * across the join. Failing either, all of data is taken.
+ **/
+static size_t
+tcp_frame_ring_wanted ( const tcp_framer_t * framer, p_tcp_frame_ring_t ring, const char * data, size_t length )
+{
+  tcp_frame_scan_t scan;
+  size_t dlen, split, idx;
+  
+  if ( ring->needed > ring->count )
+    return ( ring->needed - ring->count < length ) ? ring->needed - ring->count : length;
+  if ( framer->scan != tcp_framer_scan_delimiter )
+    return length;
+  
+  // The ring was scanned in vain, but may end with the start of a delimiter that data finishes;
+  // the more of it there is in the ring, the earlier it ends.
+  dlen = framer->delimiter_length;
+  for ( split = dlen - 1; split > 0; split-- ) {
+    if ( ( split > ring->count ) || ( dlen - split > length ) )
+      continue;
+    for ( idx = 0; idx < split; idx++ ) {
+      if ( ring->data[ ( ring->head + ring->count - split + idx ) % ring->size ] != framer->delimiter[idx] )
+        break;
+    }
+    if ( ( idx == split ) && ( memcmp ( data, framer->delimiter + split, dlen - split ) == 0 ) )
+      return dlen - split;
+  }
+  
+  memset ( &scan, 0, sizeof( scan ) );
+  if ( framer->scan ( framer, data, length, &scan ) == TCP_FRAME_COMPLETE )
+    return scan.frame_size;
+  return length;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//// tcp_framer
+//////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Hands each complete frame in data to deliver, in order. A frame begun in an earlier read is
+ * finished off in the ring first, taking no more of data than it still needs (see
+ * tcp_frame_ring_wanted()); from then on, frames are handed over straight from data, and only a
+ * frame left incomplete at its end is copied into the ring.
+ **/
+static int
+tcp_framer_feed ( const tcp_framer_t * framer, p_tcp_frame_ring_t ring, char * data, size_t length,
+                  tcp_frame_deliver_t deliver, void * ctx )
+{
+  tcp_frame_scan_t scan;
+  size_t num_bytes;
+  char * frame;
+  int rc;
+  
+  while ( ring->count && length ) {
+    num_bytes = tcp_frame_ring_wanted ( framer, ring, data, length );
+    if ( !( tcp_frame_ring_append ( ring, data, num_bytes ) ) )
+      return TCP_FEED_FAILED;
+    data += num_bytes;
+    length -= num_bytes;
+    
+    while ( ring->count ) {
+      if ( !( tcp_frame_ring_linearize ( ring ) ) )
+        return TCP_FEED_FAILED;
+      frame = ring->data + ring->head;
+      memset ( &scan, 0, sizeof( scan ) );
+      scan.from = ring->scanned;
+      rc = framer->scan ( framer, frame, ring->count, &scan );
+      if ( rc == TCP_FRAME_MALFORMED )
+        return TCP_FEED_FAILED;
+      if ( rc == TCP_FRAME_PARTIAL ) {
+        ring->needed = scan.frame_size;
+        ring->scanned = ring->count;
+        break;
       }
+      rc = deliver ( ctx, frame + scan.payload_offset, scan.payload_length );
+      if ( rc != TCP_FEED_MORE )
+        return rc;
+      tcp_frame_ring_consume ( ring, scan.frame_size );
     }
   }
   
-  return IO_SCHEDULER_TASK_INCOMPLETE;
+  while ( length ) {
+    memset ( &scan, 0, sizeof( scan ) );
+    rc = framer->scan ( framer, data, length, &scan );
+    if ( rc == TCP_FRAME_MALFORMED )
+      return TCP_FEED_FAILED;
+    if ( rc == TCP_FRAME_PARTIAL ) {
+      if ( !( tcp_frame_ring_append ( ring, data, length ) ) )
+        return TCP_FEED_FAILED;
+      ring->needed = scan.frame_size;
+      ring->scanned = length;
+      break;
+    }
+    rc = deliver ( ctx, data + scan.payload_offset, scan.payload_length );
+    if ( rc != TCP_FEED_MORE )
+      return rc;
+    data += scan.frame_size;
+    length -= scan.frame_size;
+  }
+  return TCP_FEED_MORE;
+}
+
+/**
+ * Looks for the delimiter, with memchr() for its first byte, which the C library scans for a
+ * vector at a time, and memcmp() for the rest. The search carries on from where the last one
+ * left off, backing up far enough to catch a delimiter split across reads.
+ **/
+static int
+tcp_framer_scan_delimiter ( const tcp_framer_t * framer, const char * data, size_t length, tcp_frame_scan_t * scan )
+{
+  const size_t dlen = framer->delimiter_length;
+  const char * found;
+  size_t start;
+  
+  start = ( scan->from >= dlen ) ? scan->from - ( dlen - 1 ) : 0;
+  while ( ( start + dlen <= length ) &&
+          ( found = (const char*) memchr ( data + start, framer->delimiter[0], length - start - ( dlen - 1 ) ) ) )
+  {
+    if ( ( dlen == 1 ) || ( memcmp ( found + 1, framer->delimiter + 1, dlen - 1 ) == 0 ) ) {
+      scan->payload_offset = 0;
+      scan->payload_length = (size_t) ( found - data );
+      scan->frame_size = scan->payload_length + dlen;
+      return ( scan->payload_length > framer->max_frame ) ? TCP_FRAME_MALFORMED : TCP_FRAME_COMPLETE;
+    }
+    start = (size_t) ( found - data ) + 1;
+  }
+  
+  return ( length >= framer->max_frame + dlen ) ? TCP_FRAME_MALFORMED : TCP_FRAME_PARTIAL;
+}
+
+static int
+tcp_framer_scan_fixed ( const tcp_framer_t * framer, const char * data, size_t length, tcp_frame_scan_t * scan )
+{
+  scan->payload_offset = 0;
+  scan->payload_length = framer->record_size;
+  scan->frame_size = framer->record_size;
+  return ( length >= framer->record_size ) ? TCP_FRAME_COMPLETE : TCP_FRAME_PARTIAL;
+}
+
+static int
+tcp_framer_scan_length_prefix ( const tcp_framer_t * framer, const char * data, size_t length, tcp_frame_scan_t * scan )
+{
+  uint64_t payload_length = 0;
+  size_t idx;
+  
+  // Until the whole prefix is in, the prefix is all that is known to be needed.
+  scan->frame_size = framer->prefix_size;
+  if ( length < framer->prefix_size )
+    return TCP_FRAME_PARTIAL;
+  
+  for ( idx = 0; idx < framer->prefix_size; idx++ )
+    payload_length = ( payload_length << 8 ) | (uint8_t) data[idx];
+  if ( payload_length > framer->max_frame )
+    return TCP_FRAME_MALFORMED;
+  
+  scan->payload_offset = framer->prefix_size;
+  scan->payload_length = (size_t) payload_length;
+  scan->frame_size = framer->prefix_size + (size_t) payload_length;
+  return ( length >= scan->frame_size ) ? TCP_FRAME_COMPLETE : TCP_FRAME_PARTIAL;
+}
+
+static void
+tcp_listener_close_shards ( p_tcp_listener_t listener )
+{
+  size_t idx;
+  
+  for ( idx = 0; listener->shard_fds && ( idx < listener->num_shards ); idx++ ) {
+    if ( listener->shard_fds[idx] != INVALID_SOCKET_FD )
+      close ( listener->shard_fds[idx] );
+  }
+  free ( listener->shard_fds );
+  free ( listener->shard_tasks );
+  free ( listener->shard_handles );
+  listener->shard_fds = (sock_fd_t*) 0;
+  listener->shard_tasks = (p_io_scheduler_task_t*) 0;
+  listener->shard_handles = (io_sched_handle_t*) 0;
+  listener->shard_group = NIL_IO_SCHED_GROUP;
+  listener->num_shards = 0;
+  listener->fd = INVALID_SOCKET_FD;
 }
 
 static void
@@ -527,14 +1427,547 @@ tcp_listener_drop_client ( p_tcp_listener_t listener, p_tcp_remote_client_t remc
   assert ( remcli->prev );
   assert ( remcli->next );
   
-  // Unlink the remote client instance from the listeners list of clients.
+  // Unlink the remote client instance from the listeners list of clients; recycling it does that.
+  tcp_listener_recycle_client ( listener, remcli );
+  
+}
+
+static bool_t
+tcp_listener_open_shards ( p_tcp_listener_t listener, p_io_sched_group_t group )
+{
+  size_t idx, num_shards = group->num_schedulers;
+  
+  listener->shard_fds = (sock_fd_t*) malloc ( num_shards * sizeof( sock_fd_t ) );
+  listener->shard_tasks = (p_io_scheduler_task_t*) calloc ( num_shards, sizeof( p_io_scheduler_task_t ) );
+  listener->shard_handles = (io_sched_handle_t*) calloc ( num_shards, sizeof( io_sched_handle_t ) );
+  if ( !( listener->shard_fds ) || !( listener->shard_tasks ) || !( listener->shard_handles ) ) {
+    LOGSVC_ERROR( "tcp_listener_open_shards(): Unable to allocate %lu shards.", (unsigned long) num_shards );
+    return CMNUTIL_FALSE;
+  }
+  for ( idx = 0; idx < num_shards; idx++ )
+    listener->shard_fds[idx] = INVALID_SOCKET_FD;
+  listener->num_shards = num_shards;
+  listener->shard_group = group;
+  
+  // The sockets join the port's SO_REUSEPORT group in this order, which is the order the CPU
+  // steering program counts them in.
+  //
+  for ( idx = 0; idx < num_shards; idx++ ) {
+    listener->shard_fds[idx] = tcp_create_bound_socket_reuseport ( INADDR_ANY, listener->port );
+    if ( listener->shard_fds[idx] == INVALID_SOCKET_FD ) {
+      LOGSVC_NOTICE( "tcp_listener_open_shards(): Failed to open TCP socket %lu on port %d.", (unsigned long) idx,
+                     listener->port );
+      tcp_listener_stop_shards ( listener );
+      return CMNUTIL_FALSE;
+    }
+    tcp_set_socket_nonblocking ( listener->shard_fds[idx], CMNUTIL_TRUE );
+    listener->shard_tasks[idx] =
+      io_sched_create_reader_task ( group->schedulers[idx],
+                                    listener->shard_fds[idx], IO_SCHEDULER_NO_TIMEOUT, (void*) listener,
+                                    on_tcp_listener_client_waiting );
+    if ( !( listener->shard_tasks[idx] ) ) {
+      LOGSVC_ERROR( "tcp_listener_open_shards(): Unable to create I/O task for shard %lu.", (unsigned long) idx );
+      tcp_listener_stop_shards ( listener );
+      return CMNUTIL_FALSE;
+    }
+    listener->shard_handles[idx] = io_sched_get_task_handle ( listener->shard_tasks[idx] );
+    io_sched_set_task_priority ( listener->shard_tasks[idx], listener->priority );
+  }
+  listener->fd = listener->shard_fds[0];
+  return CMNUTIL_TRUE;
+}
+
+/**
+ * Releases a client's connection, and takes the client off the listener's list (if on it) and
+ * into the idle pool, all under the one lock. Once the client is off the list, tcp_listener_stop()
+ * no longer waits on this thread, and the listener may go as soon as the lock is let go.
+ **/
+static void
+tcp_listener_recycle_client ( p_tcp_listener_t listener, p_tcp_remote_client_t remcli )
+{
+  tcp_remote_client_release ( remcli );
+  
+  LOCK_MUTEX( listener->clients_list_mutex );
+  if ( remcli->prev ) {
+    remcli->prev->next = remcli->next;
+    remcli->next->prev = remcli->prev;
+  }
+  if ( listener->num_idle_clients < listener->max_idle_clients ) {
+    remcli->next = listener->idle_clients;
+    listener->idle_clients = remcli;
+    listener->num_idle_clients++;
+    remcli = NIL_tcp_remote_client;
+  }
+  UNLOCK_MUTEX( listener->clients_list_mutex );
+  
+  if ( remcli )
+    free ( remcli );
+}
+
+static p_tcp_remote_client_t
+tcp_listener_reuse_client ( p_tcp_listener_t listener )
+{
+  p_tcp_remote_client_t remcli;
+  
+  LOCK_MUTEX( listener->clients_list_mutex );
+  remcli = listener->idle_clients;
+  if ( remcli ) {
+    listener->idle_clients = remcli->next;
+    listener->num_idle_clients--;
+  }
+  UNLOCK_MUTEX( listener->clients_list_mutex );
+  return remcli;
+}
+
+static void
+tcp_listener_stop_shards ( p_tcp_listener_t listener )
+{
+  size_t idx;
+  
+  // Each shard's task is unscheduled on its own scheduler's thread, so that once this returns no
+  // shard is still accepting and the sockets can be closed. A task that was never scheduled is
+  // handed straight back; one that could not be scheduled after all is gone already.
+  //
+  for ( idx = 0; idx < listener->num_shards; idx++ ) {
+    if ( listener->shard_handles[idx] != IO_SCHEDULER_INVALID_HANDLE ) {
+      tcp_sched_call ( listener->shard_group->schedulers[idx], tcp_sched_unschedule,
+                       (void*)(uintptr_t) listener->shard_handles[idx] );
+      listener->shard_handles[idx] = IO_SCHEDULER_INVALID_HANDLE;
+    }
+    listener->shard_tasks[idx] = NIL_IO_SCHEDULER_TASK;
+  }
+}
+
+/**
+ * Stops and destroys every client of the listener that runs on the given scheduler; called on
+ * that scheduler's thread by tcp_listener_stop().
+ **/
+static void
+tcp_listener_sweep_clients ( p_io_scheduler_t scheduler, void * arg )
+{
+  p_tcp_listener_t listener = AS_PTR_tcp_listener( arg );
+  p_tcp_remote_client_t remcli, nn;
+  
   LOCK_MUTEX( listener->clients_list_mutex );
-  remcli->prev->next = remcli->next;
-  remcli->next->prev = remcli->prev;
+  for ( remcli = listener->clients->next; remcli != listener->clients; remcli = nn ) {
+    nn = remcli->next;
+    if ( remcli->io_scheduler != scheduler )
+      continue;
+    remcli->prev->next = remcli->next;
+    remcli->next->prev = remcli->prev;
+    tcp_remote_client_stop ( remcli );
+    tcp_remote_client_destroy ( remcli );
+  }
   UNLOCK_MUTEX( listener->clients_list_mutex );
+}
+
+static void
+tcp_listener_take_client ( p_tcp_listener_t listener, p_io_scheduler_task_t task,
+                           sock_fd_t fd, in_addr_t rem_ip, uint16_t rem_port )
+{
+  // Successfully accepted the client connection. Add to the remote clients list.
+  // The on_client_connected callback should be set, or the client's I/O task will
+  // not be set, effectively providing no actual service to the client. If left
+  // NULL, we simply want to log the issue, close the client socket and return.
+  //
+  if ( !( listener->on_client_connected ) ) {
+    LOGSVC_NOTICE( "tcp_listener_take_client(): Listener's on_client_connected callback not set?! Closing remote socket." );
+    close ( fd );
+    return;
+  }
+  
+  // Create a remote client instance that we will add to our list of clients. A sharded
+  // listener's clients stay on the scheduler of the shard that accepted them.
+  //
+  p_tcp_remote_client_t remcli =
+    tcp_remote_client_init_on ( listener, listener->num_shards ? task->owner : NIL_IO_SCHEDULER, fd, rem_ip, rem_port );
+  if ( !( remcli ) ) {
+    LOGSVC_ERROR( "tcp_listener_take_client(): Failed to create remote client instance; closing remote socket." );
+    close ( fd );
+    return;
+  }
+  
+  listener->on_client_connected ( listener, remcli );
+  
+  // If the I/O task is not set, then we assume that the client was handled to
+  // completion (successfully or otherwise) in the on_client_connected callback.
+  //
+  if ( !( remcli->io_task ) ) {
+    LOGSVC_DEBUG( "tcp_listener_take_client(): Remote client's I/O task not set; closing remote socket." );
+    tcp_listener_recycle_client ( listener, remcli );
+  }
+  else {
+    p_tcp_remote_client_t last_elem;
+    
+    // Circular list, appending to "end" of list.
+    LOCK_MUTEX( listener->clients_list_mutex );
+    last_elem = listener->clients->prev;
+    last_elem->next = remcli;               // LAST->N = NEW
+    remcli->prev = last_elem;               // NEW->P = LAST
+    remcli->next = listener->clients;       // NEW->N = HEAD
+    listener->clients->prev = remcli;       // HEAD->P = NEW
+    UNLOCK_MUTEX( listener->clients_list_mutex );
+    
+    if ( !( tcp_remote_client_start ( remcli ) ) ) {
+      LOGSVC_ERROR( "tcp_listener_take_client(): Failed to start client's I/O task; closing remote socket." );
+      tcp_listener_drop_client ( listener, remcli );
+    }
+    else {
+      LOGSVC_DEBUG( "tcp_listener_take_client(): Remote client %s:%d started.",
+                    remcli->remote_ip_str, remcli->remote_port );
+    }
+  }
+}
+
+static void
+tcp_listener_unshard ( p_tcp_listener_t listener )
+{
+  tcp_listener_close_shards ( listener );
+  listener->fd = sockmgr_get_or_create_tcp ( listener->port );
+  if ( listener->fd == INVALID_SOCKET_FD )
+    LOGSVC_ERROR( "tcp_listener_unshard(): Failed to reopen TCP socket on port %d.", listener->port );
+}
+
+static int
+tcp_remote_client_deliver ( void * ctx, char * data, size_t length )
+{
+  p_io_scheduler_task_t task = (p_io_scheduler_task_t) ctx;
+  p_tcp_remote_client_t remcli = AS_PTR_tcp_remote_client( task->user_data );
+  p_tcp_listener_t listener = remcli->owner;
+  
+  if ( listener->on_client_request && listener->on_client_request ( listener, remcli, data, length ) )
+    return TCP_FEED_CLOSE;
+  return S_IOSCHED_OPTS_REMOVE( task ) ? TCP_FEED_GONE : TCP_FEED_MORE;
+}
+
+static p_tcp_remote_client_t
+tcp_remote_client_init_on ( p_tcp_listener_t owner, p_io_scheduler_t scheduler,
+                            sock_fd_t fd, in_addr_t rem_ip, uint16_t rem_port )
+{
+  p_tcp_remote_client_t rv = NIL_tcp_remote_client;
+  
+  // The head of the listener's client list is made before the listener's mutex, and is never pooled.
+  if ( owner && ( fd != INVALID_SOCKET_FD ) )
+    rv = tcp_listener_reuse_client ( owner );
+  if ( !( rv ) )
+    rv = NEW_tcp_remote_client();
+  if ( rv ) {
+    memset ( rv, 0, SIZE_tcp_remote_client );
+    rv->fd = fd;
+    rv->remote_ip = rem_ip;
+    strcpy ( rv->remote_ip_str, inet_ntoa ( *( (struct in_addr*)(void*) &rem_ip ) ) );
+    rv->remote_port = rem_port;
+    rv->owner = owner;
+    
+    // The head of the listener's client list has no socket, and so no I/O task. Real clients
+    // share the listener's scheduler, unless the listener was started on a scheduler group, or
+    // the caller gives them one (that of the shard accepting them, for a sharded listener).
+    if ( fd != INVALID_SOCKET_FD ) {
+      if ( !( scheduler ) )
+        scheduler = owner->client_group ? io_sched_group_pick ( owner->client_group, owner->client_assign, fd )
+                                        : owner->io_scheduler;
+      rv->io_task =
+        io_sched_create_task ( scheduler,
+                               fd, IO_SCHEDULER_READ | IO_SCHEDULER_EDGE, IO_SCHEDULER_NO_TIMEOUT, IO_SCHEDULER_NO_SLACK, (void*) rv,
+                               on_tcp_listener_client_request,
+                               NIL_IO_SCHEDULER_CBK, NIL_IO_SCHEDULER_CBK, NIL_IO_SCHEDULER_CBK );
+      io_sched_set_task_priority ( rv->io_task, owner->priority );
+      rv->io_scheduler = scheduler;
+      rv->io_task_handle = io_sched_get_task_handle ( rv->io_task );
+    }
+  }
+  return rv;
+}
+
+static void
+tcp_remote_client_release ( p_tcp_remote_client_t remcli )
+{
+  // The task does not get free()-ed here; only needs to be unscheduled -
+  // the scheduler will take care of releasing the memory.
+  if ( remcli->io_task )
+    io_sched_unschedule_handle ( remcli->io_scheduler, remcli->io_task_handle );
+  tcp_out_queue_clear ( &( remcli->out_queue ), remcli->io_scheduler );
+  tcp_read_frame_return ( &( remcli->read_frame ) );
+  tcp_frame_ring_clear ( &( remcli->frame_ring ) );
+  if ( remcli->fd != INVALID_SOCKET_FD )
+    close ( remcli->fd );
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//// tcp_out_queue
+//////////////////////////////////////////////////////////////////////////////////////////
+
+static bool_t
+tcp_out_queue_append ( p_tcp_out_queue_t queue, const char * data, size_t length )
+{
+  p_tcp_out_chunk_t chunk = queue->tail;
+  size_t num_bytes;
+  
+  // Pack as much as fits into whatever room the last chunk has left.
+  if ( chunk && ( chunk->end < chunk->size ) ) {
+    num_bytes = chunk->size - chunk->end;
+    if ( num_bytes > length )
+      num_bytes = length;
+    memcpy ( chunk->data + chunk->end, data, num_bytes );
+    chunk->end += num_bytes;
+    queue->num_bytes += num_bytes;
+    data += num_bytes;
+    length -= num_bytes;
+  }
+  if ( !( length ) )
+    return CMNUTIL_TRUE;
+  
+  // The rest goes into a new chunk, the spare one if it is big enough.
+  if ( queue->spare && ( length <= queue->spare->size ) ) {
+    chunk = queue->spare;
+    queue->spare = (p_tcp_out_chunk_t) 0;
+  }
+  else {
+    num_bytes = ( length > TCP_OUT_CHUNK_SIZE ) ? length : TCP_OUT_CHUNK_SIZE;
+    chunk = (p_tcp_out_chunk_t) malloc ( sizeof( tcp_out_chunk_t ) + num_bytes );
+    if ( !( chunk ) ) {
+      LOGSVC_ERROR( "tcp_out_queue_append(): Unable to allocate %lu bytes of outgoing data.", (unsigned long) num_bytes );
+      return CMNUTIL_FALSE;
+    }
+    chunk->size = num_bytes;
+  }
+  memcpy ( chunk->data, data, length );
+  chunk->start = 0;
+  chunk->end = length;
+  chunk->next = (p_tcp_out_chunk_t) 0;
+  if ( queue->tail )
+    queue->tail->next = chunk;
+  else
+    queue->head = chunk;
+  queue->tail = chunk;
+  queue->num_bytes += length;
+  return CMNUTIL_TRUE;
+}
+
+static void
+tcp_out_queue_clear ( p_tcp_out_queue_t queue, p_io_scheduler_t scheduler )
+{
+  p_tcp_out_chunk_t chunk;
+  
+  if ( queue->io_task ) {
+    io_sched_unschedule_handle ( scheduler, queue->io_task_handle );
+    queue->io_task = NIL_IO_SCHEDULER_TASK;
+    queue->io_task_handle = IO_SCHEDULER_INVALID_HANDLE;
+  }
+  while ( ( chunk = queue->head ) ) {
+    queue->head = chunk->next;
+    free ( chunk );
+  }
+  queue->tail = (p_tcp_out_chunk_t) 0;
+  free ( queue->spare );
+  queue->spare = (p_tcp_out_chunk_t) 0;
+  queue->num_bytes = 0;
+}
+
+/**
+ * Writes as much queued data as the socket takes, up to TCP_OUT_QUEUE_MAX_IOV chunks per call.
+ * Returns 1 once the queue has drained, 0 when the socket is full, -1 on error (see errno). A
+ * drained queue gives up its spare chunk too, so that an idle connection holds no memory.
+ * sendmsg() stands in for writev() so that a peer that has gone away gets EPIPE rather than
+ * raising SIGPIPE, as with tcp_send().
+ **/
+static int
+tcp_out_queue_flush ( p_tcp_out_queue_t queue, sock_fd_t fd )
+{
+  struct iovec iov[TCP_OUT_QUEUE_MAX_IOV];
+  struct msghdr msg;
+  p_tcp_out_chunk_t chunk;
+  ssize_t bytes_sent;
+  size_t num_bytes;
+  
+  while ( queue->head ) {
+    memset ( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = iov;
+    for ( chunk = queue->head; chunk && ( msg.msg_iovlen < TCP_OUT_QUEUE_MAX_IOV ); chunk = chunk->next ) {
+      iov[msg.msg_iovlen].iov_base = chunk->data + chunk->start;
+      iov[msg.msg_iovlen].iov_len = chunk->end - chunk->start;
+      msg.msg_iovlen++;
+    }
+    
+    bytes_sent = sendmsg ( fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT );
+    if ( bytes_sent < 0 ) {
+      if ( errno == EINTR )
+        continue;
+      if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) )
+        return 0;
+      return -1;
+    }
+    
+    // Consume what was written: whole chunks from the head, then part of the next one.
+    queue->num_bytes -= (size_t) bytes_sent;
+    while ( bytes_sent > 0 ) {
+      chunk = queue->head;
+      num_bytes = chunk->end - chunk->start;
+      if ( (size_t) bytes_sent < num_bytes ) {
+        chunk->start += (size_t) bytes_sent;
+        break;
+      }
+      bytes_sent -= (ssize_t) num_bytes;
+      queue->head = chunk->next;
+      tcp_out_queue_release ( queue, chunk );
+    }
+    if ( !( queue->head ) )
+      queue->tail = (p_tcp_out_chunk_t) 0;
+  }
+  free ( queue->spare );
+  queue->spare = (p_tcp_out_chunk_t) 0;
+  return 1;
+}
+
+static void
+tcp_out_queue_release ( p_tcp_out_queue_t queue, p_tcp_out_chunk_t chunk )
+{
+  // One drained chunk of the usual size is kept back for the next one needed while the socket stays backed up.
+  if ( !( queue->spare ) && ( chunk->size == TCP_OUT_CHUNK_SIZE ) )
+    queue->spare = chunk;
+  else
+    free ( chunk );
+}
+
+/**
+ * Sends data straight away if nothing is queued ahead of it, and queues whatever the socket does
+ * not take, scheduling the writer task for it if it is not already.
+ **/
+static bool_t
+tcp_out_queue_send ( p_tcp_out_queue_t queue, p_io_scheduler_t scheduler, sock_fd_t fd,
+                     const void * data, size_t length, io_sched_priority_t priority,
+                     void * user_data, io_scheduler_cbk_t write_cbk )
+{
+  const char * bytes = (const char*) data;
+  ssize_t bytes_sent;
   
-  tcp_remote_client_destroy ( remcli );
+  if ( !( queue->head ) ) {
+    while ( length > 0 ) {
+      bytes_sent = send ( fd, bytes, length, MSG_NOSIGNAL | MSG_DONTWAIT );
+      if ( bytes_sent < 0 ) {
+        if ( errno == EINTR )
+          continue;
+        if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) )
+          break;
+        LOGSVC_ERROR( "tcp_out_queue_send(): Failed to send on socket %d: %s", fd, strerror ( errno ) );
+        return CMNUTIL_FALSE;
+      }
+      bytes += bytes_sent;
+      length -= (size_t) bytes_sent;
+    }
+    if ( !( length ) )
+      return CMNUTIL_TRUE;
+  }
   
+  if ( !( tcp_out_queue_append ( queue, bytes, length ) ) )
+    return CMNUTIL_FALSE;
+  
+  if ( !( queue->io_task ) ) {
+    // Level-triggered, so that it keeps coming back for as long as the socket has room.
+    queue->io_task =
+      io_sched_create_task ( scheduler,
+                             fd, IO_SCHEDULER_WRITE, IO_SCHEDULER_NO_TIMEOUT, IO_SCHEDULER_NO_SLACK, user_data,
+                             NIL_IO_SCHEDULER_CBK, write_cbk, write_cbk, NIL_IO_SCHEDULER_CBK );
+    io_sched_set_task_priority ( queue->io_task, priority );
+    queue->io_task_handle = io_sched_get_task_handle ( queue->io_task );
+    if ( !( io_sched_schedule_task ( queue->io_task ) ) ) {
+      LOGSVC_ERROR( "tcp_out_queue_send(): Unable to create/schedule writer task for socket %d.", fd );
+      if ( queue->io_task )
+        io_sched_unschedule_task ( queue->io_task );
+      queue->io_task = NIL_IO_SCHEDULER_TASK;
+      queue->io_task_handle = IO_SCHEDULER_INVALID_HANDLE;
+      tcp_out_queue_clear ( queue, scheduler );
+      return CMNUTIL_FALSE;
+    }
+  }
+  return CMNUTIL_TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//// read frames
+//////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Makes sure a connection has a buffer of its own to read into. One the last callback took a
+ * reference to is left to it, and a fresh one borrowed in its place.
+ **/
+static bool_t
+tcp_read_frame_borrow ( p_tcp_buffer_pool_t pool, p_tcp_buffer_t * frame )
+{
+  if ( *frame && ( ( *frame )->refs > 1 ) )
+    tcp_read_frame_return ( frame );
+  if ( !( *frame ) && pool )
+    *frame = tcp_buffer_pool_get ( pool );
+  return ( *frame != NIL_tcp_buffer );
+}
+
+static void
+tcp_read_frame_return ( p_tcp_buffer_t * frame )
+{
+  if ( *frame ) {
+    tcp_buffer_release ( *frame );
+    *frame = NIL_tcp_buffer;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//// scheduler calls
+//////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Makes fn(scheduler, arg) on the scheduler's own thread, and waits for it; made right here when
+ * that is the calling thread, or when the scheduler's loop is not running. The scheduler must not
+ * be stopped while the call waits, or it waits for good.
+ **/
+static void
+tcp_sched_call ( p_io_scheduler_t scheduler, io_sched_post_fn_t fn, void * arg )
+{
+  tcp_sched_call_t call;
+  
+  if ( !( scheduler->loop_running ) || pthread_equal ( scheduler->loop_thread, pthread_self () ) ) {
+    fn ( scheduler, arg );
+    return;
+  }
+  
+  memset ( &call, 0, sizeof( call ) );
+  call.fn = fn;
+  call.arg = arg;
+  pthread_mutex_init ( &( call.mutex ), (const pthread_mutexattr_t*) 0 );
+  pthread_cond_init ( &( call.cond ), (const pthread_condattr_t*) 0 );
+  if ( io_sched_post ( scheduler, tcp_sched_call_made, (void*) &call ) ) {
+    LOCK_MUTEX( call.mutex );
+    while ( !( call.done ) )
+      pthread_cond_wait ( &( call.cond ), &( call.mutex ) );
+    UNLOCK_MUTEX( call.mutex );
+  }
+  else {
+    LOGSVC_ERROR( "tcp_sched_call(): Unable to post to the scheduler's thread; making the call from this one." );
+    fn ( scheduler, arg );
+  }
+  pthread_cond_destroy ( &( call.cond ) );
+  pthread_mutex_destroy ( &( call.mutex ) );
+}
+
+static void
+tcp_sched_call_made ( p_io_scheduler_t scheduler, void * arg )
+{
+  p_tcp_sched_call_t call = (p_tcp_sched_call_t) arg;
+  
+  call->fn ( scheduler, call->arg );
+  LOCK_MUTEX( call->mutex );
+  call->done = CMNUTIL_TRUE;
+  pthread_cond_signal ( &( call->cond ) );
+  UNLOCK_MUTEX( call->mutex );
+}
+
+/**
+ * Unschedules the task whose handle is given as arg, if it is still there; a task that could not
+ * be scheduled after all has been released already.
+ **/
+static void
+tcp_sched_unschedule ( p_io_scheduler_t scheduler, void * arg )
+{
+  io_sched_unschedule_handle ( scheduler, (io_sched_handle_t)(uintptr_t) arg );
 }
 
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
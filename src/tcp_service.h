@@ -38,6 +38,7 @@
 #include "gccpch.h"
 
 #include "io-scheduler.h"
+#include "io-sched-group.h"
 
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 /* Constants  */
@@ -46,11 +47,35 @@
 #define TCP_CLIENT_CLOSED_LOCAL         0x0001
 #define TCP_CLIENT_CLOSED_REMOTE        0x0002
 
+/* Size of the buffers a listener's clients read into, unless given a pool of their own. */
+#define TCP_SERVICE_DEFAULT_READ_SIZE   512
+
+/* Connections a listener accepts per wakeup, and client instances it keeps back for reuse, unless told otherwise. */
+#define TCP_LISTENER_DEFAULT_ACCEPT_BUDGET  64
+#define TCP_LISTENER_DEFAULT_IDLE_CLIENTS   256
+
+/* Shared buffer pools come in powers of two between these sizes; see tcp_buffer_pool_shared(). */
+#define TCP_BUFFER_POOL_MIN_SHARED      512
+#define TCP_BUFFER_POOL_MAX_SHARED      ( 64 * 1024 )
+
+/* Number of idle buffers a shared pool keeps back for reuse. */
+#define TCP_BUFFER_POOL_SHARED_IDLE     64
+
+/* Largest frame a framer accepts unless told otherwise, and longest delimiter it can look for. */
+#define TCP_FRAMER_DEFAULT_MAX_FRAME    ( 1024 * 1024 )
+#define TCP_FRAMER_MAX_DELIMITER        8
+
+/* What a framer's scan function finds at the start of the data it is given. */
+#define TCP_FRAME_MALFORMED             -1
+#define TCP_FRAME_PARTIAL               0
+#define TCP_FRAME_COMPLETE              1
+
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 /* Type definitions and structures  */
 /* ---------- ---------- ---------- */
 
 // Forward declarations of structures for use in callback declarations.
+struct _tcp_buffer_pool;
 struct _tcp_client;
 struct _tcp_listener;
 struct _tcp_remote_client;
@@ -61,14 +86,29 @@ typedef void ( *tcp_client_closed_t ) ( struct _tcp_client * client, int reason
 
 typedef void ( *tcp_client_connected_t ) ( struct _tcp_client * client );
 
+/**
+ * @brief Callback invoked with data read from the server.
+ * @param client The tcp_client instance.
+ * @param response The data read, or a frame's payload with a framer; valid only for the duration of the callback,
+ *        unless it lies in client->read_frame and that is retained.
+ * @param response_len The length of the data.
+ * @return True when the conversation is over and the connection can be closed; otherwise, false.
+ **/
 typedef bool_t ( *tcp_client_server_responded_t ) ( struct _tcp_client * client, char * response, size_t response_len );
 
+/**
+ * @brief Callback invoked once data that tcp_client_send() had to queue has all been written to the server.
+ * @param client The tcp_client instance whose outgoing queue has drained.
+ **/
+typedef void ( *tcp_client_write_complete_t ) ( struct _tcp_client * client );
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /**
  * @brief Callback invoked when a remote client connects to an exposed TCP listener.
  * @param listener The tcp_listener instance that received a remote connection.
- * @param client The tcp_remote_client instance associated with the remote connection.
+ * @param client The tcp_remote_client instance associated with the remote connection. Its socket is non-blocking;
+ *        reply with tcp_remote_client_send(), which queues what the socket cannot take just yet.
  **/
 typedef void ( *tcp_listener_client_connected_t ) ( struct _tcp_listener * listener, struct _tcp_remote_client * client );
 
@@ -83,7 +123,8 @@ typedef void ( *tcp_listener_client_disconnected_t ) ( struct _tcp_listener * li
  * @brief Callback invoked when a remote client makes a request (data read from the remote client).
  * @param listener The tcp_listener instance owning the remote connection.
  * @param client The tcp_remote_client instance that sent the request.
- * @param request_contents The request data.
+ * @param request_contents The request data, or a frame's payload with a framer; valid only for the duration of the
+ *        callback, unless it lies in client->read_frame and that is retained (see tcp_buffer_retain()).
  * @param request_length The length of the request data.
  * @return True when remote client has completed its transaction and can be closed; otherwise, false.
  **/
@@ -106,6 +147,171 @@ typedef bool_t ( *tcp_listener_client_waiting_t ) ( struct _tcp_listener * liste
  **/
 typedef void ( *tcp_listener_closed_t ) ( struct _tcp_listener * listener );
 
+/**
+ * @brief Callback invoked once data that tcp_remote_client_send() had to queue has all been written to the client.
+ * @param listener The tcp_listener instance owning the remote connection.
+ * @param client The tcp_remote_client instance whose outgoing queue has drained.
+ * @note  Data the socket takes straight away is never queued, so this is not called for it; a sender holding off
+ *        while data is queued (see tcp_out_queue_t) picks up again from here.
+ **/
+typedef void ( *tcp_listener_client_write_complete_t ) ( struct _tcp_listener * listener, struct _tcp_remote_client * client );
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////
+////  tcp_buffer_pool
+////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief A receive buffer on loan from a tcp_buffer_pool, with a count of the references held to it.
+ *
+ * A connection borrows a buffer only while it has data to read, and gives it back once the socket runs dry, so that
+ * idle connections hold no buffer at all. A callback handed data in a buffer may keep it past its return by taking a
+ * reference with tcp_buffer_retain(), and dropping it later with tcp_buffer_release(), from any thread; the buffer
+ * goes back to its pool once the last reference is dropped.
+ **/
+typedef struct _tcp_buffer {
+  
+  struct _tcp_buffer_pool *           pool;
+  struct _tcp_buffer *                next;               /**< @brief Next idle buffer, while in the pool.          **/
+  volatile int                        refs;
+  size_t                              size;               /**< @brief Room in data.                                 **/
+  char                                data[];
+  
+} tcp_buffer_t, * p_tcp_buffer_t;
+
+/**
+ * @brief A pool of receive buffers of one size, recycled between the connections sharing it.
+ *
+ * Pools may be shared between any number of listeners and clients, on any number of schedulers. Buffers are allocated
+ * as they are needed; up to max_idle of those given back are kept for reuse, and the rest freed.
+ **/
+typedef struct _tcp_buffer_pool {
+  
+  pthread_mutex_t                     mutex;
+  p_tcp_buffer_t                      idle;
+  size_t                              buffer_size;
+  size_t                              num_idle;
+  size_t                              max_idle;
+  size_t                              num_out;            /**< @brief Buffers on loan.                              **/
+  size_t                              high_watermark;     /**< @brief Most buffers on loan at once.                 **/
+  
+  bool_t                              shared;             /**< @brief One of the tcp_buffer_pool_shared() pools.    **/
+  bool_t                              destroyed;          /**< @brief Freed once the last buffer on loan is back.   **/
+  
+} tcp_buffer_pool_t, * p_tcp_buffer_pool_t;
+
+#define NIL_tcp_buffer                  ( (p_tcp_buffer_t) 0 )
+#define NIL_tcp_buffer_pool             ( (p_tcp_buffer_pool_t) 0 )
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////
+////  tcp_framer
+////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct _tcp_framer;
+
+/**
+ * @brief Where a frame lies in the data scanned, as found by a framer's scan function.
+ **/
+typedef struct _tcp_frame_scan {
+  
+  size_t                              from;               /**< @brief In: bytes already scanned without finding an
+                                                                     end to the frame, for a delimiter search to
+                                                                     carry on from.                                 **/
+  size_t                              payload_offset;     /**< @brief Out: start of the frame's payload.            **/
+  size_t                              payload_length;     /**< @brief Out: length of the payload.                   **/
+  size_t                              frame_size;         /**< @brief Out: bytes the whole frame takes up; for a
+                                                                     partial frame, its size if already known,
+                                                                     otherwise zero.                                **/
+  
+} tcp_frame_scan_t;
+
+/**
+ * @brief Looks for a frame at the start of length bytes of data.
+ * @return TCP_FRAME_COMPLETE, TCP_FRAME_PARTIAL when more data is needed, or TCP_FRAME_MALFORMED.
+ **/
+typedef int ( *tcp_framer_scan_t ) ( const struct _tcp_framer * framer, const char * data, size_t length,
+                                     tcp_frame_scan_t * scan );
+
+/**
+ * @brief Splits a connection's byte stream into frames (messages), so that the request/response callback is called
+ *        once per complete frame, with only its payload, rather than once per read.
+ *
+ * A framer is set on a listener or client before it is started, and may be shared between any number of them; it
+ * holds no per-connection state. Use one of the tcp_framer_init_*() functions, or fill in scan (and whatever it
+ * needs) for framing of some other kind. Frames that arrive whole in a read are handed over straight from the read
+ * buffer; only one arriving in pieces is gathered up in the connection's frame_ring first. A connection sending a
+ * malformed frame, or one larger than max_frame, is closed.
+ **/
+typedef struct _tcp_framer {
+  
+  tcp_framer_scan_t                   scan;
+  size_t                              max_frame;          /**< @brief Largest payload accepted.                     **/
+  
+  size_t                              prefix_size;        /**< @brief Length prefix: bytes of big-endian length.    **/
+  size_t                              record_size;        /**< @brief Fixed-size records: bytes per record.         **/
+  char                                delimiter[TCP_FRAMER_MAX_DELIMITER];
+  size_t                              delimiter_length;   /**< @brief Delimited frames: bytes of delimiter.         **/
+  
+  void *                              user_data;          /**< @brief For a custom scan function.                   **/
+  
+} tcp_framer_t, * p_tcp_framer_t;
+
+/**
+ * @brief Bytes of a frame that arrived in pieces, gathered until the frame is complete; empty and unallocated between
+ *        such frames.
+ **/
+typedef struct _tcp_frame_ring {
+  
+  char *                              data;
+  size_t                              size;
+  size_t                              head;
+  size_t                              count;
+  size_t                              needed;             /**< @brief Size of the pending frame, if known.          **/
+  size_t                              scanned;            /**< @brief Bytes already scanned in vain.                **/
+  
+} tcp_frame_ring_t, * p_tcp_frame_ring_t;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////
+////  tcp_out_queue
+////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief A chunk of outgoing data, copied in by a send and waiting for the socket to take it.
+ **/
+typedef struct _tcp_out_chunk {
+  
+  struct _tcp_out_chunk *             next;
+  size_t                              start;              /**< @brief Offset of the first byte not yet written.     **/
+  size_t                              end;                /**< @brief Offset just past the last byte queued.        **/
+  size_t                              size;               /**< @brief Room in data.                                 **/
+  char                                data[];
+  
+} tcp_out_chunk_t, * p_tcp_out_chunk_t;
+
+/**
+ * @brief Outgoing data of a client that the socket could not take at once, in the order it was sent.
+ *
+ * Small sends are packed into the tail chunk; the whole chain is written with one scatter-gather call each time the
+ * scheduler reports the socket writable, through a writer task that is only scheduled while anything is queued.
+ * The queue belongs to the client's scheduler thread; sends from any other thread should be posted to it.
+ **/
+typedef struct _tcp_out_queue {
+  
+  p_tcp_out_chunk_t                   head;
+  p_tcp_out_chunk_t                   tail;
+  p_tcp_out_chunk_t                   spare;              /**< @brief Drained chunk kept while still backed up.     **/
+  size_t                              num_bytes;          /**< @brief Bytes queued and not yet written.             **/
+  
+  p_io_scheduler_task_t               io_task;            /**< @brief Writer task, while anything is queued.        **/
+  io_sched_handle_t                   io_task_handle;
+  
+} tcp_out_queue_t, * p_tcp_out_queue_t;
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////
 ////  tcp_listener
@@ -121,14 +327,52 @@ typedef struct _tcp_listener {
   p_io_scheduler_task_t                 io_task;
   void *                                user_data;
   
+  /* Scheduler the accept task belongs to, and the task's handle, for unscheduling it once it may have been released. */
+  p_io_scheduler_t                      io_scheduler;
+  io_sched_handle_t                     io_task_handle;
+  
   struct _tcp_remote_client *           clients;
   pthread_mutex_t                       clients_list_mutex;
   
+  /* Priority class of the listener's task and its clients' tasks; set before starting the listener. */
+  io_sched_priority_t                   priority;
+  
+  /* When set, accepted clients are spread over this group rather than sharing the listener's scheduler. */
+  p_io_sched_group_t                    client_group;
+  io_sched_group_assign_t               client_assign;
+  
+  /* Sharded listeners: a SO_REUSEPORT socket and accept task for each scheduler of a group, fd and io_task being the
+     first of them; see tcp_listener_start_sharded(). The tasks' handles stop them on their own schedulers. */
+  sock_fd_t *                           shard_fds;
+  p_io_scheduler_task_t *               shard_tasks;
+  io_sched_handle_t *                   shard_handles;
+  p_io_sched_group_t                    shard_group;
+  size_t                                num_shards;
+  
+  /* Pool the clients borrow read buffers from, unless given a read_buffer of their own. Defaults to the shared pool
+     of TCP_SERVICE_DEFAULT_READ_SIZE buffers; set before starting the listener. A pool the application sets stays
+     the application's, to destroy once done with the listener. */
+  p_tcp_buffer_pool_t                   buffer_pool;
+  
+  /* When set, on_client_request is called once per frame rather than once per read; see tcp_framer_t. */
+  const tcp_framer_t *                  framer;
+  
+  /* Most connections accepted each time the listening socket turns readable, the rest waiting for the next pass;
+     zero for TCP_LISTENER_DEFAULT_ACCEPT_BUDGET. */
+  size_t                                accept_budget;
+  
+  /* Client instances given back by disconnected clients, for the next to be accepted (linked through next, guarded
+     by clients_list_mutex); at most max_idle_clients are kept, TCP_LISTENER_DEFAULT_IDLE_CLIENTS to begin with. */
+  struct _tcp_remote_client *           idle_clients;
+  size_t                                num_idle_clients;
+  size_t                                max_idle_clients;
+  
   /* Callbacks */
   tcp_listener_client_connected_t       on_client_connected;
   tcp_listener_client_disconnected_t    on_client_disconnected;
   tcp_listener_client_request_t         on_client_request;
   tcp_listener_client_waiting_t         on_client_waiting;
+  tcp_listener_client_write_complete_t  on_client_write_complete;
   tcp_listener_closed_t                 on_closed;
   
 } tcp_listener_t, * p_tcp_listener_t;
@@ -156,9 +400,14 @@ typedef struct _tcp_remote_client {
   uint16_t                            remote_port;        /**< @brief Client remote port number.                    **/
   
   p_io_scheduler_task_t               io_task;            /**< @brief I/O scheduler task handling the client.       **/
-  char *                              read_buffer;        /**< @brief Buffer used for incoming client requests.     **/
-  size_t                              read_buffer_size;   /**< @brief Size of read buffer.                          **/
+  p_io_scheduler_t                    io_scheduler;       /**< @brief Scheduler the I/O task belongs to.            **/
+  io_sched_handle_t                   io_task_handle;     /**< @brief Handle of the I/O task, for unscheduling it.  **/
+  char *                              read_buffer;        /**< @brief Private read buffer; NULL to use the pool.    **/
+  size_t                              read_buffer_size;   /**< @brief Size of private read buffer.                  **/
+  p_tcp_buffer_t                      read_frame;         /**< @brief Buffer borrowed while reading, if any.        **/
+  tcp_frame_ring_t                    frame_ring;         /**< @brief Frame arriving in pieces, with a framer.      **/
   void *                              user_data;          /**< @brief Generic data buffer; application-specific.    **/
+  tcp_out_queue_t                     out_queue;          /**< @brief Data sent but not yet written to the socket.  **/
   
   p_tcp_listener_t                    owner;
   
@@ -187,10 +436,24 @@ typedef struct _tcp_client {
   uint16_t                            remote_port;
   
   p_io_scheduler_task_t               io_task;
+  p_io_scheduler_t                    io_scheduler;
+  io_sched_handle_t                   io_task_handle;
+  /* Private read buffer, freed with the client; when NULL, a buffer is borrowed from buffer_pool while reading and
+     held in read_frame. */
   char *                              read_buffer;
   size_t                              read_buffer_size;
+  p_tcp_buffer_pool_t                 buffer_pool;
+  p_tcp_buffer_t                      read_frame;
   void *                              user_data;
   
+  /* When set, on_server_responded is called once per frame rather than once per read; see tcp_framer_t. */
+  const tcp_framer_t *                framer;
+  tcp_frame_ring_t                    frame_ring;
+  tcp_out_queue_t                     out_queue;
+  
+  /* Priority class of the I/O task; set before starting the client. */
+  io_sched_priority_t                 priority;
+  
   // Built-in auto-reconnect??
   //bool_t                              reconnect_automatically;
   //int                                 reconnect_delay;
@@ -199,6 +462,7 @@ typedef struct _tcp_client {
   tcp_client_closed_t                 on_closed;
   tcp_client_connected_t              on_connected;
   tcp_client_server_responded_t       on_server_responded;
+  tcp_client_write_complete_t         on_write_complete;
   
 } tcp_client_t, * p_tcp_client_t;
 
@@ -211,6 +475,48 @@ typedef struct _tcp_client {
 /* Exposed functions     */
 /* ---------- ---------- */
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////  tcp_buffer_pool
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Creates a pool of receive buffers.
+ * @param buffer_size The size in bytes of each buffer.
+ * @param max_idle The most buffers kept for reuse once given back.
+ * @return The new pool, or NIL_tcp_buffer_pool on error.
+ **/
+p_tcp_buffer_pool_t tcp_buffer_pool_create ( size_t buffer_size, size_t max_idle );
+
+/**
+ * @brief Destroys a pool created with tcp_buffer_pool_create(); the shared pools are left alone.
+ * @param pool The pool. Buffers still on loan remain valid; the pool is freed once the last of them is given back.
+ **/
+void tcp_buffer_pool_destroy ( p_tcp_buffer_pool_t pool );
+
+/**
+ * @brief Borrows a buffer from the pool, allocating one if none is idle.
+ * @param pool The pool.
+ * @return The buffer, holding one reference, or NIL_tcp_buffer on error.
+ **/
+p_tcp_buffer_t tcp_buffer_pool_get ( p_tcp_buffer_pool_t pool );
+
+/**
+ * @brief Returns the process-wide pool of buffers of at least the given size, creating it on first use.
+ * @param buffer_size The size needed; rounded up to a power of two no smaller than TCP_BUFFER_POOL_MIN_SHARED.
+ * @return The pool, or NIL_tcp_buffer_pool if the size exceeds TCP_BUFFER_POOL_MAX_SHARED or on error.
+ **/
+p_tcp_buffer_pool_t tcp_buffer_pool_shared ( size_t buffer_size );
+
+/**
+ * @brief Drops a reference to a buffer, handing it back to its pool if it was the last.
+ **/
+void tcp_buffer_release ( p_tcp_buffer_t buffer );
+
+/**
+ * @brief Takes another reference to a buffer, to keep its data past the callback it was handed to.
+ **/
+void tcp_buffer_retain ( p_tcp_buffer_t buffer );
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////  tcp_client
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -248,12 +554,24 @@ void tcp_client_disconnect ( p_tcp_client_t client );
  * @brief Creates a new tcp_client instance.
  * @param rem_ip_str The IPv4 address of the remote host as a string.
  * @param rem_port The port to connect to on the remote host.
- * @param buffer_size The size in bytes of the read buffer for handling server responses.
+ * @param buffer_size The size in bytes of the read buffer for handling server responses; zero for the default. The
+ *        buffer is borrowed from the shared pool of that size while there is data to read.
  * @param client_userdata Application-specific data to be stored in the tcp_client instance.
  * @return The new tcp_client instance on success, or NIL_tcp_client on error.
  **/
 p_tcp_client_t tcp_client_init ( const char * rem_ip_str, uint16_t rem_port, size_t buffer_size, void * client_userdata );
 
+/**
+ * @brief Sends data to the remote host without blocking.
+ * @param client The tcp_client instance, connected.
+ * @param data The data to send.
+ * @param length The length of the data.
+ * @return True if the data was written or queued; false if the connection has failed or the data could not be queued.
+ * @note  Whatever the socket does not take at once is copied onto the client's out_queue and written as the socket
+ *        becomes writable, after which on_write_complete is called. Call from the client's scheduler thread.
+ **/
+bool_t tcp_client_send ( p_tcp_client_t client, const void * data, size_t length );
+
 /**
  * @brief Kicks off an I/O task that handles reading responses from the remote host.
  * @param client The tcp_client instance.
@@ -268,6 +586,38 @@ bool_t tcp_client_start ( p_tcp_client_t client, p_io_scheduler_t scheduler );
  **/
 void tcp_client_stop ( p_tcp_client_t client );
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////  tcp_framer
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Sets up a framer for frames ending in the given delimiter, which is not part of the payload.
+ * @param framer The framer.
+ * @param delimiter The delimiter, for example "\r\n"; up to TCP_FRAMER_MAX_DELIMITER bytes.
+ * @param delimiter_length The length of the delimiter.
+ * @param max_frame The largest payload accepted; zero for TCP_FRAMER_DEFAULT_MAX_FRAME.
+ * @return True on success; false if the delimiter is empty or too long.
+ **/
+bool_t tcp_framer_init_delimiter ( tcp_framer_t * framer, const char * delimiter, size_t delimiter_length,
+                                   size_t max_frame );
+
+/**
+ * @brief Sets up a framer for records all of the same size.
+ * @param framer The framer.
+ * @param record_size The size in bytes of each record.
+ * @return True on success; false for a zero record size.
+ **/
+bool_t tcp_framer_init_fixed ( tcp_framer_t * framer, size_t record_size );
+
+/**
+ * @brief Sets up a framer for frames made up of a big-endian (network byte order) payload length and the payload.
+ * @param framer The framer.
+ * @param prefix_size The size in bytes of the length prefix: 1, 2, 4 or 8.
+ * @param max_frame The largest payload accepted; zero for TCP_FRAMER_DEFAULT_MAX_FRAME.
+ * @return True on success; false for an unsupported prefix size.
+ **/
+bool_t tcp_framer_init_length_prefix ( tcp_framer_t * framer, size_t prefix_size, size_t max_frame );
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////  tcp_listener
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -275,6 +625,40 @@ void tcp_client_stop ( p_tcp_client_t client );
 void tcp_listener_destroy ( p_tcp_listener_t listener );
 p_tcp_listener_t tcp_listener_init ( uint16_t port, void * listener_userdata );
 bool_t tcp_listener_start ( p_tcp_listener_t listener, p_io_scheduler_t scheduler );
+
+/**
+ * @brief Starts the listener on one scheduler of a group, spreading the accepted clients over the whole group.
+ * @param listener The tcp_listener instance.
+ * @param group The group of I/O schedulers.
+ * @param assign How the scheduler for each accepted client is chosen.
+ * @return True if successful; otherwise, false.
+ * @note  Each client's callbacks run in the thread of the scheduler it was assigned to, so several clients of the
+ *        same listener may be serviced at once; the callbacks must be written with this in mind.
+ **/
+bool_t tcp_listener_start_group ( p_tcp_listener_t listener, p_io_sched_group_t group, io_sched_group_assign_t assign );
+/**
+ * @brief Starts a listener sharded over a group of schedulers, with a listening socket of its own on each.
+ * @param listener The tcp_listener instance, not yet started.
+ * @param group The schedulers; each gets a SO_REUSEPORT socket bound to the listener's port, and an accept task.
+ * @param steer_by_cpu When true, the kernel is asked to hand each connection to the socket of the CPU it arrives on
+ *        (see tcp_steer_reuseport_by_cpu()), which pays off with a group pinned to its CPUs, one scheduler per CPU;
+ *        otherwise, or where that is not supported, the kernel spreads connections by a hash of their addresses.
+ * @return True if every shard was started; otherwise false, with none left running and the listener holding the socket
+ *         manager's socket again, ready for tcp_listener_start().
+ * @note  The socket opened by tcp_listener_init() is given back first, so that the port can be shared; it must not
+ *        be held open elsewhere. Accepted clients stay on the scheduler that accepted them, and the on_client_waiting
+ *        and on_client_connected callbacks are called from every scheduler's thread, possibly at the same time.
+ **/
+bool_t tcp_listener_start_sharded ( p_tcp_listener_t listener, p_io_sched_group_t group, bool_t steer_by_cpu );
+
+/**
+ * @brief Stops accepting connections, and stops and destroys every client the listener has.
+ * @param listener The tcp_listener instance.
+ * @note  Whatever is torn down is torn down on the thread of the scheduler it runs on, and this waits for each of
+ *        them; the schedulers must keep running (or have been stopped already) until it returns. Call it from one
+ *        thread at a time, and not from a client callback of a listener started on a group or sharded, since the
+ *        other schedulers may be waiting on this one.
+ **/
 void tcp_listener_stop ( p_tcp_listener_t listener );
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -283,6 +667,18 @@ void tcp_listener_stop ( p_tcp_listener_t listener );
 
 void tcp_remote_client_destroy ( p_tcp_remote_client_t remcli );
 p_tcp_remote_client_t tcp_remote_client_init ( p_tcp_listener_t owner, sock_fd_t fd, in_addr_t rem_ip, uint16_t rem_port );
+
+/**
+ * @brief Sends data to the remote client without blocking.
+ * @param remcli The tcp_remote_client instance.
+ * @param data The data to send.
+ * @param length The length of the data.
+ * @return True if the data was written or queued; false if the connection has failed or the data could not be queued.
+ * @note  Whatever the socket does not take at once is copied onto the client's out_queue and written as the socket
+ *        becomes writable, after which the listener's on_client_write_complete is called. Call from the client's
+ *        scheduler thread (that is, from the listener's callbacks).
+ **/
+bool_t tcp_remote_client_send ( p_tcp_remote_client_t remcli, const void * data, size_t length );
 bool_t tcp_remote_client_start ( p_tcp_remote_client_t remcli );
 void tcp_remote_client_stop ( p_tcp_remote_client_t remcli );
 
@@ -92,6 +92,33 @@ tcp_accept_full_s ( sock_fd_t sockfd, char * remote_ip_str, size_t remote_ip_len
   return rv;
 }
 
+sock_fd_t
+tcp_accept_nonblocking ( sock_fd_t sockfd, in_addr_t * remote_ip, uint16_t * remote_port )
+{
+  struct sockaddr_in remote_addr;
+  socklen_t remote_addr_len = sizeof ( struct sockaddr_in );
+  sock_fd_t remote_sock_fd;
+  
+#ifdef SOCK_NONBLOCK
+  remote_sock_fd = accept4 ( sockfd, (struct sockaddr*) &remote_addr, &remote_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC );
+#else
+  remote_sock_fd = accept ( sockfd, (struct sockaddr*) &remote_addr, &remote_addr_len );
+  if ( remote_sock_fd != INVALID_SOCKET_FD ) {
+    fcntl ( remote_sock_fd, F_SETFL, fcntl ( remote_sock_fd, F_GETFL ) | O_NONBLOCK );
+    fcntl ( remote_sock_fd, F_SETFD, FD_CLOEXEC );
+  }
+#endif
+  
+  if ( remote_sock_fd != INVALID_SOCKET_FD ) {
+    if ( remote_ip )
+      *remote_ip = remote_addr.sin_addr.s_addr; /* Remember that this is in network byte order. */
+    if ( remote_port )
+      *remote_port = ntohs ( remote_addr.sin_port );
+  }
+  
+  return remote_sock_fd;
+}
+
 bool_t
 tcp_connect ( sock_fd_t sockfd, in_addr_t remote_ip, uint16_t remote_port,
               p_io_scheduler_t scheduler, tcp_callback_t on_conn_cbk )
@@ -272,7 +299,7 @@ tcp_create_bound_socket_full ( in_addr_t local_ip, uint16_t local_port )
       close ( rv );
       rv = INVALID_SOCKET_FD;
     }
-    if ( listen ( rv, 5 ) == -1 ) {
+    if ( ( rv != INVALID_SOCKET_FD ) && ( listen ( rv, SOMAXCONN ) == -1 ) ) {
       close ( rv );
       rv = INVALID_SOCKET_FD;
     }
@@ -291,6 +318,44 @@ tcp_create_bound_socket_full_s ( const char * local_ip_str, uint16_t local_port
     return INVALID_SOCKET_FD;
 }
 
+sock_fd_t
+tcp_create_bound_socket_reuseport ( in_addr_t local_ip, uint16_t local_port )
+{
+#ifdef SO_REUSEPORT
+  sock_fd_t rv;
+  struct sockaddr_in local_addr;
+  int flags = 1;
+  
+  rv = socket ( PF_INET, SOCK_STREAM, IPPROTO_TCP );
+  if ( rv != INVALID_SOCKET_FD )
+  {
+    setsockopt ( rv, SOL_SOCKET, SO_REUSEADDR, &flags, sizeof ( flags ) );
+    if ( setsockopt ( rv, SOL_SOCKET, SO_REUSEPORT, &flags, sizeof ( flags ) ) == -1 ) {
+      LOGSVC_ERROR( "tcp_create_bound_socket_reuseport(): unable to set SO_REUSEPORT: %s", strerror ( errno ) );
+      close ( rv );
+      return INVALID_SOCKET_FD;
+    }
+    memset ( &local_addr, 0, sizeof ( struct sockaddr_in ) );
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = local_ip;
+    local_addr.sin_port = htons ( local_port );
+    if ( ( bind ( rv, (struct sockaddr*) &local_addr, sizeof ( struct sockaddr_in ) ) == -1 ) ||
+         ( listen ( rv, SOMAXCONN ) == -1 ) )
+    {
+      LOGSVC_ERROR( "tcp_create_bound_socket_reuseport(): unable to listen on port %d: %s",
+                    local_port, strerror ( errno ) );
+      close ( rv );
+      rv = INVALID_SOCKET_FD;
+    }
+  }
+  
+  return rv;
+#else
+  LOGSVC_ERROR( "tcp_create_bound_socket_reuseport(): SO_REUSEPORT not supported" );
+  return INVALID_SOCKET_FD;
+#endif
+}
+
 sock_fd_t
 tcp_create_client_socket ( void )
 {
@@ -312,19 +377,40 @@ tcp_receive ( sock_fd_t sockfd, void * buffer, size_t buffer_size )
     return read ( sockfd, buffer, buffer_size );
 }
 
+/* Like tcp_receive(), but fails with EAGAIN rather than blocking once there is nothing left to
+   read, whatever mode the socket is in; for draining edge-triggered sockets. */
+ssize_t
+tcp_receive_nowait ( sock_fd_t sockfd, void * buffer, size_t buffer_size )
+{
+  if ( ( sockfd == INVALID_SOCKET_FD ) || !( buffer ) ) {
+    errno = EBADF;
+    return -1;
+  }
+  else
+    return recv ( sockfd, buffer, buffer_size, MSG_DONTWAIT );
+}
+
 ssize_t
 tcp_send ( sock_fd_t sockfd, const void * data, size_t data_length )
 {
   ssize_t bytes_sent = 0, tot_bytes_sent = 0;
   size_t bytes_remaining = data_length;
   uint8_t * bytes = (uint8_t*) data;
+  struct pollfd pfd;
   if ( ( sockfd != INVALID_SOCKET_FD ) && ( data ) && ( data_length ) ) {
     while ( bytes_remaining > 0 ) {
       bytes_sent = send ( sockfd, bytes, bytes_remaining, MSG_NOSIGNAL );
       if ( bytes_sent == -1 ) {
-	if ( ( bytes_sent == EAGAIN ) || ( bytes_sent == EINTR ) )
+	if ( errno == EINTR )
 	  continue;
-	return -1;
+	if ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) )
+	  return -1;
+	pfd.fd = sockfd;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	if ( ( poll ( &pfd, 1, -1 ) == -1 ) && ( errno != EINTR ) )
+	  return -1;
+	continue;
       }
       else if ( bytes_sent == 0 )
 	return 0;
@@ -350,6 +436,31 @@ tcp_set_socket_nonblocking ( sock_fd_t sockfd, bool_t onOff )
   }
 }
 
+bool_t
+tcp_steer_reuseport_by_cpu ( sock_fd_t sockfd, unsigned int num_sockets )
+{
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+  /* A = current CPU; A = A % num_sockets; return A. */
+  struct sock_filter code[] = {
+    { BPF_LD  | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+    { BPF_ALU | BPF_MOD | BPF_K, 0, 0, num_sockets },
+    { BPF_RET | BPF_A,           0, 0, 0 }
+  };
+  struct sock_fprog prog = { sizeof ( code ) / sizeof ( code[0] ), code };
+  
+  if ( !num_sockets )
+    return CMNUTIL_FALSE;
+  if ( setsockopt ( sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof ( prog ) ) == -1 ) {
+    LOGSVC_NOTICE( "tcp_steer_reuseport_by_cpu(): unable to attach steering program: %s", strerror ( errno ) );
+    return CMNUTIL_FALSE;
+  }
+  return CMNUTIL_TRUE;
+#else
+  LOGSVC_NOTICE( "tcp_steer_reuseport_by_cpu(): not supported on this platform" );
+  return CMNUTIL_FALSE;
+#endif
+}
+
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 /* Local functions       */
 /* ---------- ---------- */
@@ -390,14 +501,15 @@ tcp_io_scheduler_connect_cbk ( p_io_scheduler_task_t task, int errcode )
   
   sockfd = task->fd;
 
-  /* See if we timed out while waiting to connect to the server socket. */
-  if ( errcode == IO_SCHEDULER_ERR_OP_TIMEOUT )
+  /* See if we timed out while waiting to connect to the server socket, or the task could not be
+     scheduled after all. */
+  if ( errcode != IO_SCHEDULER_ERR_NONE )
     {
-      LOGSVC_TRACE( CATEGORY_NAME, "tcp_io_scheduler_connect_cbk(): timed out" );
+      LOGSVC_TRACE( CATEGORY_NAME, "tcp_io_scheduler_connect_cbk(): timed out or not scheduled (%d)", errcode );
       if ( pconn->on_connect_ud )
-        pconn->on_connect_ud ( task->owner, sockfd, 1, pconn->user_data );
+        pconn->on_connect_ud ( task->owner, sockfd, errcode, pconn->user_data );
       else
-        pconn->on_connect ( sockfd, 1 ); /* TODO: Change this "magic number" */
+        pconn->on_connect ( sockfd, errcode );
       close ( sockfd );
       return IO_SCHEDULER_TASK_COMPLETE;
     }
@@ -32,6 +32,15 @@ sock_fd_t tcp_accept_full_s ( sock_fd_t sockfd,
 			      char * remote_ip_str, size_t remote_ip_len,
 			      uint16_t * remote_port );
 
+/**
+ * Like tcp_accept_full(), but the accepted socket comes back non-blocking and close-on-exec, set
+ * in the same call where accept4() is to be had, and the listening socket's flags are left as
+ * they are. Make that non-blocking too when accepting in a loop, which then ends with EAGAIN.
+ **/
+sock_fd_t tcp_accept_nonblocking ( sock_fd_t sockfd,
+                                   in_addr_t * remote_ip,
+                                   uint16_t * remote_port );
+
 bool_t tcp_connect ( sock_fd_t sockfd,
                      in_addr_t remote_ip, uint16_t remote_port,
                      p_io_scheduler_t scheduler,
@@ -59,14 +68,36 @@ sock_fd_t tcp_create_bound_socket_full ( in_addr_t local_ip, uint16_t local_port
 
 sock_fd_t tcp_create_bound_socket_full_s ( const char * local_ip_str, uint16_t local_port );
 
+/**
+ * Creates a listening socket with SO_REUSEPORT set, so that any number of them may be bound to
+ * the same address and port, the kernel sharing incoming connections out between them.
+ **/
+sock_fd_t tcp_create_bound_socket_reuseport ( in_addr_t local_ip, uint16_t local_port );
+
 sock_fd_t tcp_create_client_socket ( void );
 
 ssize_t tcp_receive ( sock_fd_t sockfd, void * buffer, size_t buffer_size );
 
+ssize_t tcp_receive_nowait ( sock_fd_t sockfd, void * buffer, size_t buffer_size );
+
+/**
+ * Sends all of the data, or fails; never raises SIGPIPE. A non-blocking socket (every socket a
+ * tcp_listener accepts is one) is waited on with poll() whenever it is full, so this blocks the
+ * calling thread either way; from a scheduler callback, use tcp_remote_client_send() instead.
+ **/
 ssize_t tcp_send ( sock_fd_t sockfd, const void * data, size_t data_length );
 
 void tcp_set_socket_nonblocking ( sock_fd_t sockfd, bool_t onOff );
 
+/**
+ * Attaches a classic BPF program to the SO_REUSEPORT group of the given socket that hands each
+ * incoming connection to the socket of index (CPU handling it) modulo num_sockets, the index
+ * being the order in which the group's sockets were created. With one socket per CPU, each served
+ * by a thread pinned to that CPU, a connection is then accepted on the CPU it arrived on.
+ * @return True if the program was attached; false if not supported, leaving the kernel's hashing.
+ **/
+bool_t tcp_steer_reuseport_by_cpu ( sock_fd_t sockfd, unsigned int num_sockets );
+
 /* ---------- ---------- ---------- ---------- ---------- ---------- ---------- ---------- */
 
 #endif /* TCP_SOCKS_H__ */